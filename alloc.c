@@ -22,15 +22,93 @@
  * and using these wrappers gives us a chance to free some memory and try
  * again instead of dying.
  *
- * free() is ok.
+ * The big consumers of memory allocate with Tmalloc() and Tfree(), which
+ * tag each allocation with the subsystem it's for so that we can say where
+ * the memory has gone and, with --max-memory, cap the total.
+ * Memory that libraries allocate for us is reported with mem_account().
+ *
+ * When memory is short, the allocator asks the "shedders" (the result cache,
+ * the scheduler's off-screen work and others) to let go of what they can spare
+ * and tries again. They only run in the main thread, which owns the result
+ * cache, so other threads ask the main loop to do it and wait a little.
+ *
+ * free() is ok for memory from Malloc(), Calloc() and Realloc().
  */
 
 #include "spettro.h"
 #include "alloc.h"
 
+#include "lock.h"
+
+#include <unistd.h>	/* for usleep() */
+
+size_t max_memory = 0;		/* --max-memory: 0 means no limit */
+
+static size_t current[N_MEM_TAGS];	/* Bytes in use by each subsystem */
+static size_t peak[N_MEM_TAGS];		/* and the most they have used */
+static size_t total = 0;		/* The sum of current[] */
+static size_t peak_total = 0;
+
+static char *tag_name[N_MEM_TAGS] = {
+    "results", "audio cache", "work", "windows", "FFT", "framebuffer",
+    "features"
+};
+
+#define MAX_SHEDDERS 8
+static void (*shedder[MAX_SHEDDERS])(void);
+static int shedders = 0;
+
+static bool shedding = FALSE;	/* Are the shedders running? */
+static bool shed_wanted = FALSE; /* Has another thread asked for shedding? */
+
+/* How many times and for how long other threads wait for the main loop
+ * to shed memory before giving up */
+#define SHED_TRIES 10
+#define SHED_WAIT  50000	/* microseconds */
+
+/* Run the shedders if we're in the main thread, otherwise ask it to */
+static void
+shed(void)
+{
+    if (get_thread_role() == ROLE_MAIN) {
+	int i;
+
+	/* Shedding may itself allocate memory; don't recurse */
+	if (shedding) return;
+	shedding = TRUE;
+	for (i = 0; i < shedders; i++) (*shedder[i])();
+	shedding = FALSE;
+	shed_wanted = FALSE;
+    } else {
+	shed_wanted = TRUE;
+	usleep(SHED_WAIT);
+    }
+}
+
+/* Would "size" more bytes fit under --max-memory? */
+static bool
+fits(size_t size)
+{
+    bool ok;
+
+    if (max_memory == 0) return TRUE;
+    lock_memory();
+    ok = total + size <= max_memory;
+    unlock_memory();
+    return ok;
+}
+
+/*
+ * Public functions
+ */
+
 void *Malloc(size_t size)
 {
     void *mem = malloc(size);
+    if (!mem) {
+	shed();
+	mem = malloc(size);
+    }
     if (!mem) {
     	fprintf(stderr, "Cannot allocate %d bytes\n", (int) size);
 	abort();
@@ -41,13 +119,121 @@ void *Malloc(size_t size)
 void *Calloc(size_t nmemb, size_t size)
 {
     void *mem = calloc(nmemb, size);
-    if (!mem) abort();
+    if (!mem) {
+	shed();
+	mem = calloc(nmemb, size);
+    }
+    if (!mem) {
+	fprintf(stderr, "Cannot allocate %d bytes\n", (int) (nmemb * size));
+	abort();
+    }
     return(mem);
 }
 
 void *Realloc(void *ptr, size_t size)
 {
     void *mem = realloc(ptr, size);
-    if (!mem) abort();
+    if (!mem) {
+	shed();
+	mem = realloc(ptr, size);
+    }
+    if (!mem) {
+	fprintf(stderr, "Cannot reallocate %d bytes\n", (int) size);
+	abort();
+    }
     return(mem);
 }
+
+/* Is there room for another "size" bytes for "tag" under --max-memory?
+ * If not, ask for memory to be shed and see again.
+ * It's for callers who have something else to do if there isn't,
+ * like the pools, whose free lists may be refilled by shedding. */
+bool
+mem_room(mem_tag_t tag, size_t size)
+{
+    int tries;
+
+    for (tries = 0; !fits(size); tries++) {
+	if (tries == SHED_TRIES ||
+	    (tries > 0 && get_thread_role() == ROLE_MAIN))
+	    return FALSE;
+	shed();
+    }
+    return TRUE;
+}
+
+/* Allocate memory for a subsystem, keeping count of it */
+void *
+Tmalloc(mem_tag_t tag, size_t size)
+{
+    void *mem;
+
+    if (!mem_room(tag, size)) {
+	fprintf(stderr,
+		"Another %lu bytes for the %s would exceed --max-memory\n",
+		(unsigned long) size, tag_name[tag]);
+	print_memory_usage();
+	abort();
+    }
+    mem = Malloc(size);
+    mem_account(tag, (long) size);
+
+    return mem;
+}
+
+/* Free memory obtained from Tmalloc(). "size" is what was asked for. */
+void
+Tfree(mem_tag_t tag, void *ptr, size_t size)
+{
+    if (ptr == NULL) return;
+    free(ptr);
+    mem_account(tag, -(long) size);
+}
+
+/* Record memory allocated or freed on behalf of a subsystem */
+void
+mem_account(mem_tag_t tag, long delta)
+{
+    lock_memory();
+    current[tag] += delta;
+    total += delta;
+    if (current[tag] > peak[tag]) peak[tag] = current[tag];
+    if (total > peak_total) peak_total = total;
+    unlock_memory();
+}
+
+/* Add a function that frees memory it can do without. They are called
+ * in the main thread, in the order they were added. */
+void
+mem_add_shedder(void (*fn)(void))
+{
+    if (shedders == MAX_SHEDDERS) {
+	fprintf(stderr, "Internal error: Too many memory shedders; increase MAX_SHEDDERS\n");
+	exit(1);
+    }
+    shedder[shedders++] = fn;
+}
+
+/* Called regularly by the main loop to shed memory for other threads */
+void
+mem_shed_if_wanted()
+{
+    if (shed_wanted) shed();
+}
+
+/* Print the current and peak memory use of each subsystem */
+void
+print_memory_usage()
+{
+    int tag;
+
+    lock_memory();
+    printf("Memory (MB):");
+    for (tag = 0; tag < N_MEM_TAGS; tag++)
+	printf(" %s %.1f (peak %.1f),", tag_name[tag],
+	       current[tag] / 1048576.0, peak[tag] / 1048576.0);
+    printf(" total %.1f (peak %.1f)", total / 1048576.0, peak_total / 1048576.0);
+    if (max_memory != 0) printf(" of %.1f", max_memory / 1048576.0);
+    printf("\n");
+    unlock_memory();
+}
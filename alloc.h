@@ -19,6 +19,34 @@
  *
  * All callers include spettro.h, which contains the necessary #includes */
 
+#ifndef ALLOC_H
+
+/* The subsystems whose memory use we keep track of */
+typedef enum {
+    MEM_RESULTS,	/* The result cache's spectra */
+    MEM_AUDIO,		/* The audio cache */
+    MEM_WORK,		/* calc_t's for scheduled work and results */
+    MEM_WINDOWS,	/* Window functions */
+    MEM_FFT,		/* FFTW's input and output buffers */
+    MEM_FRAMEBUFFER,	/* The screen image */
+    MEM_FEATURES,	/* The per-column features */
+    N_MEM_TAGS
+} mem_tag_t;
+
+extern size_t max_memory;	/* --max-memory in bytes, 0 means no limit */
+
 void *Malloc(size_t size);
 void *Calloc(size_t nmemb, size_t size);
 void *Realloc(void *ptr, size_t size);
+
+void *Tmalloc(mem_tag_t tag, size_t size);
+void  Tfree(mem_tag_t tag, void *ptr, size_t size);
+bool  mem_room(mem_tag_t tag, size_t size);
+void  mem_account(mem_tag_t tag, long delta);
+
+void  mem_add_shedder(void (*fn)(void));
+void  mem_shed_if_wanted(void);
+void  print_memory_usage(void);
+
+#define ALLOC_H
+#endif
@@ -22,11 +22,22 @@
 #include "spettro.h"
 #include "args.h"
 
+#include "audio.h"
 #include "audio_file.h"
 #include "barlines.h"
 #include "colormap.h"
 #include "convert.h"
+#include "dump.h"
+#include "fft.h"
+#include "lock.h"
+#include "fingerprint.h"
+#include "pyramid.h"
+#include "script.h"
+#include "shared_cache.h"
+#include "startup.h"
+#include "stream.h"
 #include "ui.h"
+#include "video.h"
 
 #include <ctype.h>	/* for tolower() */
 #include <errno.h>
@@ -76,6 +87,35 @@ usage(void)
        K for Kaiser, D for Dolph, N for Nuttall, B for Blackman, H for Hann\n\
 -m map Select a color map: heatmap, gray or print\n\
 -o f   Display the spectrogram, dump it to file f in PNG format and quit\n\
+--png-compression n  Compress PNG files with zlib level n, 0-9. Default: 3\n\
+--png-filter f  Filter PNG rows with none, sub, up, avg or paeth. Default: sub\n\
+--pyramid  Build pooled columns in the background for instant zooming out,\n\
+           showing the loudest sound in each. --pyramid-mean shows the average\n\
+--raw rate:channels:format  The file is raw audio, or live raw audio if it's\n\
+           a FIFO or - for stdin. format is u8, s8, s16, s24, s32, f32 or f64,\n\
+           and le or be if it's not in this machine's byte order: 44100:2:s16le\n\
+--capture  Show live audio from the default SDL2 capture device\n\
+--low-latency  Play through a small device buffer and scroll by the sound\n\
+           card's clock, so that picture and sound line up (SDL2 only)\n\
+--audio-buffer n  Make the sound card's buffer n sample frames long,\n\
+           rounded down to a power of two (default 256 with --low-latency)\n\
+--lock-stats  Measure contention for each lock, shown by Shift-P and on exit\n\
+--max-memory n  Limit spettro's big memory users to n bytes, or nK, nM or nG.\n\
+           Off-screen results and work are dropped to stay under it.\n\
+--shared-cache n  Share FFT results with your other spettros viewing the same\n\
+           file through an n-byte shared memory segment (nK, nM or nG)\n\
+--fft-calibration file  Time the FFT sizes near each one that's used with\n\
+           FFTW and our own power-of-two FFT and use the fastest, keeping\n\
+           the results in this file for next time\n\
+--fp-index file  Keep the index used by the J key in this file, reading it\n\
+           from there next time instead of indexing the audio file again\n\
+--startup-times  Report how long it takes to show the window, open the file,\n\
+           paint the first column and fill the screen, then quit\n\
+--script file  Replay the key presses and mouse events in a file, reporting\n\
+           how long each step takes, then quit. See script.c for the format\n\
+--video file  Write the scrolling display as video to a file, or - for stdout,\n\
+           at the --fps rate as fast as it can be calculated, then quit\n\
+--video-format f  Write YUV4MPEG2 (y4m, the default) or raw 24-bit RGB (rgb)\n\
 --version  Which version of spettro is this, and which libraries does it use?\n\
 --keys Show which key presses do what, and quit\n\
 --help This!\n");
@@ -99,21 +139,34 @@ Ctrl +/-   Zoom both axes\n\
 m          Cycle through the color maps: heatmap/grayscale/gray for printers\n\
 c/C        Decrease/increase the contrast by 6dB (by 1dB if Ctrl is held down)\n\
 b/B        Decrease/increase the brightness by 6dB\n\
+e          Set the brightness and contrast to suit the visible columns\n\
+E          Print the visible columns' level, spectral centroid, flux and\n\
+           loudest frequency on stdout as CSV\n\
 f/F        Halve/double the length of the sample taken to calculate each column\n\
 Ctrl K/D/N/B/H  Set the window function to Kaiser/Dolph/Nuttall/Blackman/Hann\n\
 w/W        Cycle forward/backward through the window functions\n\
+v/V        Cycle forward/backward through showing each channel and their mix\n\
 a          Toggle the frequency axes\n\
 A          Toggle the time axis and status line\n\
+Ctrl A     Toggle performance figures in place of the status line: FFT columns\n\
+           per second, queued FFTs for each priority class (visible/lookahead)\n\
+           + running ones and batch threads, each class's time to a result,\n\
+           result cache size and hit rate, frame time, missed frames,\n\
+           audio underruns and each thread's load\n\
 k          Toggle the overlay of frequencies of a grand piano's 88 keys\n\
 s          Toggle the overlay of conventional staff lines\n\
 g          Toggle the overlay of frequencies of a classical guitar's strings\n\
 l/r        Set the left/right bar markers for an overlay of bar lines\n\
 1-9/F1-F12 Set the number of beats per bar (1 or F1 means \"no beat lines\")\n\
 0          Remove the bar lines\n\
+j/J        Go to the next/previous place where the passage between the bar\n\
+           lines recurs. The first press starts indexing the audio file\n\
+           in the background\n\
 +/-        Increase/decrease the soft volume control\n\
 t          Show the current playing time on stdout\n\
 o          Output (save) the current screenful into a PNG file\n\
-Ctrl P     Show the playing time and settings on stdout\n\
+Ctrl P     Show the playing time, settings and memory use on stdout\n\
+P          Show the lock contention statistics on stdout (with --lock-stats)\n\
 Ctrl L     Redraw the display from cached FFT results\n\
 Ctrl R     Redraw the display by recalculating from the audio data\n\
 Ctrl F     Flip full-screen mode\n\
@@ -131,6 +184,28 @@ badarg(char *arg)
     exit(1);
 }
 
+/* A size in bytes, optionally followed by K, M or G */
+static size_t
+parse_size(char *option, char *arg)
+{
+    double size;
+    char *suffix;
+
+    size = strtod(arg, &suffix);
+    switch (tolower(*suffix)) {
+    case 'g': size *= 1024;	/* and fall through */
+    case 'm': size *= 1024;
+    case 'k': size *= 1024;
+    case '\0': break;
+    default: size = 0.0;
+    }
+    if (size < 1.0) {
+	fprintf(stderr, "%s must be a number of bytes, optionally with K, M or G after it\n", option);
+	exit(1);
+    }
+    return (size_t) size;
+}
+
 /*
  * Process command-line options, leaving argv pointing at the first filename
  */
@@ -191,6 +266,125 @@ switch_again:
 	    else if (!strcmp(argv[0], "--fps")) argv[0] = "-R";
 	    else if (!strcmp(argv[0], "--ppsec")) argv[0] = "-P";
 	    /* Flags with no single-letter equivalent */
+	    else if (!strcmp(argv[0], "--pyramid")) {
+		use_pyramid = PYRAMID_MAX;
+		continue;
+	    } else if (!strcmp(argv[0], "--pyramid-mean")) {
+		use_pyramid = PYRAMID_MEAN;
+		continue;
+	    } else if (!strcmp(argv[0], "--raw")) {
+		if (argc < 2) {
+		    fprintf(stderr, "--raw what?\n");
+		    exit(1);
+		}
+		argv++, argc--;
+		stream_format = argv[0];
+		continue;
+	    } else if (!strcmp(argv[0], "--capture")) {
+		stream_capture = TRUE;
+		continue;
+	    } else if (!strcmp(argv[0], "--low-latency")) {
+		low_latency = TRUE;
+		continue;
+	    } else if (!strcmp(argv[0], "--audio-buffer")) {
+		if (argc < 2) {
+		    fprintf(stderr, "--audio-buffer what?\n");
+		    exit(1);
+		}
+		argv++, argc--;
+		audio_buffer = atoi(argv[0]);
+		if (audio_buffer < 16) {
+		    fprintf(stderr, "--audio-buffer must be at least 16 frames\n");
+		    exit(1);
+		}
+		continue;
+	    } else if (!strcmp(argv[0], "--lock-stats")) {
+		lock_stats = TRUE;
+		continue;
+	    } else if (!strcmp(argv[0], "--max-memory")) {
+		if (argc < 2) {
+		    fprintf(stderr, "--max-memory what?\n");
+		    exit(1);
+		}
+		argv++, argc--;
+		max_memory = parse_size("--max-memory", argv[0]);
+		continue;
+	    } else if (!strcmp(argv[0], "--shared-cache")) {
+		if (argc < 2) {
+		    fprintf(stderr, "--shared-cache what?\n");
+		    exit(1);
+		}
+		argv++, argc--;
+		shared_cache_size = parse_size("--shared-cache", argv[0]);
+		if (shared_cache_size < 1024 * 1024) {
+		    fprintf(stderr, "--shared-cache needs at least 1M\n");
+		    exit(1);
+		}
+		continue;
+	    } else if (!strcmp(argv[0], "--fp-index")) {
+		if (argc < 2) {
+		    fprintf(stderr, "--fp-index what?\n");
+		    exit(1);
+		}
+		argv++, argc--;
+		fp_index_file = argv[0];
+		continue;
+	    } else if (!strcmp(argv[0], "--png-compression")) {
+		if (argc < 2 || (png_compression = atoi(argv[1])) < 0 ||
+		    png_compression > 9 || !isdigit(argv[1][0])) {
+		    fprintf(stderr, "--png-compression must be from 0 to 9\n");
+		    exit(1);
+		}
+		argv++, argc--;
+		continue;
+	    } else if (!strcmp(argv[0], "--png-filter")) {
+		if (argc < 2 || !set_png_filter(argv[1])) {
+		    fprintf(stderr, "--png-filter must be none, sub, up, avg or paeth\n");
+		    exit(1);
+		}
+		argv++, argc--;
+		continue;
+	    } else if (!strcmp(argv[0], "--video")) {
+		if (argc < 2) {
+		    fprintf(stderr, "--video what?\n");
+		    exit(1);
+		}
+		argv++, argc--;
+		video_file = argv[0];
+		continue;
+	    } else if (!strcmp(argv[0], "--video-format")) {
+		if (argc < 2) {
+		    fprintf(stderr, "--video-format what?\n");
+		    exit(1);
+		}
+		argv++, argc--;
+		if (!strcmp(argv[0], "y4m")) video_format = VIDEO_Y4M;
+		else if (!strcmp(argv[0], "rgb")) video_format = VIDEO_RGB;
+		else {
+		    fprintf(stderr, "--video-format must be y4m or rgb\n");
+		    exit(1);
+		}
+		continue;
+	    } else if (!strcmp(argv[0], "--startup-times")) {
+		startup_times = TRUE;
+		continue;
+	    } else if (!strcmp(argv[0], "--fft-calibration")) {
+		if (argc < 2) {
+		    fprintf(stderr, "--fft-calibration what?\n");
+		    exit(1);
+		}
+		argv++, argc--;
+		fft_calibration_file = argv[0];
+		continue;
+	    } else if (!strcmp(argv[0], "--script")) {
+		if (argc < 2) {
+		    fprintf(stderr, "--script what?\n");
+		    exit(1);
+		}
+		argv++, argc--;
+		script_file = argv[0];
+		continue;
+	    }
 	    else if (!strcmp(argv[0], "--version")) {
 		print_version();
 		exit(0);
@@ -24,10 +24,13 @@
 
 #include "audio_cache.h"
 #include "gui.h"
+#include "hud.h"
 #include "lock.h"
+#include "stream.h"
 #include "ui.h"
 
 #include <sys/time.h>	/* for gettimeofsay() */
+#include <unistd.h>	/* for usleep() */
 
 
 #if EMOTION_AUDIO
@@ -43,16 +46,56 @@ static off_t sdl_start = 0;	/* At what offset in the audio file, in frames,
 				 * will we next read samples to play? */
 static void sdl_fill_audio(void *userdata, Uint8 *stream, int len);
 static unsigned SDL_buffer_size;	/* In sample frames */
+static bool sdl_filling = FALSE;	/* Has the callback been called since
+					 * the player was last (re)started? */
+static struct timeval sdl_last_fill;	/* When it was last called */
+static void apply_softvol(short *sp, int nsamples);
 
+#if SDL2
+/*
+ * --low-latency: Instead of SDL calling sdl_fill_audio() for a buffer at a
+ * time, a thread of ours keeps SDL's queue topped up with a couple of small
+ * device buffers' worth of audio. The sound coming out now is then what
+ * has left the queue less what the device is still holding, which SDL's
+ * queued-audio accounting tells us exactly.
+ */
+static int sdl_feed_audio(void *data);
+static double low_latency_position(void);
+static SDL_Thread *feeder = NULL;
+static volatile bool feeder_quit;
+static off_t consumed = -1;		/* Frames the device had taken */
+static struct timeval consumed_at;	/* when we saw that */
+
+#define LOW_LATENCY_FRAMES 256	/* Default device buffer, about 5ms */
+#define QUEUE_BUFFERS 2		/* How many of them to keep queued */
 #endif
 
+#endif
+
+bool low_latency = FALSE;	/* --low-latency */
+int audio_buffer = 0;		/* --audio-buffer in frames, 0 = choose */
+
 static void set_real_start_time(double when);
 
 enum playing playing = PAUSED;
 
+/* Live input isn't played: "playing" just means following its newest audio,
+ * and when paused we stay at live_time. */
+static bool live = FALSE;
+static double live_time = 0.0;
+
 void
 init_audio(audio_file_t *af, char *filename)
 {
+    if ((live = af->live)) return;
+
+#if !(SDL_AUDIO && SDL2)
+    if (low_latency) {
+	fprintf(stderr, "--low-latency needs SDL2 audio\n");
+	low_latency = FALSE;
+    }
+#endif
+
 #if EMOTION_AUDIO
     /* Set audio player callbacks */
     evas_object_smart_callback_add(em, "playback_finished",
@@ -84,7 +127,10 @@ init_audio(audio_file_t *af, char *filename)
 	    fprintf(stderr, "Internal error: init_audio() was called before \"sample_rate\" was initialized.\n");
 	    exit(1);
 	}
-	wavspec.samples = lrint(secpp * sample_rate * af->channels);
+	/* SDL's "samples" is in sample frames, whatever the channel count */
+	wavspec.samples = lrint(secpp * sample_rate);
+	if (low_latency) wavspec.samples = LOW_LATENCY_FRAMES;
+	if (audio_buffer > 0) wavspec.samples = audio_buffer;
 	/* SDL sometimes requires a power-of-two buffer,
 	 * failing to work if it isn't, so reduce it to such */
 	{
@@ -95,14 +141,29 @@ init_audio(audio_file_t *af, char *filename)
 	    }
 	    wavspec.samples = 1 << (places - 1);
 	}
-	SDL_buffer_size = wavspec.samples / af->channels;
+	SDL_buffer_size = wavspec.samples;
 	wavspec.callback = sdl_fill_audio;
 	wavspec.userdata = af;
+#if SDL2
+	/* With no callback, SDL plays whatever we queue for it */
+	if (low_latency) wavspec.callback = NULL;
+#endif
 
 	if (SDL_OpenAudio(&wavspec, NULL) < 0) {
 	    fprintf(stderr, "Couldn't initialize SDL audio: %s.\n", SDL_GetError());
 	    exit(1);
 	}
+#if SDL2
+	if (low_latency) {
+	    feeder_quit = FALSE;
+	    feeder = SDL_CreateThread(sdl_feed_audio, "audio", af);
+	    if (feeder == NULL) {
+		fprintf(stderr, "Couldn't start the audio thread: %s.\n",
+			SDL_GetError());
+		exit(1);
+	    }
+	}
+#endif
     }
 #else
 # error "Define one of EMOTION_AUDIO and SDL_AUDIO"
@@ -113,12 +174,15 @@ init_audio(audio_file_t *af, char *filename)
 void
 reinit_audio(audio_file_t *af, char *filename)
 {
+    if (live) return;
+
 #if EMOTION_AUDIO
     if (emotion_object_file_set(em, filename) != EINA_TRUE) {
 	fputs("Couldn't load audio file. Try compiling with -DUSE_EMOTION_SDL in Makefile.am\n", stderr);
 	exit(1);
     }
 #elif SDL_AUDIO
+    close_audio();
     SDL_QuitSubSystem(SDL_INIT_AUDIO);
     init_audio(af, filename);
 #else
@@ -126,6 +190,19 @@ reinit_audio(audio_file_t *af, char *filename)
 #endif
 }
 
+/* Stop the --low-latency audio thread, before SDL shuts down */
+void
+close_audio()
+{
+#if SDL_AUDIO && SDL2
+    if (feeder != NULL) {
+	feeder_quit = TRUE;
+	SDL_WaitThread(feeder, NULL);
+	feeder = NULL;
+    }
+#endif
+}
+
 #if EMOTION_AUDIO
 /*
  * Callback is called when the player gets to the end of the piece.
@@ -145,10 +222,27 @@ playback_finished_cb(void *data, Evas_Object *obj, void *ev)
 void
 pause_audio()
 {
+    if (live) {
+	live_time = stream_live_time();
+	playing = PAUSED;
+	return;
+    }
 #if EMOTION_AUDIO
     emotion_object_play_set(em, EINA_FALSE);
 #endif
 #if SDL_AUDIO
+# if SDL2
+    /* Stop where the sound stopped, not where the queue ended */
+    if (low_latency) {
+	double now = low_latency_position();
+
+	SDL_PauseAudio(1);
+	SDL_LockAudio();
+	SDL_ClearQueuedAudio(1);
+	sdl_start = llrint(now);
+	SDL_UnlockAudio();
+    } else
+# endif
     SDL_PauseAudio(1);
 #endif
     playing = PAUSED;
@@ -158,10 +252,18 @@ pause_audio()
 void
 start_playing()
 {
+    if (live) {
+	playing = PLAYING;
+	return;
+    }
 #if EMOTION_AUDIO
     emotion_object_play_set(em, EINA_TRUE);
 #endif
 #if SDL_AUDIO
+    sdl_filling = FALSE;
+# if SDL2
+    consumed = -1;
+# endif
     SDL_PauseAudio(0);
 #endif
     set_real_start_time(disp_time);
@@ -172,6 +274,10 @@ start_playing()
 void
 stop_playing()
 {
+    if (live) {
+	playing = PAUSED;
+	return;
+    }
 #if EMOTION_AUDIO
     emotion_object_play_set(em, EINA_FALSE);
 #endif
@@ -190,6 +296,10 @@ stop_playing()
 void
 continue_playing()
 {
+    if (live) {
+	playing = PLAYING;
+	return;
+    }
 #if EMOTION_AUDIO
     /* Resynchronise the playing position to the display,
      * as emotion stops playing immediately but seems to throw away
@@ -199,7 +309,14 @@ continue_playing()
     emotion_object_play_set(em, EINA_TRUE);
 #endif
 #if SDL_AUDIO
-    sdl_start = lrint(disp_time * current_sample_rate());
+    SDL_LockAudio();
+# if SDL2
+    if (low_latency) SDL_ClearQueuedAudio(1);
+    consumed = -1;
+# endif
+    sdl_start = llrint(disp_time * current_sample_rate());
+    SDL_UnlockAudio();
+    sdl_filling = FALSE;
     SDL_PauseAudio(0);
 #endif
     set_real_start_time(disp_time);
@@ -221,11 +338,22 @@ static bool use_real_start_time = FALSE; /* Should we use real_start_time? */
 void
 set_playing_time(double when)
 {
+    if (live) {
+	live_time = when;
+	return;
+    }
 #if EMOTION_AUDIO
     emotion_object_position_set(em, when);
 #endif
 #if SDL_AUDIO
-    sdl_start = lrint(when * current_sample_rate());
+    SDL_LockAudio();
+# if SDL2
+    /* Drop the audio queued for the old position */
+    if (low_latency) SDL_ClearQueuedAudio(1);
+    consumed = -1;
+# endif
+    sdl_start = llrint(when * current_sample_rate());
+    SDL_UnlockAudio();
 #endif
     set_real_start_time(when);
 }
@@ -250,6 +378,11 @@ set_real_start_time(double when)
 double
 get_playing_time(void)
 {
+    if (live) return playing == PLAYING ? stream_live_time() : live_time;
+
+    /* The device's own clock is smooth enough to scroll by */
+    if (low_latency) return get_audio_players_time();
+
     if (use_real_start_time) {
 	struct timeval tv;
 
@@ -286,6 +419,8 @@ get_playing_time(void)
 double
 get_audio_players_time(void)
 {
+    if (live) return get_playing_time();
+
 #if EMOTION_AUDIO
     /* Empirically, if its playing, e_o_p_g() returns a value on average
      * .0181 seconds ahead of what it's actually playing. */
@@ -294,6 +429,10 @@ get_audio_players_time(void)
 #elif SDL_AUDIO
     /* The current playing time is in sdl_start, counted in frames
      * since the start of the piece. */
+#if SDL2
+    if (playing == PLAYING && low_latency)
+	return low_latency_position() / current_sample_rate();
+#endif
     if (playing == PLAYING) {
 	/* If its playing, we don't know how much of its last buffer it
 	 * has already played, but on average it will be half way through. */
@@ -321,8 +460,23 @@ sdl_fill_audio(void *userdata, Uint8 *stream, int len)
 {
     audio_file_t *af = (audio_file_t *)userdata;
     int channels = af->channels;
-    int frames_to_read = len / (sizeof(short) * channels);
-    int frames_read;	/* How many were read from the file */
+    off_t frames_to_read = len / (sizeof(short) * channels);
+    off_t frames_read;	/* How many were read from the file */
+    struct timeval now;
+
+    set_thread_role(ROLE_AUDIO);
+
+    /* If we're called later than the last buffer we filled would have
+     * taken to play, the sound card has probably run dry. */
+    gettimeofday(&now, NULL);
+    if (sdl_filling &&
+	(now.tv_sec - sdl_last_fill.tv_sec) +
+	(now.tv_usec - sdl_last_fill.tv_usec) / 1000000.0
+	> 2.0 * frames_to_read / af->sample_rate) {
+	hud_underrun();
+    }
+    sdl_last_fill = now;
+    sdl_filling = TRUE;
 
     /* SDL has no "playback finished" callback, so spot it here */
     if (sdl_start >= af->frames) {
@@ -343,31 +497,153 @@ sdl_fill_audio(void *userdata, Uint8 *stream, int len)
     }
     if (frames_read < 0) {
 	/* Some error */
-	fprintf(stderr, "Error reading %ld cached frames at %d for the audio player.", sdl_start, len);
+	fprintf(stderr, "Error reading %d bytes of cached audio at frame %lld for the audio player.", len, (long long)sdl_start);
 	/* Carry on playing: better an audio blip than seizing up */
 	/* This never happens because read_cached_audio() always succeeds */
     }
 
-    /* Apply softvol */
-    if (softvol != 1.0) {
-	int i; short *sp;
-	for (i=0, sp=(short *)stream;
-	     i < frames_read * channels;
-	     i++, sp++) {
-	    double value = *sp * softvol;
-	    if (DELTA_LT(value, -32767.0) || DELTA_GT(value, 32767.0)) {
-		/* Reduce softvol to avoid clipping */
-		softvol = 32767.0 / abs(*sp);
-		value = *sp * softvol;
+    if (frames_read > 0) apply_softvol((short *)stream, frames_read * channels);
+
+    if (frames_read >= 0) sdl_start += frames_read;
+    else sdl_start += len; /* On read errors, pretend it worked */
+}
+
+static void
+apply_softvol(short *sp, int nsamples)
+{
+    int i;
+
+    if (softvol == 1.0) return;
+
+    for (i=0; i < nsamples; i++, sp++) {
+	double value = *sp * softvol;
+	if (DELTA_LT(value, -32767.0) || DELTA_GT(value, 32767.0)) {
+	    /* Reduce softvol to avoid clipping */
+	    softvol = 32767.0 / abs(*sp);
+	    value = *sp * softvol;
 printf("The audio would have clipped so I lowered softvol to %g\n", softvol);
-	     }
+	 }
+
+	/* Plus half a bit of dither? */
+	*sp = (short) lrint(value);
+    }
+}
+
+#if SDL2
+/* The --low-latency audio thread: keep SDL's queue topped up */
+static int
+sdl_feed_audio(void *data)
+{
+    audio_file_t *af = (audio_file_t *)data;
+    int channels = af->channels;
+    Uint32 frame_bytes = channels * sizeof(short);
+    short *buf = Malloc(SDL_buffer_size * frame_bytes);
+    /* Look twice per device buffer */
+    useconds_t nap = lrint(SDL_buffer_size * 500000.0 / af->sample_rate);
+
+    set_thread_role(ROLE_AUDIO);
+
+    while (!feeder_quit) {
+	Uint32 queued = SDL_GetQueuedAudioSize(1) / frame_bytes;
+
+	if (playing == PLAYING && queued == 0 && sdl_filling &&
+	    sdl_start < af->frames) {
+	    hud_underrun();
+	}
+
+	while (playing == PLAYING && queued < QUEUE_BUFFERS * SDL_buffer_size) {
+	    off_t start = sdl_start;
+	    off_t frames_read;
+	    bool failed = FALSE;
+
+	    /* SDL has no "playback finished" callback, so spot it here */
+	    if (start >= af->frames) {
+		/* Let what's queued play out, then stop */
+		if (queued == 0) {
+		    stop_playing();
+		    if (exit_when_played) gui_quit_main_loop();
+		}
+		break;
+	    }
 
-	    /* Plus half a bit of dither? */
-	    *sp = (short) lrint(value);
+	    frames_read = read_cached_audio(af, (char *)buf, af_signed,
+					    channels, start, SDL_buffer_size);
+	    if (frames_read <= 0) {
+		stop_playing();
+		break;
+	    }
+	    apply_softvol(buf, frames_read * channels);
+
+	    /* Unless they've moved the player while we were reading... */
+	    SDL_LockAudio();
+	    if (sdl_start != start) {
+		/* Moving the player empties the queue; see what's left */
+		queued = SDL_GetQueuedAudioSize(1) / frame_bytes;
+	    } else if (SDL_QueueAudio(1, buf, frames_read * frame_bytes) == 0) {
+		sdl_start += frames_read;
+		queued += frames_read;
+		sdl_filling = TRUE;
+	    } else {
+		failed = TRUE;
+	    }
+	    SDL_UnlockAudio();
+	    if (failed) break;	/* Try again after a nap */
 	}
+	usleep(nap);
     }
+    free(buf);
 
-    if (frames_read >= 0) sdl_start += frames_read;
-    else sdl_start += len; /* On read errors, pretend it worked */
+    return 0;
+}
+
+/*
+ * Which frame is the sound card playing now? The device has taken
+ * everything we queued that isn't still in the queue, and it takes it
+ * a buffer at a time, so the sound we hear is a buffer behind that.
+ * Between its takes, it plays at a steady rate.
+ */
+static double
+low_latency_position()
+{
+    Uint32 queued;
+    struct timeval now;
+    double position;
+
+    SDL_LockAudio();
+    queued = SDL_GetQueuedAudioSize(1)
+	     / (current_audio_file()->channels * sizeof(short));
+    gettimeofday(&now, NULL);
+    if (sdl_start - queued != consumed) {
+	consumed = sdl_start - queued;
+	consumed_at = now;
+    }
+    position = consumed - SDL_buffer_size +
+	       ((now.tv_sec - consumed_at.tv_sec) +
+		(now.tv_usec - consumed_at.tv_usec) / 1000000.0)
+	       * current_sample_rate();
+    if (position > consumed) position = consumed;
+    SDL_UnlockAudio();
+
+    return position < 0.0 ? 0.0 : position;
 }
 #endif
+#endif
+
+/* How long does it take for audio to get from us to the loudspeaker?
+ * With --low-latency, this is measured; otherwise it's a guess.
+ */
+double
+audio_latency(void)
+{
+#if SDL_AUDIO
+# if SDL2
+    if (low_latency && !live)
+	return (SDL_GetQueuedAudioSize(1)
+		/ (current_audio_file()->channels * sizeof(short))
+		+ SDL_buffer_size) / current_sample_rate();
+# endif
+    return SDL_buffer_size / 2 / current_sample_rate();
+#else
+    return 0.181;	/* See get_audio_players_time() */
+#endif
+}
@@ -29,6 +29,9 @@
 enum playing { STOPPED, PLAYING, PAUSED };
 extern enum playing playing;
 
+extern bool low_latency;	/* --low-latency */
+extern int audio_buffer;	/* --audio-buffer in frames, 0 = choose */
+
 extern void init_audio(audio_file_t *audio_file, char *filename);
 extern void reinit_audio(audio_file_t *audio_file, char *filename);
 extern void pause_audio(void);
@@ -38,6 +41,8 @@ extern void continue_playing(void);
 extern void set_playing_time(double when);
 extern double get_playing_time(void);
 extern double get_audio_players_time(void);
+extern double audio_latency(void);
+extern void close_audio(void);
 
 #define AUDIO_H
 #endif
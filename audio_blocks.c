@@ -0,0 +1,202 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * audio_blocks.c - A second-level cache of decoded audio in fixed-size blocks
+ *
+ * The audio cache only holds the audio around the displayed region, so when
+ * they jump somewhere else, it has to be decoded again, and jumping to and
+ * fro between two passages of a long MP3 decodes the same audio each time.
+ *
+ * Instead, reposition_audio_cache() gets its audio from here, where the
+ * 16-bit audio is kept in blocks of about a second, and only the blocks
+ * we don't have are decoded. When the blocks exceed AUDIO_BLOCKS_BUDGET,
+ * the least recently used ones are thrown away.
+ *
+ * The mono and per-channel floats aren't kept here as they are quick to
+ * make from the shorts, and keeping them would more than triple the size.
+ *
+ * It is used by reposition_audio_cache(), in the startup thread while the
+ * file is being opened and in the main thread after that. The main thread's memory shedder also
+ * drops the blocks, but main() only adds it once finish_opening() has
+ * waited for the startup thread, so the two threads never use the blocks
+ * at once and they need no lock of their own.
+ */
+
+#include "spettro.h"
+#include "audio_blocks.h"
+
+#include <string.h>	/* for memcpy() and memset() */
+
+/* How much memory to keep decoded audio in */
+#define AUDIO_BLOCKS_BUDGET (64 * 1024 * 1024)
+
+typedef struct block {
+    off_t index;		/* Which block of the file this is */
+    short *data;		/* block_frames frames of audio */
+    struct block *hash_next;	/* Chain of blocks in the same hash bucket */
+    struct block *newer, *older; /* LRU list, most recently used first */
+} block_t;
+
+#define HASH_SIZE 256
+static block_t *hash_table[HASH_SIZE];
+#define hash(index) ((unsigned)(index) % HASH_SIZE)
+
+static block_t *newest = NULL, *oldest = NULL;
+
+static audio_file_t *blocks_af = NULL;	/* Which file the blocks are from */
+static int   blocks_channels;		/* and how many channels it has */
+static off_t block_frames;		/* Frames per block */
+static size_t block_bytes;		/* Size of each block's data */
+static int   nblocks = 0;		/* How many we have */
+static int   max_blocks;		/* and how many we can have */
+
+static void
+unlink_lru(block_t *b)
+{
+    if (b->newer) b->newer->older = b->older; else newest = b->older;
+    if (b->older) b->older->newer = b->newer; else oldest = b->newer;
+}
+
+static void
+link_newest(block_t *b)
+{
+    b->older = newest;
+    b->newer = NULL;
+    if (newest) newest->newer = b; else oldest = b;
+    newest = b;
+}
+
+static void
+unhash_block(block_t *b)
+{
+    block_t **bp;
+
+    for (bp = &hash_table[hash(b->index)]; *bp != NULL; bp = &(*bp)->hash_next)
+	if (*bp == b) {
+	    *bp = b->hash_next;
+	    return;
+	}
+}
+
+static void
+free_block(block_t *b)
+{
+    unlink_lru(b);
+    unhash_block(b);
+    Tfree(MEM_AUDIO, b->data, block_bytes);
+    free(b);
+    nblocks--;
+}
+
+/* Get a block, decoding it if we don't have it. NULL on read errors */
+static block_t *
+get_block(audio_file_t *af, off_t index)
+{
+    block_t *b;
+
+    for (b = hash_table[hash(index)]; b != NULL; b = b->hash_next)
+	if (b->index == index) {
+	    /* Move it to the front of the LRU list */
+	    unlink_lru(b);
+	    link_newest(b);
+	    return b;
+	}
+
+    /* Make room for it */
+    while (nblocks >= max_blocks && oldest != NULL)
+	free_block(oldest);
+
+    b = Malloc(sizeof(*b));
+    b->index = index;
+    b->data = Tmalloc(MEM_AUDIO, block_bytes);
+    if (read_audio_file(af, (char *) b->data, af_signed, blocks_channels,
+			index * block_frames, block_frames) != block_frames) {
+	Tfree(MEM_AUDIO, b->data, block_bytes);
+	free(b);
+	return NULL;
+    }
+    b->hash_next = hash_table[hash(index)];
+    hash_table[hash(index)] = b;
+    link_newest(b);
+    nblocks++;
+
+    return b;
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Read 16-bit audio like read_audio_file(), but via the block cache.
+ * Returns frames_to_read, or -1 if the audio file couldn't be read.
+ */
+off_t
+read_audio_blocks(audio_file_t *af, short *data,
+		  off_t start, off_t frames_to_read)
+{
+    off_t frames_written = 0;
+
+    /* A different file? Forget the old one's audio */
+    if (af != blocks_af) {
+	drop_audio_blocks();
+	blocks_af = af;
+	blocks_channels = af->channels;
+	block_frames = lrint(af->sample_rate);
+	if (block_frames < 1024) block_frames = 1024;
+	block_bytes = block_frames * blocks_channels * sizeof(short);
+	max_blocks = AUDIO_BLOCKS_BUDGET / block_bytes;
+	if (max_blocks < 2) max_blocks = 2;
+    }
+
+    /* Before the start of the file is silent and isn't worth caching */
+    if (start < 0) {
+	off_t silence = MIN(-start, frames_to_read);
+
+	memset(data, 0, silence * blocks_channels * sizeof(short));
+	data += silence * blocks_channels;
+	start += silence;
+	frames_to_read -= silence;
+	frames_written += silence;
+    }
+
+    while (frames_to_read > 0) {
+	off_t index = start / block_frames;
+	off_t offset = start - index * block_frames;
+	off_t frames = MIN(block_frames - offset, frames_to_read);
+	block_t *b = get_block(af, index);
+
+	if (b == NULL) return -1;
+	memcpy(data, b->data + offset * blocks_channels,
+	       frames * blocks_channels * sizeof(short));
+	data += frames * blocks_channels;
+	start += frames;
+	frames_to_read -= frames;
+	frames_written += frames;
+    }
+
+    return frames_written;
+}
+
+/* Forget all decoded audio */
+void
+drop_audio_blocks()
+{
+    while (oldest != NULL) free_block(oldest);
+    blocks_af = NULL;
+}
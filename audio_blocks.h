@@ -0,0 +1,31 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * audio_blocks.h - Declarations for audio_blocks.c
+ */
+
+#ifndef AUDIO_BLOCKS_H
+
+#include "audio_file.h"
+
+extern off_t read_audio_blocks(audio_file_t *af, short *data,
+			       off_t start, off_t frames_to_read);
+extern void  drop_audio_blocks(void);
+
+#define AUDIO_BLOCKS_H
+#endif
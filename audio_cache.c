@@ -34,22 +34,31 @@
  *
  * The cached audio needs to be refreshed whenever the displayed audio moves,
  * i.e. on user-interface pans and when the display scrolls while playing,
- * and when the time-zoom changes.
+ * and when the time-zoom changes. It is refilled from audio_blocks.c,
+ * which keeps recently decoded audio so that returning to a place that
+ * has been seen before doesn't decode it again.
  */
 
 #include "spettro.h"
 #include "audio_cache.h"
+#include "audio_blocks.h"
 #include "calc.h"	/* for LOOKAHEAD */
 #include "lock.h"
+#include "pcmfile.h"
 #include "ui.h"
 
 #ifndef NO_CACHE
 static void shorts_to_mono_floats(float *floats, short *shorts,
 				  off_t frames, int nchannels);
+static void shorts_to_float_planes(float *planes, off_t plane_size,
+				   short *shorts, off_t frames, int nchannels);
 
-/* We keep the cached audio in two formats: */
+/* We keep the cached audio in three formats: */
 static short *audio_cache_s = NULL;	/* 16-bit all channels for audio */
 static float *audio_cache_f = NULL;	/* 32-bit mono floats for FFT threads */
+static float *audio_cache_p = NULL;	/* 32-bit floats for each channel,
+					 * one plane of audio_cache_size
+					 * after the other, or NULL if mono */
 
 static off_t audio_cache_start = 0;	/* Where the cache starts in sample frames
 				 	 * from the start of the audio file */
@@ -62,18 +71,74 @@ static off_t audio_cache_size = 0;	/* Size of cache in sample frames */
  * cache is mispositioned (which "should" never happen, but can if playing
  * position changes by a page but screen hasn't scrolled yet, or if a calc
  * takes so long to get done that time has aleady noved on).
+ *
+ * As well as mono floats, af_float with channels > 1 fetches the channels
+ * as separate planes of floats, one after the other in "data",
+ * for the per-channel spectrograms.
  */
 
-int
+#ifndef NO_CACHE
+static off_t read_cached_plane(char *data, af_format_t format, int channels,
+			       int plane, off_t start, off_t frames_to_read);
+#endif
+
+off_t
 read_cached_audio(audio_file_t *af, char *data,
 		  af_format_t format, int channels,
-		  off_t start, int frames_to_read)
+		  off_t start, off_t frames_to_read)
 {
-#ifdef NO_CACHE
+#ifndef NO_CACHE
+    /* Live input is kept in stream.c's ring buffer, which is its own cache,
+     * and mapped files are read straight from the mapping. */
+    if (!af->live && !af->pcm) {
+	if (format == af_float && channels > 1) {
+	    int c;
+	    off_t r = 0;
+
+	    for (c = 0; c < channels; c++) {
+		r = read_cached_plane(data + c * frames_to_read * sizeof(float),
+				      af_float, 1, c, start, frames_to_read);
+	    }
+	    return r;
+	}
+	return read_cached_plane(data, format, channels, -1,
+				 start, frames_to_read);
+    }
+#endif
+    /* Mapped files can give us the channels' planes directly */
+    if (af->pcm) return pcmfile_read_frames(af, data, format, channels,
+					    start, frames_to_read);
+
+    if (format == af_float && channels > 1) {
+	/* Read the original audio and deinterleave it */
+	int nchannels = af->channels;
+	short *shorts = Malloc(frames_to_read * nchannels * sizeof(short));
+	float *floats = (float *) data;
+	off_t r = read_audio_file(af, (char *) shorts, af_signed, nchannels,
+				  start, frames_to_read);
+	int c;
+	off_t i;
+
+	for (c = 0; c < channels; c++)
+	    for (i = 0; i < frames_to_read; i++)
+		*floats++ = (i < r) ? shorts[i * nchannels + c] / 32768.0 : 0.0;
+	free(shorts);
+	return r;
+    }
     return read_audio_file(af, data, format, channels, start, frames_to_read);
-#else
-    int frames_written = 0;
+}
+
+#ifndef NO_CACHE
+/* Read from one of the cache buffers, where "plane" is -1 for the mono floats
+ * or the 16-bit audio, or a channel number to read that channel's floats.
+ */
+static off_t
+read_cached_plane(char *data, af_format_t format, int channels,
+		  int plane, off_t start, off_t frames_to_read)
+{
+    off_t frames_written = 0;
     size_t framesize;
+    char *cache;	/* The cache buffer we read from */
 
     switch (format) {
     case af_float: framesize = sizeof(float); break;
@@ -83,7 +148,7 @@ read_cached_audio(audio_file_t *af, char *data,
 
     /* Deal with start < 0 and fill with silence */
     if (start < 0) {
-	int nframes = MIN(-start, frames_to_read);
+	off_t nframes = MIN(-start, frames_to_read);
 	memset(data, 0, nframes * framesize);
 	start += nframes; data += nframes * framesize;
 	frames_to_read -= nframes;
@@ -96,7 +161,7 @@ read_cached_audio(audio_file_t *af, char *data,
 
     /* Does it read past end-of-file? If so, fill the end with silence */
     if (start + frames_to_read > current_audio_file()->frames) {
-	int nframes = start + frames_to_read - current_audio_file()->frames;
+	off_t nframes = start + frames_to_read - current_audio_file()->frames;
 	frames_to_read -= nframes;
 	memset(data + (frames_to_read * framesize), 0, nframes * framesize);
 	frames_written += nframes;
@@ -111,6 +176,15 @@ read_cached_audio(audio_file_t *af, char *data,
      */
     lock_audio_cache();
 
+    cache = format == af_signed ? (char *) audio_cache_s :
+	    plane < 0 ? (char *) audio_cache_f :
+	    audio_cache_p == NULL ? NULL :
+	    (char *) (audio_cache_p + plane * audio_cache_size);
+    if (cache == NULL) {
+	/* Channel planes of a mono file? Give them the mono data */
+	cache = (char *) audio_cache_f;
+    }
+
     /* 1) starting before the start of the cache */
     if (start < audio_cache_start) {
 	/* zero the missing first part, then copy the rest from the cache */
@@ -118,18 +192,10 @@ read_cached_audio(audio_file_t *af, char *data,
 	    /* There is an overlap between the cache and the required region so
 	     * fill the non-overlapping region with silence
 	     */
-	    int frames = audio_cache_start - start;
-
-	    switch (format) {
-	    case af_float:
-		 memset(data, 0, frames * sizeof(float));
-		 data += frames * sizeof(float);
-		 break;
-	    case af_signed:
-		 memset(data, 0, frames * channels * sizeof(short));
-		 data += frames * channels * sizeof(short);
-		 break;
-	    }
+	    off_t frames = audio_cache_start - start;
+
+	    memset(data, 0, frames * framesize);
+	    data += frames * framesize;
 	    frames_written += frames;
 	    frames_to_read -= frames;
 	    start = audio_cache_start;
@@ -137,16 +203,7 @@ read_cached_audio(audio_file_t *af, char *data,
 	    /* There is no overlap. Fill with silence */
 	    unlock_audio_cache();
 
-	    switch (format) {
-	    case af_float:
-		memset(data, 0, frames_to_read * sizeof(float));
-		data += frames_to_read * sizeof(float);
-		break;
-	    case af_signed:
-		memset(data, 0, frames_to_read * channels * sizeof(short));
-		data += frames_to_read * channels * sizeof(short);
-		break;
-	    }
+	    memset(data, 0, frames_to_read * framesize);
 	    return frames_to_read;
 	}
     }
@@ -157,60 +214,32 @@ read_cached_audio(audio_file_t *af, char *data,
 	 * the rest from the cache */
 	if (start < audio_cache_start + audio_cache_size) {
 	    /* Size of the overlapping region in frames */
-	    int overlap = audio_cache_start + audio_cache_size - start;
+	    off_t overlap = audio_cache_start + audio_cache_size - start;
 	    /* How many frames to fill with silence */
-	    int frames = frames_to_read - overlap;
-
-	    switch (format) {
-		int framesize;
-	    case af_float:
-	    	framesize = sizeof(float);
-		memset(data + overlap * framesize, 0, frames * framesize);
-		break;
-	    case af_signed:
-	    	framesize = channels * sizeof(short);
-		memset(data + overlap * framesize, 0, frames * framesize);
-		break;
-	    }
+	    off_t frames = frames_to_read - overlap;
+
+	    memset(data + overlap * framesize, 0, frames * framesize);
 	    frames_written += frames;
 	    frames_to_read -= frames;	/* == overlap */
 	} else {
 	    /* There is no overlap. Fill with silence */
 	    unlock_audio_cache();
 
-	    switch (format) {
-	    case af_float:
-		 memset(data, 0, frames_to_read * sizeof(float));
-		 data += frames_to_read * sizeof(float);
-		 break;
-	    case af_signed:
-		 memset(data, 0, frames_to_read * channels * sizeof(short));
-		 data += frames_to_read * channels * sizeof(short);
-		 break;
-	    }
+	    memset(data, 0, frames_to_read * framesize);
 	    return frames_to_read;
 	}
     }
 
     /* Copy from the cache to the audio buffer */
-    switch (format) {
-    case af_float:
-	memcpy(data, audio_cache_f + (start - audio_cache_start),
-	       frames_to_read * sizeof(float));
-	frames_written += frames_to_read;
-	break;
-    case af_signed:
-	memcpy(data, audio_cache_s + (start - audio_cache_start) * channels,
-	       frames_to_read * channels * sizeof(short));
-	frames_written += frames_to_read;
-	break;
-    }
+    memcpy(data, cache + (start - audio_cache_start) * framesize,
+	   frames_to_read * framesize);
+    frames_written += frames_to_read;
 
     unlock_audio_cache();
 
     return(frames_written);
-#endif
 }
+#endif
 
 /*
  * Make the cached portion of the audio reflect the current settings:
@@ -226,7 +255,7 @@ reposition_audio_cache()
     return;
 #else
     /* Where the audio cache will start, in frames from start of audio file */
-    off_t new_cache_start = lrint(floor(
+    off_t new_cache_start = llrint(floor(
     	(disp_time - (disp_width/2 + LOOKAHEAD) * secpp - 1/fft_freq/2) * current_sample_rate()
     ));
 
@@ -234,7 +263,7 @@ reposition_audio_cache()
     double new_cache_time = (disp_width + LOOKAHEAD * 2) * secpp + 1/fft_freq;
 
     /* How big the new cache will be, in sample frames */
-    off_t new_cache_size = lrint(ceil(new_cache_time * current_sample_rate()));
+    off_t new_cache_size = llrint(ceil(new_cache_time * current_sample_rate()));
 
     int nchannels = current_audio_file()->channels;	/* Local copy */
 
@@ -244,6 +273,9 @@ reposition_audio_cache()
      * from the audio file */
     off_t fill_start, fill_size;
 
+    /* Live input and mapped files need no cache */
+    if (current_audio_file()->live || current_audio_file()->pcm) return;
+
     lock_audio_cache();
 
     /* In the rare case of the size of the interesting area changing,
@@ -251,15 +283,23 @@ reposition_audio_cache()
      * to preserve the overlapping region. It's just too difficult.
      */
     if (audio_cache_size != 0 && audio_cache_size != new_cache_size) {
-	free(audio_cache_s);
-	free(audio_cache_f);
+	Tfree(MEM_AUDIO, audio_cache_s,
+	      audio_cache_size * sizeof(short) * nchannels);
+	Tfree(MEM_AUDIO, audio_cache_f, audio_cache_size * sizeof(float));
+	Tfree(MEM_AUDIO, audio_cache_p,
+	      audio_cache_size * sizeof(float) * nchannels);
+	audio_cache_p = NULL;
 	audio_cache_size = 0;
     }
 
     /* If this is the first call, allocate the cache buffers */
     if (audio_cache_size == 0) {
-	audio_cache_s = Malloc(new_cache_size * sizeof(short) * nchannels);
-	audio_cache_f = Malloc(new_cache_size * sizeof(float));
+	audio_cache_s = Tmalloc(MEM_AUDIO,
+				new_cache_size * sizeof(short) * nchannels);
+	audio_cache_f = Tmalloc(MEM_AUDIO, new_cache_size * sizeof(float));
+	if (nchannels > 1)
+	    audio_cache_p = Tmalloc(MEM_AUDIO,
+				    new_cache_size * sizeof(float) * nchannels);
 	audio_cache_size = new_cache_size;
 	refill = TRUE;
     }
@@ -277,13 +317,20 @@ reposition_audio_cache()
     if (!refill && new_cache_start > audio_cache_start &&
 		   new_cache_start < audio_cache_start + audio_cache_size) {
 	/* How many frames we move by, and how many frames overlap */ 
-	int move_by = new_cache_start - audio_cache_start;
-	int overlap = audio_cache_size - move_by;
+	off_t move_by = new_cache_start - audio_cache_start;
+	off_t overlap = audio_cache_size - move_by;
 
 	memmove(audio_cache_s, audio_cache_s + move_by * nchannels,
 		overlap * sizeof(short) * nchannels);
 	memmove(audio_cache_f, audio_cache_f + move_by,
 		overlap * sizeof(float));
+	if (audio_cache_p) {
+	    int c;
+	    for (c = 0; c < nchannels; c++) {
+		float *plane = audio_cache_p + c * audio_cache_size;
+		memmove(plane, plane + move_by, overlap * sizeof(float));
+	    }
+	}
 	audio_cache_start += move_by;
 	fill_start = audio_cache_start + overlap;
 	fill_size = move_by;
@@ -293,13 +340,20 @@ reposition_audio_cache()
     if (!refill && new_cache_start < audio_cache_start &&
 		   new_cache_start > audio_cache_start - audio_cache_size) {
 	/* How many frames we move by, and how many frames overlap */ 
-	int move_by = audio_cache_start - new_cache_start;
-	int overlap = audio_cache_size - move_by;
+	off_t move_by = audio_cache_start - new_cache_start;
+	off_t overlap = audio_cache_size - move_by;
 
 	memmove(audio_cache_s + move_by * nchannels , audio_cache_s,
 		overlap * sizeof(short) * nchannels);
 	memmove(audio_cache_f + move_by, audio_cache_f,
 		overlap * sizeof(float));
+	if (audio_cache_p) {
+	    int c;
+	    for (c = 0; c < nchannels; c++) {
+		float *plane = audio_cache_p + c * audio_cache_size;
+		memmove(plane + move_by, plane, overlap * sizeof(float));
+	    }
+	}
 	audio_cache_start -= move_by;
 	fill_start = audio_cache_start;
 	fill_size = move_by;
@@ -310,25 +364,30 @@ reposition_audio_cache()
 	fill_size = audio_cache_size;
     }
 
-    /* Read 16-bit nchannel shorts into the buffer
-     * and convert those to mono doubles */
+    /* Read 16-bit nchannel shorts into the buffer, decoding only what
+     * isn't in the block cache, and convert those to mono doubles */
     {
 	/* Where the region to fill starts, relative to the cache start */
 	off_t fill_offset = fill_start - audio_cache_start;  /* in frames */
-	int r = read_audio_file(current_audio_file(),
-				(char *)(audio_cache_s + fill_offset * nchannels),
-				af_signed, nchannels, fill_start, fill_size);
+	off_t r = read_audio_blocks(current_audio_file(),
+				    audio_cache_s + fill_offset * nchannels,
+				    fill_start, fill_size);
 	if (r != fill_size) {
-	    fprintf(stderr, "Failed to fill the audio cache with %ld frames; got %d.\n",
-		    fill_size, r);
+	    fprintf(stderr, "Failed to fill the audio cache with %lld frames; got %lld.\n",
+		    (long long)fill_size, (long long)r);
 	}
-	shorts_to_mono_floats(audio_cache_f + fill_offset,
-			      audio_cache_s + fill_offset * nchannels,
-			      r, nchannels);
 	/* If the read was short or erroneous, fill the unwritten space with silence */
 	if (r < 0) r = 0;
-	memset(audio_cache_f + fill_offset + r, 0, (fill_size - r) * sizeof(double));
-	memset(audio_cache_s + fill_offset + r, 0, (fill_size - r) * sizeof(short) * nchannels);
+	memset(audio_cache_s + (fill_offset + r) * nchannels, 0,
+	       (fill_size - r) * sizeof(short) * nchannels);
+	shorts_to_mono_floats(audio_cache_f + fill_offset,
+			      audio_cache_s + fill_offset * nchannels,
+			      fill_size, nchannels);
+	if (audio_cache_p)
+	    shorts_to_float_planes(audio_cache_p + fill_offset,
+				   audio_cache_size,
+				   audio_cache_s + fill_offset * nchannels,
+				   fill_size, nchannels);
     }
 
     unlock_audio_cache();
@@ -368,6 +427,25 @@ shorts_to_mono_floats(float *floats, short *shorts, off_t frames, int nchannels)
 	}
     }
 }
+
+/* Convert 16-bit nchannel shorts to a plane of floats for each channel */
+static void
+shorts_to_float_planes(float *planes, off_t plane_size,
+		       short *shorts, off_t frames, int nchannels)
+{
+    int c;
+
+    for (c = 0; c < nchannels; c++) {
+	float *fp = planes + c * plane_size;
+	short *sp = shorts + c;
+	off_t todo;
+
+	for (todo = frames; todo > 0; todo--) {
+	    *fp++ = (float)(*sp) / 32768.0;
+	    sp += nchannels;
+	}
+    }
+}
 #endif
 
 /* Dump the audio cache as a WAV file */
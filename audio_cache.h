@@ -23,8 +23,8 @@
 
 #include "audio_file.h"	/* for af_format_t */
 
-extern int read_cached_audio(audio_file_t *af, char *data, af_format_t format,
-			     int channels, off_t start, int frames_to_read);
+extern off_t read_cached_audio(audio_file_t *af, char *data, af_format_t format,
+			       int channels, off_t start, off_t frames_to_read);
 
 extern void reposition_audio_cache(void);
 
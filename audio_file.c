@@ -20,6 +20,7 @@
  *
  * Implemented using libsndfile, which can read wav, ogg and flac but not mp3.
  * and libmpg123, because spettro needs sample-accurate seeking.
+ * Uncompressed WAV and AIFF files are mapped into memory by pcmfile.c.
  *
  * This also keeps track of all the opened audio files, treating them as if
  + they were one long file made of them all concatenated together and thus
@@ -38,6 +39,8 @@
 #include "libsndfile.h"
 #include "libmpg123.h"
 #include "lock.h"
+#include "pcmfile.h"
+#include "stream.h"
 #include "ui.h"			/* for disp_time, disp_offset and secpp */
 
 #include <string.h>		/* for memset() */
@@ -50,6 +53,8 @@ current_audio_file(void)
     return audio_file;
 }
 
+static audio_file_t *open_file(char *filename, audio_file_t *like);
+
 /* Open the audio file to find out sampling rate, length and to be able
  * to fetch pixel data to be converted into spectra.
  *
@@ -59,22 +64,55 @@ current_audio_file(void)
  */
 audio_file_t *
 open_audio_file(char *filename)
+{
+    audio_file_t *af = open_file(filename, NULL);
+
+    if (af != NULL) audio_file = af;
+    return af;
+}
+
+/* Open another handle on an audio file for a thread of its own.
+ * It doesn't become the current audio file, and what we already know
+ * about the file isn't worked out again, like the length of an MP3. */
+audio_file_t *
+dup_audio_file(audio_file_t *like)
+{
+    return open_file(like->filename, like);
+}
+
+static audio_file_t *
+open_file(char *filename, audio_file_t *like)
 {
     audio_file_t *af = Malloc(sizeof(*af));
 
     /* These also indicate whether we're using libsndfile or libmpg123 */
     af->sndfile = NULL;
     af->mh = NULL;
+    af->pcm = NULL;
 
     af->audio_buf = NULL;
     af->audio_buflen = 0;
+    af->live = FALSE;
 
+    /* Raw PCM is mapped if it's in a regular file, otherwise it is
+     * streamed from stdin, a FIFO or a capture device */
+    if (stream_capture || stream_format != NULL) {
+	if (!stream_capture && strcmp(filename, "-") != 0 &&
+	    pcmfile_open(af, filename)) {
+	    /* A raw file */
+	} else if (!stream_open(af, filename)) {
+	    free(af);
+	    return NULL;
+	}
+    } else
     /* Decode MP3's with libmpg123 */
     if (strcasecmp(filename + strlen(filename)-4, ".mp3") == 0) {
-	if (!libmpg123_open(af, filename)) {
+	if (!libmpg123_open(af, filename, like)) {
 	    free(af);
 	    return NULL;
 	}
+    } else if (pcmfile_open(af, filename)) {
+	/* Uncompressed WAV or AIFF */
     } else {
 	/* for anything else, use libsndfile */
 	if (!libsndfile_open(af, filename)) {
@@ -83,7 +121,6 @@ open_audio_file(char *filename)
 	}
     }
 
-    audio_file = af;
     return af;
 }
 
@@ -127,15 +164,15 @@ current_sample_rate()
  * a negative value if some kind of read error occurred.
  */
 
-int
+off_t
 read_audio_file(audio_file_t *af, char *data,
 		af_format_t format, int channels,
-		off_t start, int frames_to_read)
+		off_t start, off_t frames_to_read)
 {
     /* size of one frame of output data in bytes */
-    int framesize = (format == af_float ? sizeof(float) : sizeof(short))
-    		    * channels;
-    int total_frames = 0;	/* How many frames have we filled? */
+    size_t framesize = (format == af_float ? sizeof(float) : sizeof(short))
+    		       * channels;
+    off_t total_frames = 0;	/* How many frames have we filled? */
     char *write_to = data;	/* Where to write next data */
 
     if (start < 0) {
@@ -146,7 +183,7 @@ read_audio_file(audio_file_t *af, char *data,
 	    return frames_to_read;
 	} else {
 	    /* Fill before time 0.0 with silence */
-	    int silence = -start;	/* How many silent frames to fill */
+	    off_t silence = -start;	/* How many silent frames to fill */
 	    memset(write_to, 0, silence * framesize);
 	    write_to += silence * framesize;
 	    total_frames += silence;
@@ -155,6 +192,23 @@ read_audio_file(audio_file_t *af, char *data,
 	}
     }
 
+    /* Live input has no end yet, and isn't seekable */
+    if (af->live) {
+	off_t frames = stream_read_frames(af, write_to, start,
+					  frames_to_read, format);
+	total_frames += frames;
+	write_to += frames * framesize;
+	frames_to_read -= frames;
+	goto fill_with_silence;
+    }
+
+    /* Mapped files can be read from anywhere */
+    if (af->pcm) {
+	return total_frames + pcmfile_read_frames(af, write_to, format,
+						  channels, start,
+						  frames_to_read);
+    }
+
     if (start >= af->frames) goto fill_with_silence;
 
     /* Decode MP3's with libmpg123 */
@@ -165,7 +219,7 @@ read_audio_file(audio_file_t *af, char *data,
 	    return -1;
 	}
 	while (frames_to_read > 0) {
-	    int frames = libmpg123_read_frames(af, write_to, frames_to_read, format);
+	    off_t frames = libmpg123_read_frames(af, write_to, frames_to_read, format);
 	    if (frames > 0) {
 		total_frames += frames;
 		write_to += frames * framesize;
@@ -184,7 +238,7 @@ read_audio_file(audio_file_t *af, char *data,
 	}
 
 	{
-	    int frames = libsndfile_read_frames(af, write_to,
+	    off_t frames = libsndfile_read_frames(af, write_to,
 	    					frames_to_read, format);
 	    if (frames < 0) return -1;
 
@@ -210,6 +264,8 @@ close_audio_file(audio_file_t *af)
 {
     if (af == NULL) return;
 
+    if (af->live) stream_close(af);
+    if (af->pcm) pcmfile_close(af);
     if (af->sndfile) libsndfile_close(af);
     if (af->mh) libmpg123_close(af);
 
@@ -33,12 +33,16 @@ typedef struct audio_file {
 	/* libmpg123 handle, NULL if not using libmpg123 */
 	mpg123_handle *mh;
 
+	/* Memory-mapped PCM file, NULL if not using pcmfile.c */
+	struct pcmfile *pcm;
+
 	double sample_rate;
-	long frames;		/* The file has (frames*channels) samples */
+	off_t frames;		/* The file has (frames*channels) samples */
 	int channels;
 	short *audio_buf;	/* The required audio data as 16-bit signed,
     				 * with same number of channels as audio file */
 	int audio_buflen;	/* Memory allocated to audio_buf[] in samples */
+	bool live;		/* Live input from stream.c, which grows */
 } audio_file_t;
 
 typedef enum {
@@ -50,11 +54,13 @@ extern audio_file_t *current_audio_file(void);
 
 /* Return a handle for the audio file, NULL on failure */
 extern audio_file_t *open_audio_file(char *filename);
+/* and another one on the same file for a thread to use */
+extern audio_file_t *dup_audio_file(audio_file_t *like);
 
-extern int read_audio_file(audio_file_t *af, char *data,
-			   af_format_t format, int channels,
-			   off_t start,	/* In frames offset from 0.0 */
-			   int nframes);
+extern off_t read_audio_file(audio_file_t *af, char *data,
+			     af_format_t format, int channels,
+			     off_t start,	/* In frames offset from 0.0 */
+			     off_t nframes);
 
 extern void close_audio_file(audio_file_t *audio_file);
 
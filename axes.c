@@ -35,6 +35,7 @@
 #include "barlines.h"
 #include "convert.h"
 #include "gui.h"
+#include "hud.h"
 #include "text.h"
 #include "ui.h"
 #include "window.h"
@@ -412,6 +413,11 @@ draw_status_line(void)
     /* First, blank it */
     gui_paint_rect(min_x, max_y+1, max_x, disp_height-1, black);
 
+    if (show_hud) {
+	draw_hud();
+	return;
+    }
+
     gui_lock();
     sprintf(s, "%g - %g Hz   %g octaves   %g dB",
 	    min_freq, max_freq,
@@ -427,7 +433,11 @@ draw_status_line(void)
     sprintf(s, "%g dB DYNAMIC RANGE", (double)dyn_range);
     draw_text(s, (max_x + disp_offset / 2), max_y + 2, CENTER, BOTTOM);
 
-    sprintf(s, "%s WINDOW AT %g HZ", window_name(window_function), fft_freq);
+    if (show_channel < 0)
+	sprintf(s, "%s WINDOW AT %g HZ", window_name(window_function), fft_freq);
+    else
+	sprintf(s, "%s WINDOW AT %g HZ   CHANNEL %d",
+		window_name(window_function), fft_freq, show_channel + 1);
     draw_text(s, max_x, max_y + 2, RIGHT, BOTTOM);
     gui_unlock();
 
@@ -32,6 +32,11 @@
  * measured in pixels, not time, for convenience.
  * If a beat line doesn't fall exactly on a pixel's timestamp, we round
  * it to the nearest pixel.
+ *
+ * Which columns have lines is kept in a map of the piece's columns around
+ * the display, so that painting a column doesn't have to work it out.
+ * The map is remade when the bar lines or the time zoom change or when
+ * the display moves beyond it.
  */
 
 #include "spettro.h"
@@ -45,10 +50,19 @@
 
 /* Helper function tells whether to display a bar line at this pixel offset */
 static int is_bar_line(int x);
+static int bar_line_at(off_t x);
 /* and its return values, other than FALSE */
 #define BAR_LINE 1
 #define BEAT_LINE 2
 
+/* The map of bar and beat lines for piece columns map_start to
+ * map_start + map_len - 1, and the settings it was made for. */
+static unsigned char *bar_map = NULL;
+static off_t map_start;
+static int map_len = 0;
+static double map_left, map_right, map_secpp;
+static int map_bpb;
+
 /* Set start and end of marked bar.
  * If neither is defined, we display nothing.
  * If only one is defined, display a marker at that point.
@@ -228,6 +242,51 @@ get_col_overlay(int x, color_t *colorp)
 }
 
 /* Does screen column x coincide with the position of a bar or beat line?
+ * The answer comes from the map, which we remake if it's out of date.
+ */
+static int
+is_bar_line(int pos_x)
+{
+    off_t x;		/* Column index into the whole piece */
+
+    /* If neither of the bar positions is defined, there are none displayed */
+    if (left_bar_time == UNDEFINED &&
+	right_bar_time == UNDEFINED) return FALSE;
+
+    x = screen_column_to_piece_column(pos_x);
+
+    if (bar_map == NULL || x < map_start || x >= map_start + map_len ||
+	map_left != left_bar_time || map_right != right_bar_time ||
+	map_bpb != beats_per_bar || map_secpp != secpp) {
+	int i;
+
+	/* Map a screenful either side of the display,
+	 * so that scrolling doesn't remake it often */
+	if (map_len != 3 * disp_width) {
+	    map_len = 3 * disp_width;
+	    bar_map = Realloc(bar_map, map_len);
+	}
+	map_start = screen_column_to_piece_column(min_x) - disp_width;
+	if (x < map_start || x >= map_start + map_len)
+	    map_start = x - disp_width;
+	for (i = 0; i < map_len; i++)
+	    bar_map[i] = bar_line_at(map_start + i);
+	map_left = left_bar_time; map_right = right_bar_time;
+	map_bpb = beats_per_bar; map_secpp = secpp;
+    }
+
+    return bar_map[x - map_start];
+}
+
+void
+free_bar_map()
+{
+    free(bar_map);
+    bar_map = NULL;
+    map_len = 0;
+}
+
+/* Does piece column x coincide with the position of a bar or beat line?
  *
  * This is where bar lines are made three pixels wide when beat lines are shown,
  * by answering "yes" if either of the adjacent columns is on a bar line.
@@ -240,20 +299,12 @@ get_col_overlay(int x, color_t *colorp)
  * FALSE (0)	if there is neither at this column.
  */
 static int
-is_bar_line(int pos_x)
+bar_line_at(off_t x)
 {
-    int x;		/* Column index into the whole piece */
-
     /* The bar positions in pixel columns since the start of the piece. */
-    int left_bar_ticks = -disp_width;  /* impossible value, surely off-screen */
-    int right_bar_ticks = -disp_width;
-    int bar_width = 0;	/* How long is the bar in pixels? 0: there is no bar */
-
-    /* If neither of the bar positions is defined, there are none displayed */
-    if (left_bar_time == UNDEFINED &&
-	right_bar_time == UNDEFINED) return FALSE;
-
-    x = time_to_piece_column(screen_column_to_start_time(pos_x));
+    off_t left_bar_ticks = -(off_t)disp_width;  /* impossible value, surely off-screen */
+    off_t right_bar_ticks = -(off_t)disp_width;
+    off_t bar_width = 0;	/* How long is the bar in pixels? 0: there is no bar */
 
     if (left_bar_time != UNDEFINED)
 	left_bar_ticks = time_to_piece_column(left_bar_time);
@@ -26,3 +26,4 @@ extern void set_left_bar_time(double when);
 extern void set_right_bar_time(double when);
 extern void set_beats_per_bar(int bpb);
 extern bool get_col_overlay(int x, color_t *colorp);
+extern void free_bar_map(void);
@@ -31,16 +31,43 @@
 
 #include "convert.h"
 #include "calc.h"
+#include "pool.h"
 #include "window.h"
 #include "ui.h"
 
-#include <string.h>	/* for memcmp() */
+#include <string.h>	/* for memset() */
 
 static void destroy_result(calc_t *r);
+static void hash_result(calc_t *r);
+static void unhash_result(calc_t *r);
+
+static calc_t *find_result(off_t frame, double fftfreq,
+			   window_function_t window);
+static size_t result_size(calc_t *r);
 
 static calc_t *results = NULL; /* Linked list of result structures */
 static calc_t *last_result = NULL; /* Last element in the linked list */
 
+/* Statistics for the performance HUD */
+static size_t cache_bytes = 0;		/* Memory used by cached results */
+static unsigned long lookups = 0;	/* Calls to recall_result() */
+static unsigned long hits = 0;		/* that found something */
+
+/* The results are also chained in a hash table indexed by their sample frame
+ * so that recall_result(), which is called for every column we repaint,
+ * doesn't have to scan the whole list.
+ * HASH_BITS gives 1024 chains, plenty for a few screenfuls of results.
+ */
+#define HASH_BITS 10
+#define HASH_SIZE (1 << HASH_BITS)
+static calc_t *hash_table[HASH_SIZE];	/* Init to NULL */
+
+/* Fibonacci hashing: the top bits of the product are well mixed
+ * even though the frames are usually multiples of some column step. */
+#define hash(frame) \
+	((unsigned)(((unsigned long long)(frame) * 0x9E3779B97F4A7C15ULL) \
+		    >> (64 - HASH_BITS)))
+
 /* "result" was obtained from malloc(); it is up to us to free it. */
 /* We return the result because, if we find a duplicate in the cache, that
  * becomes the active result.
@@ -49,13 +76,30 @@ calc_t *
 remember_result(calc_t *result)
 {
     /* Drop any stored results more than a screenful before the display */
-    double earliest = screen_column_to_start_time(min_x - disp_width);
+    off_t earliest = screen_column_to_frame(min_x - disp_width);
 
-    while (results != NULL && DELTA_LT(results->t, earliest)) {
+    while (results != NULL && results->frame < earliest) {
 	calc_t *r = results;
 	results = results->next;
+	unhash_result(r);
 	destroy_result(r);
     }
+    if (results == NULL) last_result = NULL;
+
+    /* Check for duplicates */
+    {
+	calc_t *r = find_result(result->frame, result->fft_freq,
+				result->window);
+	if (r != NULL) {
+	    /* Same params: forget the new result and return the old */
+	    fprintf(stderr,
+		    "Discarding duplicate result for %lld/%g/%c\n",
+		    (long long) result->frame, result->fft_freq,
+		    window_key(result->window));
+	    destroy_result(result);
+	    return(r);
+	}
+    }
 
     /* Now find where to add the result to the time-ordered list */
     if (results == NULL) {
@@ -65,7 +109,7 @@ remember_result(calc_t *result)
         /* If it's after the last one (the most common case),
 	 * add it at the tail of the list
 	 */
-	if (DELTA_GT(result->t, last_result->t)) {
+	if (result->frame > last_result->frame) {
             result->next = NULL;
 	    last_result->next = result;
 	    last_result = result;
@@ -80,21 +124,9 @@ remember_result(calc_t *result)
 	    calc_t *r;	/* Handy pointer to the result to examine */
 
 	    for (rp=&results;
-		 (r = *rp) != NULL && DELTA_LE(r->t, result->t);
-		 rp = &((*rp)->next)) {
-		/* Check for duplicates */
-		if (DELTA_EQ(r->t, result->t) &&
-		    r->fft_freq == result->fft_freq &&
-		    r->window == result->window) {
-		    /* Same params: forget the new result and return the old */
-		    fprintf(stderr,
-			    "Discarding duplicate result for %g/%g/%c\n",
-			    result->t, result->fft_freq,
-			    window_key(result->window));
-		    destroy_result(result);
-		    return(r);
-		}
-	    }
+		 (r = *rp) != NULL && r->frame <= result->frame;
+		 rp = &((*rp)->next))
+		;
 	    /* rp points to the "next" field of the cell after which we
 	     * should place it (or to the head pointer "results") */
 	    result->next = *rp;
@@ -102,41 +134,53 @@ remember_result(calc_t *result)
 	    if (r == NULL) last_result = result;
 	}
     }
+    hash_result(result);
+
     return result;
 }
 
-/* Return the result for time t at the current fft_freq and window function
- * or NULL if it hasn't been calculated yet, in which case we schedule it.
- * speclen==-1 or window==-1 means "I don't care for what speclen/window".
+/* Return the result for the FFT centred on sample frame "frame" at the
+ * current fft_freq and window function or NULL if it hasn't been
+ * calculated yet.
  *
  * The parameter "fftfreq" may be the current fft_freq or ANY_FFTFREQ,
  * which will match the result for any FFT frequency.
  * Similarly for the parameter "window".
  */
 calc_t *
-recall_result(double t, double fftfreq, window_function_t window)
+recall_result(off_t frame, double fftfreq, window_function_t window)
 {
-    calc_t *p;
+    calc_t *p = find_result(frame, fftfreq, window);
+
+    lookups++;
+    if (p != NULL) hits++;
 
-    /* If it's later than the last cached result, we don't have it.
-     * This saves uselessly scanning the whole list of results.
-     */
-    if (last_result == NULL || DELTA_GT(t, last_result->t))
-	return(NULL);
+    return(p);
+}
 
-    for (p=results; p != NULL; p=p->next) {
-	/* If the time is the same and speclen is the same,
+/* Report the cache's memory use and how many lookups have found something */
+void
+cache_stats(size_t *bytesp, unsigned long *lookupsp, unsigned long *hitsp)
+{
+    *bytesp = cache_bytes;
+    *lookupsp = lookups;
+    *hitsp = hits;
+}
+
+/* The hash table search for recall_result(), also used to spot duplicates */
+static calc_t *
+find_result(off_t frame, double fftfreq, window_function_t window)
+{
+    calc_t *p;
+
+    for (p = hash_table[hash(frame)]; p != NULL; p = p->hash_next) {
+	/* If the frame is the same and speclen is the same,
 	 * this is the result we want */
-	if (DELTA_GE(p->t, t) && DELTA_LE(p->t, t) &&
+	if (p->frame == frame &&
 	    (fftfreq == ANY_FFTFREQ || p->fft_freq == fftfreq) &&
 	    (window  == ANY_WINDOW  || p->window  == window)) {
 	    break;
 	}
-	/* If the stored time is greater, it isn't there. */
-	if (DELTA_GT(p->t, t)) {
-	    p = NULL;
-	    break;
-	}
     }
     return(p);	/* NULL if not found */
 }
@@ -153,12 +197,72 @@ drop_all_results(void)
 	r = next;
     }
     results = last_result = NULL;
+    memset(hash_table, 0, sizeof(hash_table));
+    cache_bytes = 0;
+}
+
+/* Drop the results for columns that aren't on-screen, when memory is short */
+void
+shed_results(void)
+{
+    off_t first = screen_column_to_frame(min_x);
+    off_t last = screen_column_to_frame(max_x);
+    calc_t **rp;
+
+    last_result = NULL;
+    for (rp = &results; *rp != NULL; /* see below */) {
+	calc_t *r = *rp;
+
+	if (r->frame < first || r->frame > last) {
+	    *rp = r->next;
+	    unhash_result(r);
+	    destroy_result(r);
+	} else {
+	    last_result = r;
+	    rp = &(r->next);
+	}
+    }
+}
+
+/* Add a result to the head of its hash chain */
+static void
+hash_result(calc_t *r)
+{
+    calc_t **hp = &hash_table[hash(r->frame)];
+
+    r->hash_next = *hp;
+    *hp = r;
+    cache_bytes += result_size(r);
+}
+
+/* Remove a result from its hash chain */
+static void
+unhash_result(calc_t *r)
+{
+    calc_t **hp;
+
+    for (hp = &hash_table[hash(r->frame)]; *hp != NULL;
+	 hp = &((*hp)->hash_next)) {
+	if (*hp == r) {
+	    *hp = r->hash_next;
+	    cache_bytes -= result_size(r);
+	    return;
+	}
+    }
 }
 
 /* Free the memory associated with a result structure */
 static void
 destroy_result(calc_t *r)
 {
-    free(r->spec);
-    free(r);
+    free_calc(r);	/* and its spectrum */
+}
+
+/* How much memory does a cached result occupy? */
+static size_t
+result_size(calc_t *r)
+{
+    int speclen = fft_freq_to_speclen(r->fft_freq, current_sample_rate());
+
+    return sizeof(*r) + (speclen + 1) * r->channels * sizeof(float);
 }
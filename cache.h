@@ -24,9 +24,12 @@
 #include "calc.h"
 
 extern calc_t *remember_result(calc_t *result);
-extern calc_t *recall_result(double t, double fftfreq,
+extern calc_t *recall_result(off_t frame, double fftfreq,
 			     window_function_t window);
 extern void	drop_all_results(void);
+extern void	shed_results(void);
+extern void	cache_stats(size_t *bytesp, unsigned long *lookupsp,
+			    unsigned long *hitsp);
 
 #define CACHE_H
 #endif
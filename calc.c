@@ -34,6 +34,7 @@
 #include "scheduler.h"
 
 #include <unistd.h>	/* for usleep() */
+#include <sys/time.h>	/* for gettimeofday() */
 
 #if ECORE_MAIN
 #include <Ecore.h>
@@ -47,6 +48,8 @@
 #include "calc.h"
 #include "gui.h"	/* For RESULT_EVENT */
 #include "lock.h"
+#include "pool.h"
+#include "shared_cache.h"
 #include "spectrum.h"
 #include "ui.h"
 
@@ -57,6 +60,8 @@
 /* Helper functions */
 static void calc_result(calc_t *result);
 static calc_t *get_result(calc_t *calc, spectrum *spec, int speclen);
+static int fft_threads(int speclen);
+static void note_fft_time(int speclen, int nthreads, double secs);
 
 void
 calc(calc_t *calc)
@@ -64,31 +69,98 @@ calc(calc_t *calc)
     spectrum *spec;
     int speclen	= fft_freq_to_speclen(calc->fft_freq,
     				      current_sample_rate());
+    int nthreads;
+    struct timeval before, after;
     calc_t *result;
 
     /* If parameters have changed since the work was queued, don't bother.
      * This should never happen because we clear the work queue when we
      * change these parameters */
-    if (calc->window != window_function || calc->fft_freq != fft_freq) {
-	remove_job(calc);
-	free(calc);
+    if (calc->window != window_function || calc->fft_freq != fft_freq ||
+	calc->channels != calc_channels()) {
+	remove_job(calc);	/* which also frees it */
 	return;
     }
 
-    spec = create_spectrum(speclen, calc->window);
+    /* Another spettro viewing the same file may already have done it */
+    if ((result = shared_recall(calc, speclen)) != NULL) {
+#if ECORE_MAIN
+	result->thread = calc->thread;
+#endif
+	calc_result(result);
+	return;
+    }
+
+    nthreads = fft_threads(speclen);
+    spec = create_spectrum(speclen, calc->channels, calc->window, nthreads);
     if (spec == NULL) {
-	fprintf(stderr, "Can't create spectrum.\n");
+	/* There's no room for its buffers under --max-memory.
+	 * Leave it to be done when shedding has made some. */
+	requeue_job(calc);
 	return;
     }
 
+    gettimeofday(&before, NULL);
     result = get_result(calc, spec, speclen);
+    gettimeofday(&after, NULL);
 
-    if (result != NULL) calc_result(result);
-    else remove_job(calc);
+    if (result != NULL) {
+	note_fft_time(speclen, nthreads,
+		      (after.tv_sec - before.tv_sec) +
+		      (after.tv_usec - before.tv_usec) * 0.000001);
+	shared_publish(result, speclen);
+	calc_result(result);
+    } else remove_job(calc);
 
     destroy_spectrum(spec);
 }
 
+/*
+ * FFTW can split a very large transform across several threads, which is
+ * worth doing when calculation threads would otherwise sit idle, as after
+ * a seek, when only a few columns are urgent. When the queue is deep, it's
+ * more efficient for each thread to do a column of its own.
+ *
+ * We keep the average time taken for each octave of transform sizes done
+ * each way, try both, and only split them if that turns out to be quicker.
+ */
+#define MIN_THREADED_SPECLEN 16384	/* Smaller ones aren't worth splitting */
+
+/* Seconds per column, indexed by ilogb(speclen) and by whether the
+ * transform was split. All the calc threads update these, so they are
+ * under lock_list(), which is only ever held for a moment. */
+static double fft_time[32][2];
+
+/* How many threads should FFTW use for a transform of this size? */
+static int
+fft_threads(int speclen)
+{
+    int size = ilogb(speclen);
+    int idle;
+    bool split;
+
+    if (speclen < MIN_THREADED_SPECLEN || (idle = idle_threads()) == 0)
+	return 1;
+
+    /* Use the idle threads' CPUs unless that has been slower */
+    lock_list();
+    split = fft_time[size][1] == 0.0 || fft_time[size][1] < fft_time[size][0];
+    unlock_list();
+
+    return split ? idle + 1 : 1;
+}
+
+static void
+note_fft_time(int speclen, int nthreads, double secs)
+{
+    double *t = &fft_time[ilogb(speclen)][nthreads > 1];
+
+    /* A running average, which follows changes in the machine's load */
+    lock_list();
+    *t = (*t == 0.0) ? secs : 0.75 * *t + 0.25 * secs;
+    unlock_list();
+}
+
 /* The function called by calculation threads to report a result */
 static void
 calc_result(calc_t *result)
@@ -121,19 +193,22 @@ get_result(calc_t *calc, spectrum *spec, int speclen)
 {
         calc_t *result;	/* The result structure */
 	int fftsize;
+	float rms;
 
 	/* Check that the requested sample is within the current interesting
 	 * region: either on-screen or in the lookahead/behind regions */
-	if (DELTA_LT(calc->t, disp_time - (disp_offset - min_x - LOOKAHEAD) * secpp) &&
-	    DELTA_GT(calc->t, disp_time + (max_x - disp_offset + LOOKAHEAD) * secpp)) {
+	if (calc->frame < screen_column_to_frame(min_x - LOOKAHEAD) ||
+	    calc->frame > screen_column_to_frame(max_x + LOOKAHEAD)) {
 	    fprintf(stderr, "Skipping calculation of an off-screen column\n");
 	    return NULL;
 	}
 
-	result = (calc_t *) Malloc(sizeof(calc_t));
-	result->t = calc->t;
+	result = new_calc();
+	result->frame = calc->frame;
 	result->fft_freq = calc->fft_freq;
 	result->window = calc->window;
+	result->channels = calc->channels;
+	result->priority = calc->priority;
 #if ECORE_MAIN
 	result->thread = calc->thread;
 #endif
@@ -141,23 +216,32 @@ get_result(calc_t *calc, spectrum *spec, int speclen)
 	fftsize = speclen * 2;
 
 	/* Fetch the appropriate audio for our FFT source */
-	/* The data is centred on the requested time. */
-	if (read_cached_audio(calc->af, (char *) spec->time_domain, af_float, 1,
-			      lrint(calc->t * current_sample_rate()) - fftsize/2,
+	/* The data is centred on the requested time.
+	 * For more than one channel, we get a plane of fftsize samples
+	 * for each one, which is how the spectrum's plan expects them. */
+	if (read_cached_audio(calc->af, (char *) spec->time_domain,
+			      af_float, calc->channels,
+			      calc->frame - fftsize/2,
 			      fftsize) != fftsize) {
 	    /* Actually, it can't fail any more, but... */
-	    free(result);
+	    free_calc(result);
 	    return NULL;
 	}
 
+	/* The level has to be measured before the audio is windowed */
+	rms = audio_rms(spec->time_domain, fftsize * calc->channels);
+
 	calc_magnitude_spectrum(spec);
 
-	/* We need to pass back a buffer obtained from malloc() that will
+	compute_features(&result->features, rms, spec->mag_spec, speclen,
+			 calc->channels, calc->af->sample_rate);
+
+	/* We need to pass back a buffer obtained from new_spec() that will
 	 * subsequently be freed or kept. Rather than memcpy() it, we hijack
-	 * the already-allocated buffer and malloc a new one for next time.
+	 * the already-allocated buffer and get a new one for next time.
 	 */
 	result->spec = spec->mag_spec;
-	spec->mag_spec = Malloc((speclen + 1) * sizeof(*(spec->mag_spec)));
+	spec->mag_spec = new_spec(speclen, calc->channels);
 
 	return(result);
 }
@@ -30,9 +30,23 @@
 #endif
 
 #include "audio_file.h"
+#include "col_features.h"
 #include "spettro.h"
 #include "window.h"
 
+#include <sys/time.h>	/* for struct timeval */
+
+/* The scheduler's priority classes, most urgent first.
+ * Display work is visible or lookahead according to where its column is,
+ * and moves between the two as the display scrolls.
+ * Batch work is done by threads of their own and is never queued. */
+typedef enum {
+    PRI_VISIBLE,	/* Columns that are on-screen now */
+    PRI_LOOKAHEAD,	/* Columns just off either side of the screen */
+    PRI_BATCH,		/* The pyramid, the fingerprint index and PNG files */
+    NUMBER_OF_PRIORITIES
+} priority_t;
+
 /* The parameters for a calculation, passed to calc(), giving all parameters,
  * also, an element of the list of needed FFTs used by the scheduler.
  *
@@ -40,21 +54,33 @@
  */
 typedef struct calc_t {
     /* These items define what calculation is to be or was performed */
-    double		t;	/* FFT centered on when? */
+    off_t		frame;	/* FFT centered on which sample frame? */
     double		fft_freq; /* FFT frequency when scheduled */
     window_function_t	window;
+    int			channels; /* 1 for the mono mix or the number of
+				   * channels in the audio file */
     audio_file_t	*af;
+    priority_t		priority;
+    struct timeval	queued;	/* When it was scheduled, if the HUD is on */
 
     /* This is the result */
     float *		spec;	 /* The linear spectrum from [0..speclen]
-    				  * for 0Hz to audio_file->sample_rate / 2 */
+    				  * for 0Hz to audio_file->sample_rate / 2,
+				  * or one after the other for each channel */
+    features_t		features; /* A summary of the column, from features.c */
     /* Other data */
 #if ECORE_MAIN
     Ecore_Thread *	thread;
 #endif
     struct calc_t *	next;	/* List of calcs to perform, in time order */
+    struct calc_t *	hash_next; /* Chain of cached results in cache.c */
 } calc_t;
 
+/* How many channels do calculations for the current display need?
+ * When showing a single channel, we calculate all of them in one go
+ * so that flipping between them needs no recalculation. */
+#define calc_channels() (show_channel < 0 ? 1 : current_audio_file()->channels)
+
 /* Used in recall_result() to see if the cache has any results for a column */
 #define ANY_FFTFREQ (0)
 
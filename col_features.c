@@ -0,0 +1,265 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * col_features.c - A few figures describing each column, made alongside its FFT
+ *
+ * While a calc thread has a column's audio and magnitude spectrum in hand,
+ * compute_features() measures its RMS level, spectral centroid, loudest bin
+ * and the energy in a few bands. The main thread keeps these in an array
+ * indexed by piece column, separate from the result cache so that it stays
+ * when the results are dropped, and works out the spectral flux between
+ * neighbouring columns as they arrive.
+ *
+ * The E key uses them to choose the brightness and contrast for the visible
+ * columns without re-reading the audio, and Shift-E prints them.
+ */
+
+#include "spettro.h"
+#include "col_features.h"
+
+#include "audio_file.h"
+#include "calc.h"
+#include "convert.h"
+#include "ui.h"
+#include "ui_funcs.h"
+
+#include <string.h>	/* for memcpy() and memset() */
+
+/* The array of features, for the settings they were made with */
+static features_t *features = NULL;
+static off_t nfeatures = 0;		/* How many entries are allocated */
+static double features_ppsec = 0.0;
+static double features_fft_freq = 0.0;
+static window_function_t features_window = -1;
+
+/*
+ * Calculation, in the calc threads
+ */
+
+/* The RMS of a buffer of samples, called before they are windowed */
+float
+audio_rms(const float *audio, int nsamples)
+{
+    double sum = 0.0;
+    int i;
+
+    for (i = 0; i < nsamples; i++) sum += audio[i] * audio[i];
+
+    return nsamples > 0 ? sqrt(sum / nsamples) : 0.0;
+}
+
+/* Fill in a column's features from its magnitude spectrum.
+ * With several channels, use the average of their magnitudes. */
+void
+compute_features(features_t *f, float rms, const float *mag_spec,
+		 int speclen, int nchannels, double sample_rate)
+{
+    double hz_per_bin = sample_rate / (2 * speclen);
+    double sum = 0.0, weighted = 0.0;
+    double band_sum = 0.0;
+    int band = 0;
+    int band_bins = 0;
+    int band_end;	/* First bin of the next band */
+    float peak = -1.0;
+    int peak_bin = 0;
+    int k, c;
+
+    f->rms = rms;
+
+    /* The bands are spaced logarithmically from bin 1 to speclen */
+    band_end = lrint(pow(speclen, (band + 1.0) / FEATURE_BANDS));
+    for (k = 1; k <= speclen; k++) {
+	float mag = 0.0;
+
+	for (c = 0; c < nchannels; c++) mag += mag_spec[c * (speclen + 1) + k];
+	mag /= nchannels;
+
+	sum += mag;
+	weighted += mag * k;
+	if (mag > peak) {
+	    peak = mag;
+	    peak_bin = k;
+	}
+
+	band_sum += mag * mag;
+	band_bins++;
+	if (k >= band_end || k == speclen) {
+	    f->band[band] = 10.0 * log10(band_sum / band_bins + 1e-20);
+	    band_sum = 0.0;
+	    band_bins = 0;
+	    /* Narrow bands at the bottom may be empty; give them the same */
+	    while (++band < FEATURE_BANDS &&
+		   (band_end = lrint(pow(speclen, (band + 1.0) / FEATURE_BANDS)))
+		   <= k)
+		f->band[band] = f->band[band - 1];
+	}
+    }
+    while (band < FEATURE_BANDS) {
+	f->band[band] = f->band[band - 1];
+	band++;
+    }
+
+    f->centroid = sum > 0.0 ? weighted / sum * hz_per_bin : 0.0;
+    f->peak_freq = peak_bin * hz_per_bin;
+    f->peak_mag = peak;
+    f->flux = -1.0;
+    f->valid = TRUE;
+}
+
+/*
+ * Storage, in the main thread
+ */
+
+/* The mean rise in band energy from one column to the next */
+static float
+flux(features_t *prev, features_t *this)
+{
+    double rise = 0.0;
+    int b;
+
+    for (b = 0; b < FEATURE_BANDS; b++)
+	if (this->band[b] > prev->band[b]) rise += this->band[b] - prev->band[b];
+
+    return rise / FEATURE_BANDS;
+}
+
+/* Remember the features that came with a result for the current settings */
+void
+store_features(calc_t *result)
+{
+    off_t col = frame_to_piece_column(result->frame);
+
+    if (!result->features.valid || col < 0) return;
+
+    /* When the columns change, the old features are no use */
+    if (ppsec != features_ppsec || fft_freq != features_fft_freq ||
+	window_function != features_window) {
+	drop_features();
+	features_ppsec = ppsec;
+	features_fft_freq = fft_freq;
+	features_window = window_function;
+    }
+
+    if (col >= nfeatures) {
+	off_t n = time_to_piece_column(audio_file_length()) + 1;
+	features_t *new;
+
+	if (n <= col) n = col + 1 + lrint(ppsec * 60); /* Live input grows */
+	new = Tmalloc(MEM_FEATURES, n * sizeof(*features));
+
+	if (nfeatures > 0)
+	    memcpy(new, features, nfeatures * sizeof(*features));
+	memset(new + nfeatures, 0, (n - nfeatures) * sizeof(*features));
+	Tfree(MEM_FEATURES, features, nfeatures * sizeof(*features));
+	features = new;
+	nfeatures = n;
+    }
+
+    features[col] = result->features;
+    if (col > 0 && features[col - 1].valid)
+	features[col].flux = flux(&features[col - 1], &features[col]);
+    if (col + 1 < nfeatures && features[col + 1].valid)
+	features[col + 1].flux = flux(&features[col], &features[col + 1]);
+}
+
+/* The features of a piece column, or NULL if we don't have them */
+features_t *
+get_features(off_t col)
+{
+    if (ppsec != features_ppsec || fft_freq != features_fft_freq ||
+	window_function != features_window || col < 0 || col >= nfeatures || !features[col].valid)
+	return NULL;
+
+    return &features[col];
+}
+
+void
+drop_features()
+{
+    Tfree(MEM_FEATURES, features, nfeatures * sizeof(*features));
+    features = NULL;
+    nfeatures = 0;
+}
+
+/*
+ * Uses of the features
+ */
+
+/* Set the brightness and contrast to suit the visible columns:
+ * the loudest peak is full brightness and the dynamic range reaches
+ * AUTO_HEADROOM dB below the peaks of the quietest tenth of the columns.
+ *
+ * Returns FALSE if no visible columns have been calculated yet.
+ */
+#define AUTO_HEADROOM 40.0
+
+static int
+compare_floats(const void *a, const void *b)
+{
+    float fa = *(const float *)a, fb = *(const float *)b;
+
+    return fa < fb ? -1 : fa > fb ? 1 : 0;
+}
+
+bool
+auto_levels()
+{
+    float *peaks = Malloc((max_x - min_x + 1) * sizeof(*peaks));
+    int n = 0;
+    int x;
+    float loudest, quiet;
+
+    for (x = min_x; x <= max_x; x++) {
+	features_t *f = get_features(screen_column_to_piece_column(x));
+
+	if (f != NULL && f->peak_mag > 0.0) peaks[n++] = f->peak_mag;
+    }
+    if (n == 0) {
+	free(peaks);
+	return FALSE;
+    }
+
+    qsort(peaks, n, sizeof(*peaks), compare_floats);
+    loudest = peaks[n - 1];
+    quiet = peaks[n / 10];
+    free(peaks);
+
+    logmax = log10(loudest);
+    dyn_range = 20.0 * log10(loudest / quiet) + AUTO_HEADROOM;
+    if (dyn_range > 160.0) dyn_range = 160.0;
+
+    return TRUE;
+}
+
+/* Print the features of the visible columns on stdout */
+void
+print_features()
+{
+    int x;
+
+    printf("time,rms_db,centroid_hz,flux_db,peak_hz,peak_db\n");
+    for (x = min_x; x <= max_x; x++) {
+	features_t *f = get_features(screen_column_to_piece_column(x));
+
+	if (f == NULL) continue;
+	printf("%.3f,%.1f,%.0f,%.2f,%.0f,%.1f\n",
+	       screen_column_to_start_time(x),
+	       20.0 * log10(f->rms + 1e-10), f->centroid, f->flux,
+	       f->peak_freq, 20.0 * log10(f->peak_mag + 1e-10));
+    }
+}
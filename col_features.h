@@ -0,0 +1,54 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * col_features.h: Declarations for col_features.c
+ */
+
+#ifndef COL_FEATURES_H
+
+#include "spettro.h"
+
+/* Number of log-spaced frequency bands whose energy we keep for the flux */
+#define FEATURE_BANDS 16
+
+typedef struct {
+    float rms;			/* RMS level of the audio, linear */
+    float centroid;		/* Spectral centroid in Hz */
+    float flux;			/* Spectral flux from the previous column in dB,
+				 * or -1 if that isn't known yet */
+    float peak_freq;		/* Frequency of the loudest bin in Hz */
+    float peak_mag;		/* and its magnitude, linear */
+    float band[FEATURE_BANDS];	/* Energy in each band, in dB */
+    bool valid;			/* Has this column been calculated? */
+} features_t;
+
+/* Called by the calc threads */
+extern float audio_rms(const float *audio, int nsamples);
+extern void  compute_features(features_t *f, float rms, const float *mag_spec,
+			      int speclen, int nchannels, double sample_rate);
+
+/* Called in the main thread */
+struct calc_t;
+extern void  store_features(struct calc_t *result);
+extern features_t *get_features(off_t piece_column);
+extern void  drop_features(void);
+extern bool  auto_levels(void);
+extern void  print_features(void);
+
+#define COL_FEATURES_H
+#endif
@@ -22,9 +22,11 @@
 #include "convert.h"
 
 #include "audio_file.h"		/* for audio_file->sample_rate */
+#include "fft.h"		/* for calibrated_speclen() */
 #include "ui.h"
 
 #include <ctype.h>		/* for toupper() */
+#include <limits.h>		/* for INT_MIN and INT_MAX */
 
 /*
  * Vertical position (frequency domain) conversion functions
@@ -121,11 +123,14 @@ note_number_to_freq(const int n)
  */
 
 /* Convert a time in seconds to the screen column in the whole piece that
- * contains this moment. */
-int
+ * contains this moment.
+ * Zoomed right in, there can be as many columns as there are sample frames,
+ * which overflows an int for long recordings at high sample rates.
+ */
+off_t
 time_to_piece_column(double t)
 {
-    return (int) floor(t / secpp + DELTA);
+    return (off_t) floor(t / secpp + DELTA);
 }
 
 int
@@ -141,12 +146,64 @@ screen_column_to_start_time(int col)
     return disp_time + (col - disp_offset) * secpp;
 }
 
+/*
+ * Sample-frame addressing of columns
+ *
+ * The FFT for each column of the piece is centred on an exact sample frame,
+ * and calculations and results are identified by that integer, not by a time,
+ * so that they can be compared exactly and don't drift on long files.
+ *
+ * We divide by ppsec rather than multiplying by secpp so that when the time
+ * axis is zoomed by a factor of two, column 2*n at the new ppsec gives exactly
+ * the same frame as column n at the old one, and cached results still match.
+ */
+off_t
+piece_column_to_frame(off_t col)
+{
+    return (off_t) llrint(col * current_sample_rate() / ppsec);
+}
+
+/* Which column of the piece is nearest to this sample frame?
+ * If the frame isn't exactly a column's, e.g. it's from a result calculated
+ * at a different ppsec, piece_column_to_frame() of the answer won't give the
+ * same frame back.
+ */
+off_t
+frame_to_piece_column(off_t frame)
+{
+    return (off_t) llrint(frame * ppsec / current_sample_rate());
+}
+
+/* disp_time is always a multiple of secpp, so this is exact */
+off_t
+screen_column_to_piece_column(int col)
+{
+    return (off_t) llrint(disp_time * ppsec) + (col - disp_offset);
+}
+
+off_t
+screen_column_to_frame(int col)
+{
+    return piece_column_to_frame(screen_column_to_piece_column(col));
+}
+
+/* Frames that are miles off-screen give INT_MIN or INT_MAX */
+int
+frame_to_screen_column(off_t frame)
+{
+    off_t col = frame_to_piece_column(frame) - (off_t) llrint(disp_time * ppsec)
+		+ disp_offset;
+
+    if (col < INT_MIN) return INT_MIN;
+    if (col > INT_MAX) return INT_MAX;
+    return (int) col;
+}
+
 /*
  *	Choose a good FFT size for the given FFT frequency
  */
 
 /* Helper functions */
-static bool is_good_speclen(int n);
 static bool is_2357(int n);
 
 int
@@ -154,6 +211,11 @@ fft_freq_to_speclen(double fft_freq, double sample_rate)
 {
     int speclen = (sample_rate / fft_freq + 1) / 2;
     int d; /* difference between ideal speclen and preferred speclen */
+    int calibrated;
+
+    /* If --fft-calibration has timed the sizes near this one, use its pick */
+    if ((calibrated = calibrated_speclen(speclen, NULL)) > 0)
+	return calibrated;
 
     /* Find the nearest fast value for the FFT size. */
 
@@ -189,7 +251,7 @@ fft_freq_to_speclen(double fft_freq, double sample_rate)
  * the "half complex" format conversion in calc_magnitudes().
  */
 
-static bool
+bool
 is_good_speclen (int n)
 {
     /* It wants n, 11*n, 13*n but not (11*13*n)
@@ -32,14 +32,24 @@ extern double note_number_to_freq(const int note);
 /*
  * Horizontal position (time domain) conversion functions
  */
-extern int time_to_piece_column(double t);
+extern off_t time_to_piece_column(double t);
 extern int time_to_screen_column(double t);
 extern double screen_column_to_start_time(int col);
 
+/*
+ * Sample-frame addressing of columns
+ */
+extern off_t piece_column_to_frame(off_t col);
+extern off_t frame_to_piece_column(off_t frame);
+extern off_t screen_column_to_piece_column(int col);
+extern off_t screen_column_to_frame(int col);
+extern int frame_to_screen_column(off_t frame);
+
 /*
  * Choose a good FFT size for the given FFT frequency
  */
 extern int fft_freq_to_speclen(double fft_freq, double sample_rate);
+extern bool is_good_speclen(int n);
 
 extern char *seconds_to_string(double secs);
 extern double string_to_seconds(char *string);
@@ -38,11 +38,17 @@
 #include "axes.h"
 #include "barlines.h"
 #include "cache.h"
+#include "calc.h"
 #include "colormap.h"
+#include "col_features.h"
 #include "convert.h"
 #include "dump.h"
+#include "fft.h"
+#include "fingerprint.h"
 #include "gui.h"
+#include "hud.h"
 #include "key.h"
+#include "lock.h"
 #include "overlay.h"
 #include "paint.h"
 #include "scheduler.h"
@@ -50,6 +56,8 @@
 #include "ui_funcs.h"
 #include "window.h"
 
+#include <strings.h>	/* for strcasecmp() */
+
 static void
 k_change_color(key_t key)
 {
@@ -114,7 +122,7 @@ k_left_right(key_t key)
     if (Shift && !Ctrl) by = disp_width * secpp;
     if (!Shift && Ctrl) by = secpp;
     if (Shift && Ctrl) by = 1.0;
-    time_pan_by(key == KEY_LEFT ? -by : +by);
+    request_time_pan_by(key == KEY_LEFT ? -by : +by);
 }
 
 /*
@@ -137,7 +145,7 @@ k_end(key_t key)
 /*
  * Arrow Up/Down: Pan the frequency axis by a tenth of the screen height.
  * With Shift: by a screenful. With Ctrl, by a pixel, with both by a semitone.
- * The argument to freq_pan_by() multiplies min_freq and max_freq.
+ * The argument to request_freq_pan_by() multiplies min_freq and max_freq.
  * Page Up/Down: Pan the frequency axis by a screenful
  */
 static void
@@ -145,28 +153,26 @@ k_freq_pan(key_t key)
 {
     switch (key) {
     case KEY_UP:
-	freq_pan_by((Ctrl && !Shift) ? v_pixel_freq_ratio():
-		    (Shift && !Ctrl) ? max_freq / min_freq :
-		    (Shift && Ctrl) ? pow(2, 1/12.0) :
-		    pow(max_freq / min_freq, 1/10.0));
+	request_freq_pan_by((Ctrl && !Shift) ? v_pixel_freq_ratio():
+			    (Shift && !Ctrl) ? max_freq / min_freq :
+			    (Shift && Ctrl) ? pow(2, 1/12.0) :
+			    pow(max_freq / min_freq, 1/10.0));
 	break;
     case KEY_DOWN:
-	freq_pan_by((Ctrl && !Shift) ? 1.0 / v_pixel_freq_ratio() :
-		    (Shift && !Ctrl) ? min_freq / max_freq :
-		    (Shift && Ctrl) ? 1.0 / pow(2, 1/12.0) :
-		    pow(min_freq / max_freq, 1/10.0));
+	request_freq_pan_by((Ctrl && !Shift) ? 1.0 / v_pixel_freq_ratio() :
+			    (Shift && !Ctrl) ? min_freq / max_freq :
+			    (Shift && Ctrl) ? 1.0 / pow(2, 1/12.0) :
+			    pow(min_freq / max_freq, 1/10.0));
 	break;
     case KEY_PGUP:
-	freq_pan_by(max_freq/min_freq);
+	request_freq_pan_by(max_freq/min_freq);
 	break;
     case KEY_PGDN:
-	freq_pan_by(min_freq/max_freq);
+	request_freq_pan_by(min_freq/max_freq);
 	break;
     default:
     	break;	/* Shut up compiler warnings */
     }
-
-    gui_update_display();
 }
 
 /* Zoom on the time axis by a factor of two so that, when zooming in,
@@ -175,8 +181,7 @@ k_freq_pan(key_t key)
 static void
 k_time_zoom(key_t key)
 {
-    time_zoom_by(Shift ? 2.0 : 0.5);
-    repaint_display(FALSE);
+    request_time_zoom_by(Shift ? 2.0 : 0.5);
 }
 
 /* Y/y: Zoom in/out on the frequency axis.
@@ -190,25 +195,22 @@ k_freq_zoom(key_t key)
 
     if (Ctrl) by = (double)(max_y - min_y) / (double)((max_y-1) - (min_y+1));
     else by = 2.0;
-    freq_zoom_by(Shift ? by : 1.0/by);
-    repaint_display(TRUE);
+    request_freq_zoom_by(Shift ? by : 1.0/by);
 }
 
 /* Normal zoom-in zoom-out, i.e. both axes. */
 static void
 k_both_zoom_in(key_t key)
 {
-    freq_zoom_by(2.0);
-    time_zoom_by(2.0);
-    repaint_display(FALSE);
+    request_freq_zoom_by(2.0);
+    request_time_zoom_by(2.0);
 }
 
 static void
 k_both_zoom_out(key_t key)
 {
-    freq_zoom_by(0.5);
-    time_zoom_by(0.5);
-    repaint_display(FALSE);
+    request_freq_zoom_by(0.5);
+    request_time_zoom_by(0.5);
 }
 
 /* Capital letters choose the window function */
@@ -230,6 +232,8 @@ k_set_window(key_t key)
 
     if (new_fn != window_function) {
 	window_function = new_fn;
+	prepare_window(window_function,
+		       2 * fft_freq_to_speclen(fft_freq, current_sample_rate()));
 	if (show_time_axes) draw_status_line();
 	drop_all_work();
 	repaint_display(FALSE);
@@ -263,6 +267,33 @@ k_brightness(key_t key)
     repaint_display(TRUE);
 }
 
+/* e: Set the brightness and contrast from the visible columns' levels */
+static void
+k_auto_levels(key_t key)
+{
+    if (!auto_levels()) {
+	fprintf(stderr, "No columns have been calculated yet\n");
+	return;
+    }
+    if (show_time_axes) draw_status_line();
+    repaint_display(TRUE);
+}
+
+/* E: Print the visible columns' features on stdout */
+static void
+k_print_features(key_t key)
+{
+    print_features();
+}
+
+/* j/J: Go to the next/previous place where the passage between the
+ * bar lines recurs */
+static void
+k_find_similar(key_t key)
+{
+    find_similar(Shift);
+}
+
 /* Toggle frequency axis */
 static void
 k_toggle_axes(key_t key)
@@ -300,6 +331,23 @@ k_toggle_axes(key_t key)
     draw_axes();
 }
 
+/* Ctrl-A: Toggle the performance figures in place of the status line */
+static void
+k_toggle_hud(key_t key)
+{
+    show_hud = !show_hud;
+    if (show_time_axes) {
+	draw_status_line();
+    } else if (show_hud) {
+	/* The HUD lives in the status line, so show that */
+	bool old_shift = Shift;
+
+	Shift = TRUE;
+	k_toggle_axes(key);
+	Shift = old_shift;
+    }
+}
+
 /* w: Cycle through window functions;
  * W: cycle backwards
  */
@@ -309,6 +357,8 @@ k_cycle_window(key_t key)
     window_function = ((!Shift) ? (window_function + 1)
     			        : (window_function + NUMBER_OF_WINDOW_FUNCTIONS-1))
     		      % NUMBER_OF_WINDOW_FUNCTIONS;
+    prepare_window(window_function,
+		   2 * fft_freq_to_speclen(fft_freq, current_sample_rate()));
     if (show_time_axes) draw_status_line();
     drop_all_work();
     repaint_display(FALSE);
@@ -361,12 +411,13 @@ k_print_params(key_t key)
     printf("disp_time=%.3f ppsec=%.3f jobs_in_flight=%d\n",
 	disp_time, ppsec, jobs_in_flight);
 
-    printf("%s %.3f (player: %.3f) Showing %.3f to %.3f\n",
+    printf("%s %.3f (player: %.3f, latency %.1fms) Showing %.3f to %.3f\n",
 	playing == PLAYING ? "Playing" :
 	playing == STOPPED ? "Stopped at" :
 	playing == PAUSED  ? "Paused at" : "Doing what? at",
 	get_playing_time(),
 	get_audio_players_time(),
+	audio_latency() * 1000.0,
 	screen_column_to_start_time(min_x),
 	screen_column_to_start_time(max_x + 1));
 
@@ -383,6 +434,17 @@ k_print_params(key_t key)
 			       * beats_per_bar));
     if (left_bar_time != UNDEFINED || right_bar_time != UNDEFINED)
 	printf("\n");
+
+    print_memory_usage();
+
+    if (lock_stats) dump_lock_stats();
+}
+
+/* Show how often each lock has been fought over */
+static void
+k_dump_lock_stats(key_t key)
+{
+    dump_lock_stats();
 }
 
 /* Display the current playing time */
@@ -422,6 +484,9 @@ k_fft_size(key_t key)
     }
     reposition_audio_cache();
     drop_all_work();
+    calibrate_fft(fft_freq, current_sample_rate());
+    prepare_window(window_function,
+		   2 * fft_freq_to_speclen(fft_freq, current_sample_rate()));
 
     if (show_time_axes) draw_status_line();
 
@@ -508,6 +573,36 @@ k_beats_per_bar(key_t key)
     }
 }
 
+/* Cycle through showing the mono mix and each of the audio's channels */
+static void
+k_channel(key_t key)
+{
+    int nchannels = current_audio_file()->channels;
+    int old_calc_channels = calc_channels();
+
+    if (nchannels == 1) {
+	fprintf(stderr, "The audio file only has one channel\n");
+	return;
+    }
+
+    /* show_channel goes -1 (the mix), 0, 1 ... nchannels-1 and round again */
+    if (!Shift) {
+	if (++show_channel >= nchannels) show_channel = -1;
+    } else {
+	if (--show_channel < -1) show_channel = nchannels - 1;
+    }
+
+    /* Going between the mix and single channels needs new calculations.
+     * Between channels, all of them are already in the result cache. */
+    if (calc_channels() != old_calc_channels) {
+	drop_all_work();
+	drop_all_results();
+    }
+
+    if (show_time_axes) draw_status_line();
+    repaint_display(FALSE);
+}
+
 static void
 k_dump_audio_cache(key_t key)
 {
@@ -570,18 +665,21 @@ static key_fn key_fns[] = {
     { KEY_S,	"S",    k_overlay,	k_bad,		k_bad,		k_bad },
     { KEY_G,	"G",    k_overlay,	k_bad,		k_bad,		k_bad },
     { KEY_O,	"O",    k_screendump,	k_bad,		k_bad,		k_bad },
-    { KEY_P,	"P",    k_bad,		k_bad,		k_print_params,	k_bad },
+    { KEY_P,	"P",    k_bad,		k_dump_lock_stats,k_print_params,k_bad },
     { KEY_T,	"T",    k_print_time,	k_bad,		k_bad,		k_bad },
     { KEY_F,	"F",    k_fft_size,	k_fft_size,	k_fullscreen,	k_bad },
     { KEY_L,	"L",    k_left_barline,	k_bad,		k_refresh,	k_bad },
     { KEY_R,	"R",    k_right_barline,k_bad,		k_redraw,	k_bad },
     { KEY_B,	"B",    k_brightness,	k_brightness,	k_set_window, 	k_bad },
     { KEY_D,	"D",    k_bad,		k_dump_audio_cache,k_set_window,k_bad },
-    { KEY_A,	"A",    k_toggle_axes,	k_toggle_axes,	k_bad,		k_bad },
+    { KEY_A,	"A",    k_toggle_axes,	k_toggle_axes,	k_toggle_hud,	k_bad },
     { KEY_W,	"W",    k_cycle_window,	k_cycle_window,	k_bad,		k_bad },
     { KEY_M,	"M",    k_change_color,	k_bad,		k_bad,		k_bad },
     { KEY_H,	"H",	k_bad,		k_bad,		k_set_window,	k_bad },
     { KEY_N,	"N",    k_bad,		k_bad,		k_set_window,	k_bad },
+    { KEY_V,	"V",    k_channel,	k_channel,	k_bad,		k_bad },
+    { KEY_E,	"E",    k_auto_levels,	k_print_features,k_bad,		k_bad },
+    { KEY_J,	"J",    k_find_similar,	k_find_similar,	k_bad,		k_bad },
     { KEY_0,	"0",	k_no_barlines,	k_bad,		k_bad,		k_bad },
     { KEY_9,	"9",	k_beats_per_bar,k_bad,		k_bad,		k_bad },
     { KEY_1,	"1",	k_beats_per_bar,k_bad,		k_bad,		k_bad },
@@ -633,3 +731,16 @@ do_key(key_t key)
     }
     fprintf(stderr, "Internal error: Impossible key value %d\n", key);
 }
+
+/* Which key has this name in key_fns[]? Used by --script.
+ * Returns KEY_NONE if there isn't one. */
+key_t
+key_by_name(const char *name)
+{
+    int i;
+
+    for (i=1; i < N_KEYS; i++)
+	if (strcasecmp(key_fns[i].name, name) == 0) return key_fns[i].key;
+
+    return KEY_NONE;
+}
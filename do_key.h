@@ -22,6 +22,7 @@
 #include "key.h"
 
 extern void do_key(key_t key);
+extern key_t key_by_name(const char *name);
 
 #define DO_KEY_H
 #endif
@@ -17,6 +17,14 @@
 
 /*
  * dump.c: Screen-dumping and (one day) entire spectrogram-writing routines
+ *
+ * The screen is copied into a buffer on the main thread, which is all the
+ * GUI sees of it, and a thread of its own filters and compresses it into
+ * a non-interlaced RGB PNG file. We write the PNG ourselves with zlib so
+ * that big images can be compressed by several threads at once, each
+ * doing a strip of rows: every strip but the last is ended with a sync
+ * flush, which makes their deflate streams concatenate into one, and the
+ * checksum for the whole is made with adler32_combine().
  */
 
 #include "spettro.h"
@@ -25,10 +33,81 @@
 #include "audio_file.h"		/* for audio_file */
 #include "barlines.h"
 #include "gui.h"
+#include "lock.h"		/* for set_thread_role() */
+#include "scheduler.h"		/* for take_batch_slot() */
 #include "ui.h"
 
 #include <libgen.h>		/* for basename() */
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>		/* for sysconf(), usleep() */
+#include <zlib.h>
+
+#if ECORE_MAIN
+#include <Ecore.h>
+#elif SDL_MAIN
+#include <SDL.h>
+#include <SDL_thread.h>
+#endif
+
+int png_compression = 3;		/* --png-compression */
+int png_filter = FILTER_SUB;	/* --png-filter */
+
+static char *filter_names[] = { "none", "sub", "up", "avg", "paeth" };
+
+/* Images bigger than this many bytes of filtered data are compressed in
+ * several strips, up to one per CPU */
+#define STRIP_BYTES (1024 * 1024)
+
+struct png_job;
+
+/* A strip of rows of a PNG file being compressed */
+typedef struct {
+    struct png_job *job;
+    int from_y, to_y;		/* Rows from_y to to_y-1 */
+    bool last;			/* Is this the last strip? */
+    unsigned char *out;		/* The raw deflate data */
+    size_t out_len;
+    unsigned long adler;	/* Checksum of the uncompressed data */
+    size_t in_len;		/* and its length */
+    volatile bool done;
+#if ECORE_MAIN
+    Ecore_Thread *thread;
+#elif SDL_MAIN
+    SDL_Thread *thread;
+#endif
+} strip_t;
+
+/* A PNG file being written */
+typedef struct png_job {
+    char *filename;
+    unsigned char *pixels;	/* From gui_snapshot() */
+    int width, height;
+    strip_t *strips;
+    int nstrips;
+    volatile bool done;
+#if ECORE_MAIN
+    Ecore_Thread *thread;
+#elif SDL_MAIN
+    SDL_Thread *thread;
+#endif
+    struct png_job *next;
+} png_job_t;
+
+static png_job_t *png_jobs = NULL;	/* The ones that are being written */
+/* Set at exit, when the main loop can no longer finish the calculations
+ * that hold the batch slots, so the strips don't wait for one */
+static volatile bool finishing = FALSE;
+
+static void write_png(png_job_t *job);
+static void deflate_strip(strip_t *s);
+#if ECORE_MAIN
+static void ecore_write_png(void *data, Ecore_Thread *thread);
+static void ecore_deflate_strip(void *data, Ecore_Thread *thread);
+#elif SDL_MAIN
+static int sdl_write_png(void *data);
+static int sdl_deflate_strip(void *data);
+#endif
 
 void
 dump_screenshot()
@@ -72,5 +151,380 @@ dump_screenshot()
     }
 
 #undef add
-    gui_output_png_file(s);
+    output_png_file(s);
+}
+
+/* Set png_filter from the name of a filter. Returns FALSE if it's unknown. */
+bool
+set_png_filter(const char *name)
+{
+    int i;
+
+    for (i = 0; i < sizeof(filter_names) / sizeof(filter_names[0]); i++) {
+	if (!strcmp(name, filter_names[i])) {
+	    png_filter = i;
+	    return TRUE;
+	}
+    }
+    return FALSE;
+}
+
+/* Collect any writers that have finished. If "wait", wait for them all. */
+static void
+reap_png_jobs(bool wait)
+{
+    png_job_t **jp = &png_jobs;
+
+    while (*jp != NULL) {
+	png_job_t *job = *jp;
+
+	if (wait) while (!job->done) usleep(10000);
+	if (!job->done) {
+	    jp = &job->next;
+	    continue;
+	}
+#if SDL_MAIN
+	if (job->thread != NULL) SDL_WaitThread(job->thread, NULL);
+#endif
+	*jp = job->next;
+	free(job->filename);
+	free(job);
+    }
+}
+
+/*
+ * Write the current screen contents to a PNG file in the background.
+ * Called from the main thread, which is the only one that may start
+ * threads under Ecore, so the strips' threads are started here too.
+ */
+void
+output_png_file(const char *filename)
+{
+    png_job_t *job = Malloc(sizeof(*job));
+    size_t total;
+    int i;
+
+    reap_png_jobs(FALSE);
+
+    job->filename = strdup(filename);
+    job->width = disp_width;
+    job->height = disp_height;
+    job->pixels = gui_snapshot(FALSE);
+    job->done = FALSE;
+
+    /* Split it into strips, one per STRIP_BYTES up to one per CPU */
+    total = (1 + (size_t) job->width * 3) * job->height;
+    job->nstrips = total / STRIP_BYTES + 1;
+    if (job->nstrips > sysconf(_SC_NPROCESSORS_ONLN))
+	job->nstrips = sysconf(_SC_NPROCESSORS_ONLN);
+    if (job->nstrips > job->height) job->nstrips = job->height;
+    if (job->nstrips < 1) job->nstrips = 1;
+
+    job->strips = Calloc(job->nstrips, sizeof(*job->strips));
+    for (i = 0; i < job->nstrips; i++) {
+	strip_t *s = &job->strips[i];
+
+	s->job = job;
+	s->from_y = (long) job->height * i / job->nstrips;
+	s->to_y = (long) job->height * (i + 1) / job->nstrips;
+	s->last = (i == job->nstrips - 1);
+    }
+
+    /* The writer does the first strip itself and the others in threads */
+    for (i = 1; i < job->nstrips; i++) {
+	strip_t *s = &job->strips[i];
+#if ECORE_MAIN
+	s->thread = ecore_thread_run(ecore_deflate_strip, NULL, NULL, s);
+#elif SDL_MAIN
+	s->thread = SDL_CreateThread(sdl_deflate_strip,
+# if SDL2
+				     "deflate",
+# endif
+				     s);
+#endif
+	if (s->thread == NULL) deflate_strip(s);
+    }
+
+#if ECORE_MAIN
+    job->thread = ecore_thread_run(ecore_write_png, NULL, NULL, job);
+#elif SDL_MAIN
+    job->thread = SDL_CreateThread(sdl_write_png,
+# if SDL2
+				   "png",
+# endif
+				   job);
+#endif
+    /* If we can't start a thread, do it here */
+    if (job->thread == NULL) write_png(job);
+
+    job->next = png_jobs;
+    png_jobs = job;
+}
+
+/* Wait for any PNG files that are still being written. Called at exit. */
+void
+finish_png_files()
+{
+    finishing = TRUE;
+    reap_png_jobs(TRUE);
+}
+
+#if ECORE_MAIN
+static void
+ecore_write_png(void *data, Ecore_Thread *thread)
+{
+    set_thread_role(ROLE_CALC);
+    write_png((png_job_t *) data);
+}
+
+static void
+ecore_deflate_strip(void *data, Ecore_Thread *thread)
+{
+    set_thread_role(ROLE_CALC);
+    deflate_strip((strip_t *) data);
+}
+#elif SDL_MAIN
+static int
+sdl_write_png(void *data)
+{
+    set_thread_role(ROLE_CALC);
+    write_png((png_job_t *) data);
+    return 0;
+}
+
+static int
+sdl_deflate_strip(void *data)
+{
+    set_thread_role(ROLE_CALC);
+    deflate_strip((strip_t *) data);
+    return 0;
+}
+#endif
+
+/* Convert row y of the snapshot, which is blue, green, red, unused,
+ * into red, green, blue */
+static void
+get_rgb_row(png_job_t *job, int y, unsigned char *rgb)
+{
+    unsigned char *p = job->pixels + (size_t) y * job->width * 4;
+    int x;
+
+    for (x = 0; x < job->width; x++, p += 4, rgb += 3) {
+	rgb[0] = p[2];
+	rgb[1] = p[1];
+	rgb[2] = p[0];
+    }
+}
+
+static unsigned char
+paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+/* Apply png_filter to a row of RGB, given the row above (all zeroes for
+ * the first row), putting the filter type and the result in "out". */
+static void
+filter_row(unsigned char *row, unsigned char *above, int len,
+	   unsigned char *out)
+{
+    int i;
+
+    *out++ = png_filter;
+    for (i = 0; i < len; i++) {
+	int left = i >= 3 ? row[i - 3] : 0;
+	int up_left = i >= 3 ? above[i - 3] : 0;
+
+	switch (png_filter) {
+	case FILTER_NONE:  out[i] = row[i];				break;
+	case FILTER_SUB:   out[i] = row[i] - left;			break;
+	case FILTER_UP:    out[i] = row[i] - above[i];		break;
+	case FILTER_AVG:   out[i] = row[i] - (left + above[i]) / 2;	break;
+	case FILTER_PAETH: out[i] = row[i] - paeth(left, above[i], up_left);
+									break;
+	}
+    }
+}
+
+/* Filter and compress a strip of the image */
+static void
+deflate_strip(strip_t *s)
+{
+    png_job_t *job = s->job;
+    int row_len = job->width * 3;
+    unsigned char *above = Calloc(row_len, 1);
+    unsigned char *row = Malloc(row_len);
+    unsigned char *in, *ip;
+    size_t out_size;
+    z_stream z;
+    int y;
+    /* Take a batch slot unless we've been called in the main thread */
+    bool slot = get_thread_role() != ROLE_MAIN && take_batch_slot(&finishing);
+
+    s->in_len = (size_t) (s->to_y - s->from_y) * (1 + row_len);
+    in = Malloc(s->in_len);
+    if (s->from_y > 0) get_rgb_row(job, s->from_y - 1, above);
+    for (y = s->from_y, ip = in; y < s->to_y; y++, ip += 1 + row_len) {
+	unsigned char *tmp;
+
+	get_rgb_row(job, y, row);
+	filter_row(row, above, row_len, ip);
+	tmp = above; above = row; row = tmp;
+    }
+    free(above);
+    free(row);
+
+    s->adler = adler32(adler32(0L, Z_NULL, 0), in, s->in_len);
+
+    memset(&z, 0, sizeof(z));
+    /* Raw deflate data: the zlib header and checksum are added later */
+    if (deflateInit2(&z, png_compression, Z_DEFLATED, -15, 8,
+		     Z_DEFAULT_STRATEGY) != Z_OK) {
+	fprintf(stderr, "Cannot initialize zlib\n");
+	s->out = NULL;
+	free(in);
+	if (slot) give_batch_slot();
+	s->done = TRUE;
+	return;
+    }
+    /* Room for the data and the sync flush's empty block */
+    out_size = deflateBound(&z, s->in_len) + 16;
+    s->out = Malloc(out_size);
+    z.next_in = in;
+    z.avail_in = s->in_len;
+    z.next_out = s->out;
+    z.avail_out = out_size;
+    if (deflate(&z, s->last ? Z_FINISH : Z_SYNC_FLUSH) ==
+	    (s->last ? Z_STREAM_END : Z_OK) && z.avail_in == 0) {
+	s->out_len = out_size - z.avail_out;
+    } else {
+	fprintf(stderr, "Cannot compress the PNG data\n");
+	free(s->out);
+	s->out = NULL;
+    }
+    deflateEnd(&z);
+    free(in);
+
+    if (slot) give_batch_slot();
+    s->done = TRUE;
+}
+
+static void
+put_u32(unsigned char *p, unsigned long n)
+{
+    p[0] = n >> 24; p[1] = n >> 16; p[2] = n >> 8; p[3] = n;
+}
+
+/* Write a PNG chunk whose data is in two parts, either of which may be empty */
+static bool
+write_chunk(FILE *file, const char *type,
+	    const unsigned char *data1, size_t len1,
+	    const unsigned char *data2, size_t len2)
+{
+    unsigned char buf[4];
+    unsigned long crc;
+
+    crc = crc32(0L, (const unsigned char *) type, 4);
+    if (len1 > 0) crc = crc32(crc, data1, len1);
+    if (len2 > 0) crc = crc32(crc, data2, len2);
+
+    put_u32(buf, len1 + len2);
+    if (fwrite(buf, 4, 1, file) != 1 ||
+	fwrite(type, 4, 1, file) != 1 ||
+	(len1 > 0 && fwrite(data1, len1, 1, file) != 1) ||
+	(len2 > 0 && fwrite(data2, len2, 1, file) != 1))
+	return FALSE;
+    put_u32(buf, crc);
+    return fwrite(buf, 4, 1, file) == 1;
+}
+
+/* The body of a PNG-writing thread */
+static void
+write_png(png_job_t *job)
+{
+    static const unsigned char signature[8] = {
+	0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+    };
+    unsigned char ihdr[13];
+    unsigned char zlib_header[2];
+    unsigned char adler_buf[4];
+    unsigned long adler;
+    int nstrips = job->nstrips;
+    strip_t *strips = job->strips;
+    FILE *file;
+    bool ok;
+    int i;
+
+    deflate_strip(&strips[0]);
+    for (i = 1; i < nstrips; i++) {
+#if ECORE_MAIN
+	while (!strips[i].done) usleep(1000);
+#elif SDL_MAIN
+	if (strips[i].thread != NULL) SDL_WaitThread(strips[i].thread, NULL);
+#endif
+    }
+
+    ok = TRUE;
+    adler = strips[0].adler;
+    for (i = 0; i < nstrips; i++) {
+	if (strips[i].out == NULL) ok = FALSE;
+	if (i > 0) adler = adler32_combine(adler, strips[i].adler,
+					   strips[i].in_len);
+    }
+    Tfree(MEM_FRAMEBUFFER, job->pixels, (size_t) job->width * job->height * 4);
+    job->pixels = NULL;
+
+    if (!ok) {
+	/* deflate_strip() has said why */
+    } else if ((file = fopen(job->filename, "wb")) == NULL) {
+	fprintf(stderr, "Can't open \"%s\": %s\n",
+		job->filename, strerror(errno));
+	ok = FALSE;
+    } else {
+	put_u32(ihdr, job->width);
+	put_u32(ihdr + 4, job->height);
+	ihdr[8] = 8;		/* Bits per sample */
+	ihdr[9] = 2;		/* Truecolor */
+	ihdr[10] = 0;		/* Deflate */
+	ihdr[11] = 0;		/* Adaptive filtering */
+	ihdr[12] = 0;		/* Not interlaced */
+
+	/* The zlib header: deflate with a 32K window and the level,
+	 * rounded up to a multiple of 31 */
+	zlib_header[0] = 0x78;
+	zlib_header[1] = (png_compression < 2 ? 0 :
+			  png_compression < 6 ? 1 :
+			  png_compression == 6 ? 2 : 3) << 6;
+	zlib_header[1] += 31 - (zlib_header[0] * 256 + zlib_header[1]) % 31;
+	put_u32(adler_buf, adler);
+
+	ok = fwrite(signature, sizeof(signature), 1, file) == 1 &&
+	     write_chunk(file, "IHDR", ihdr, sizeof(ihdr), NULL, 0);
+	for (i = 0; ok && i < nstrips; i++) {
+	    if (i == 0)
+		ok = write_chunk(file, "IDAT", zlib_header, 2,
+				 strips[i].out, strips[i].out_len);
+	    else
+		ok = write_chunk(file, "IDAT", strips[i].out, strips[i].out_len,
+				 NULL, 0);
+	}
+	ok = ok && write_chunk(file, "IDAT", adler_buf, 4, NULL, 0) &&
+		   write_chunk(file, "IEND", NULL, 0, NULL, 0);
+	if (fclose(file) != 0) ok = FALSE;
+	if (!ok) fprintf(stderr, "Can't write \"%s\": %s\n",
+			 job->filename, strerror(errno));
+    }
+
+    for (i = 0; i < nstrips; i++) free(strips[i].out);
+    free(strips);
+    job->strips = NULL;
+
+    if (ok) printf("Dumped the window to %s\n", job->filename);
+
+    job->done = TRUE;
 }
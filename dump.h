@@ -19,4 +19,20 @@
  * dump.h - header for interface to dump.c
  */
 
+#ifndef DUMP_H
+
+/* The PNG filter types, for png_filter */
+enum png_filter {
+    FILTER_NONE, FILTER_SUB, FILTER_UP, FILTER_AVG, FILTER_PAETH
+};
+
+extern int png_compression;	/* --png-compression: zlib level 0-9 */
+extern int png_filter;		/* --png-filter: one of enum png_filter */
+
 extern void dump_screenshot(void);
+extern void output_png_file(const char *filename);
+extern void finish_png_files(void);
+extern bool set_png_filter(const char *name);
+
+#define DUMP_H
+#endif
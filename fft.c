@@ -0,0 +1,542 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * fft.c: The FFT backends, and calibration to choose between them.
+ *
+ * Each backend does a real-to-halfcomplex transform of "nchannels" planes
+ * of n samples, one after the other, with the output in FFTW's format:
+ * r0, r1, r2 ... r(n/2), i(n+1)/2-1 .. i2, i1
+ *
+ * FFT_FFTW uses FFTW, which can do any size and use several threads.
+ * FFT_RADIX2 is our own for power-of-two sizes, which does the real FFT
+ * of n points as a complex FFT of n/2 points with precomputed tables.
+ *
+ * With --fft-calibration file, the first time each FFT size is asked for,
+ * both backends are timed at and near that size and the fastest pair
+ * is used from then on and remembered in the file for next time.
+ * Without it, FFTW is used at the size chosen by convert.c's rule.
+ */
+
+#include "spettro.h"
+#include "fft.h"
+
+#include "convert.h"		/* for is_good_speclen() */
+#include "lock.h"
+
+#include <fftw3.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>		/* for gettimeofday() */
+
+char *fft_calibration_file = NULL;	/* --fft-calibration */
+
+static const char *backend_names[] = { "fftw", "radix2" };
+
+/*
+ * The tables for a power-of-two size, which are shared by all plans
+ * for that size and kept until we exit.
+ */
+typedef struct radix2_tables {
+    int n;			/* The real transform size */
+    int *bitrev;		/* Bit-reversed index for each of n/2 points */
+    float *tw_re, *tw_im;	/* The twiddles for each stage of the complex
+				 * FFT, one stage's after the other */
+    float *post_re, *post_im;	/* exp(-2*pi*i*k/n) for k = 0..n/4 */
+    struct radix2_tables *next;
+} radix2_tables_t;
+
+static radix2_tables_t *radix2_tables = NULL;
+
+struct fft_plan {
+    fft_backend_t backend;
+    int n, nchannels;
+    float *in, *out;
+    fftwf_plan fftw;
+    radix2_tables_t *tables;
+    float *re, *im;		/* Workspace for the complex FFT */
+};
+
+/* Calibration results: the speclen and backend to use for an ideal speclen.
+ * Only one thread calibrates at a time, from startup.c or the F key,
+ * and new entries are complete before n_calibrated says they're there. */
+#define MAX_CALIBRATIONS 64
+typedef struct {
+    int ideal, speclen;
+    fft_backend_t backend;
+} calibration_t;
+
+static calibration_t calibrated[MAX_CALIBRATIONS];
+static volatile int n_calibrated = 0;
+static bool calibration_loaded = FALSE;
+
+const char *
+fft_backend_name(fft_backend_t backend)
+{
+    return backend_names[backend];
+}
+
+static bool
+is_power_of_2(int n)
+{
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+/* Can this backend do a transform of n points? */
+bool
+fft_backend_can(fft_backend_t backend, int n)
+{
+    switch (backend) {
+    case FFT_FFTW:	return TRUE;
+    case FFT_RADIX2:	return is_power_of_2(n) && n >= 4;
+    default:		return FALSE;
+    }
+}
+
+/* Make, or find, the tables for a power-of-two transform size.
+ * Called with the FFTW lock held, which serializes all planning. */
+static radix2_tables_t *
+get_radix2_tables(int n)
+{
+    radix2_tables_t *t;
+    int m = n / 2;		/* Points in the complex FFT */
+    int bits, i, half, k;
+    float *re, *im;
+
+    for (t = radix2_tables; t != NULL; t = t->next)
+	if (t->n == n) return t;
+
+    t = Malloc(sizeof(*t));
+    t->n = n;
+
+    for (bits = 0; (1 << bits) < m; bits++)
+	;
+    t->bitrev = Malloc(m * sizeof(*t->bitrev));
+    for (i = 0; i < m; i++) {
+	int r = 0, b;
+	for (b = 0; b < bits; b++)
+	    if (i & (1 << b)) r |= 1 << (bits - 1 - b);
+	t->bitrev[i] = r;
+    }
+
+    /* Stages of half-size 1, 2, 4 ... m/2 need 1 + 2 + ... + m/2 = m - 1 */
+    t->tw_re = re = Malloc((m > 1 ? m - 1 : 1) * sizeof(float));
+    t->tw_im = im = Malloc((m > 1 ? m - 1 : 1) * sizeof(float));
+    for (half = 1; half < m; half *= 2) {
+	for (k = 0; k < half; k++) {
+	    *re++ = cos(M_PI * k / half);
+	    *im++ = -sin(M_PI * k / half);
+	}
+    }
+
+    t->post_re = Malloc((n / 4 + 1) * sizeof(float));
+    t->post_im = Malloc((n / 4 + 1) * sizeof(float));
+    for (k = 0; k <= n / 4; k++) {
+	t->post_re[k] = cos(2 * M_PI * k / n);
+	t->post_im[k] = -sin(2 * M_PI * k / n);
+    }
+
+    t->next = radix2_tables;
+    radix2_tables = t;
+    return t;
+}
+
+/* Free the radix-2 tables. Only called at exit. */
+void
+free_fft_tables()
+{
+    radix2_tables_t *t, *next;
+
+    for (t = radix2_tables; t != NULL; t = next) {
+	next = t->next;
+	free(t->bitrev);
+	free(t->tw_re); free(t->tw_im);
+	free(t->post_re); free(t->post_im);
+	free(t);
+    }
+    radix2_tables = NULL;
+}
+
+/*
+ * Plan a transform of "nchannels" planes of n points from "in" to "out".
+ * "nthreads" is how many threads FFTW may use; our own only uses one.
+ * Returns NULL on failure.
+ */
+fft_plan_t *
+fft_plan(fft_backend_t backend, int n, int nchannels,
+	 float *in, float *out, int nthreads)
+{
+    static bool threads_ok = FALSE;	/* Has fftwf_init_threads() worked? */
+    static bool threads_tried = FALSE;	/* Have we called it? */
+    fft_plan_t *plan;
+
+    if (!fft_backend_can(backend, n)) return NULL;
+
+    plan = Calloc(1, sizeof(*plan));
+    plan->backend = backend;
+    plan->n = n;
+    plan->nchannels = nchannels;
+    plan->in = in;
+    plan->out = out;
+
+    lock_fftw3();
+    switch (backend) {
+    case FFT_FFTW:
+	if (nthreads > 1 && !threads_tried) {
+	    threads_ok = fftwf_init_threads() != 0;
+	    threads_tried = TRUE;
+	    if (!threads_ok)
+		fprintf(stderr, "FFTW can't use threads, so each FFT will use one.\n");
+	}
+	/* This is global to FFTW, so always set it before planning */
+	if (threads_ok) fftwf_plan_with_nthreads(nthreads > 1 ? nthreads : 1);
+
+	if (nchannels == 1) {
+	    plan->fftw = fftwf_plan_r2r_1d(n, in, out,
+				FFTW_R2HC, FFTW_ESTIMATE /*| FFTW_PRESERVE_INPUT*/);
+	} else {
+	    /* Transform all the channels in one go */
+	    fftwf_r2r_kind kind = FFTW_R2HC;
+
+	    plan->fftw = fftwf_plan_many_r2r(1, &n, nchannels,
+				in, NULL, 1, n,
+				out, NULL, 1, n,
+				&kind, FFTW_ESTIMATE);
+	}
+	break;
+
+    case FFT_RADIX2:
+	plan->tables = get_radix2_tables(n);
+	plan->re = Malloc((n / 2) * sizeof(float));
+	plan->im = Malloc((n / 2) * sizeof(float));
+	break;
+
+    default:
+	break;
+    }
+    unlock_fftw3();
+
+    if (backend == FFT_FFTW && plan->fftw == NULL) {
+	free(plan);
+	return NULL;
+    }
+
+    return plan;
+}
+
+void
+fft_destroy(fft_plan_t *plan)
+{
+    if (plan == NULL) return;
+
+    if (plan->fftw != NULL) {
+	lock_fftw3();
+	fftwf_destroy_plan(plan->fftw);
+	unlock_fftw3();
+    }
+    free(plan->re);
+    free(plan->im);
+    free(plan);
+}
+
+/* One channel's real FFT of n points by our own radix-2 code */
+static void
+radix2_execute(fft_plan_t *plan, float *in, float *out)
+{
+    radix2_tables_t *t = plan->tables;
+    int n = plan->n, m = n / 2;
+    float *re = plan->re, *im = plan->im;
+    float *tw_re = t->tw_re, *tw_im = t->tw_im;
+    int half, i, j, k;
+
+    /* Pack the even samples into the real part and the odd ones into
+     * the imaginary part, in bit-reversed order */
+    for (i = 0; i < m; i++) {
+	re[t->bitrev[i]] = in[2 * i];
+	im[t->bitrev[i]] = in[2 * i + 1];
+    }
+
+    /* The complex FFT of m points, with each stage's twiddles contiguous
+     * so that the inner loop can be vectorized */
+    for (half = 1; half < m; half *= 2) {
+	for (i = 0; i < m; i += 2 * half) {
+	    float *are = re + i, *aim = im + i;
+	    float *bre = are + half, *bim = aim + half;
+
+	    for (j = 0; j < half; j++) {
+		float xr = bre[j] * tw_re[j] - bim[j] * tw_im[j];
+		float xi = bre[j] * tw_im[j] + bim[j] * tw_re[j];
+
+		bre[j] = are[j] - xr;
+		bim[j] = aim[j] - xi;
+		are[j] += xr;
+		aim[j] += xi;
+	    }
+	}
+	tw_re += half;
+	tw_im += half;
+    }
+
+    /*
+     * Separate the spectra of the even and odd samples and combine them:
+     * X[k] = (Z[k] + conj(Z[m-k])) / 2
+     *	     - i * w^k * (Z[k] - conj(Z[m-k])) / 2,  where w = exp(-2*pi*i/n)
+     * and, as the input is real, X[m-k] is the conjugate of the same thing
+     * with the other twiddle, so we do k and m-k together.
+     */
+    out[0] = re[0] + im[0];
+    out[m] = re[0] - im[0];
+    for (k = 1; k <= m / 2; k++) {
+	float zr = re[k], zi = im[k];			/* Z[k] */
+	float cr = re[m - k], ci = -im[m - k];		/* conj(Z[m-k]) */
+	float er = 0.5 * (zr + cr), ei = 0.5 * (zi + ci);   /* Even */
+	float or = 0.5 * (zi - ci), oi = -0.5 * (zr - cr);  /* Odd, / i */
+	float wr = t->post_re[k], wi = t->post_im[k];
+	float tr = wr * or - wi * oi, ti = wr * oi + wi * or;
+
+	out[k] = er + tr;			/* Re X[k] */
+	if (k < m - k) {
+	    out[n - k] = ei + ti;		/* Im X[k] */
+	    out[m - k] = er - tr;		/* Re X[m-k] */
+	    out[n - (m - k)] = -(ei - ti);	/* Im X[m-k] */
+	} else {
+	    out[n - k] = ei + ti;
+	}
+    }
+}
+
+void
+fft_execute(fft_plan_t *plan)
+{
+    int c;
+
+    switch (plan->backend) {
+    case FFT_FFTW:
+	fftwf_execute(plan->fftw);
+	break;
+    case FFT_RADIX2:
+	for (c = 0; c < plan->nchannels; c++)
+	    radix2_execute(plan, plan->in + c * plan->n,
+			   plan->out + c * plan->n);
+	break;
+    default:
+	break;
+    }
+}
+
+/*
+ * Calibration
+ */
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* How long does one transform of n points take with this backend? */
+static double
+time_fft(fft_backend_t backend, int n)
+{
+    float *in = fftwf_alloc_real(n);
+    float *out = fftwf_alloc_real(n);
+    fft_plan_t *plan;
+    double start, best = HUGE_VAL;
+    int i, runs;
+
+    if (in == NULL || out == NULL ||
+	(plan = fft_plan(backend, n, 1, in, out, 1)) == NULL) {
+	fftwf_free(in);
+	fftwf_free(out);
+	return HUGE_VAL;
+    }
+
+    for (i = 0; i < n; i++) in[i] = (float) rand() / RAND_MAX - 0.5;
+
+    /* Warm up, then take the best of several runs for at least 20ms */
+    fft_execute(plan);
+    start = now();
+    for (runs = 0; runs < 5 || now() - start < 0.02; runs++) {
+	double before = now(), secs;
+
+	fft_execute(plan);
+	secs = now() - before;
+	if (secs < best) best = secs;
+    }
+
+    fft_destroy(plan);
+    fftwf_free(in);
+    fftwf_free(out);
+    return best;
+}
+
+/* Read the calibrations from the file, if it exists */
+static void
+load_calibration(void)
+{
+    FILE *file;
+    char line[80];
+
+    calibration_loaded = TRUE;
+    if ((file = fopen(fft_calibration_file, "r")) == NULL) return;
+
+    while (fgets(line, sizeof(line), file) != NULL &&
+	   n_calibrated < MAX_CALIBRATIONS) {
+	calibration_t *c = &calibrated[n_calibrated];
+	char name[16];
+
+	if (line[0] == '#') continue;
+	if (sscanf(line, "%d %15s %d", &c->ideal, name, &c->speclen) != 3)
+	    continue;
+	if (!strcmp(name, "fftw")) c->backend = FFT_FFTW;
+	else if (!strcmp(name, "radix2")) c->backend = FFT_RADIX2;
+	else continue;
+	if (!fft_backend_can(c->backend, 2 * c->speclen)) continue;
+	n_calibrated++;
+    }
+    fclose(file);
+}
+
+static void
+save_calibration(void)
+{
+    FILE *file;
+    int i;
+
+    if ((file = fopen(fft_calibration_file, "w")) == NULL) {
+	fprintf(stderr, "Can't write \"%s\": %s\n",
+		fft_calibration_file, strerror(errno));
+	return;
+    }
+    fprintf(file, "# spettro FFT calibration: ideal speclen, backend, speclen\n");
+    for (i = 0; i < n_calibrated; i++)
+	fprintf(file, "%d %s %d\n", calibrated[i].ideal,
+		backend_names[calibrated[i].backend], calibrated[i].speclen);
+    if (fclose(file) != 0)
+	fprintf(stderr, "Can't write \"%s\": %s\n",
+		fft_calibration_file, strerror(errno));
+}
+
+/* Sizes within this ratio of the ideal one are good enough */
+#define CALIBRATION_SLACK 1.06		/* About a semitone */
+/* and we try this many of FFTW's favourite sizes */
+#define CALIBRATION_SIZES 4
+/* Smaller ones are quick whatever we do */
+#define MIN_CALIBRATED_SPECLEN 256
+
+/*
+ * Choose the fastest backend and size for the FFTs for this fft_freq,
+ * if it hasn't been done already. Called before columns of a new
+ * FFT size are scheduled, from startup.c and the F key.
+ */
+void
+calibrate_fft(double fft_freq, double sample_rate)
+{
+    int ideal = (sample_rate / fft_freq + 1) / 2;   /* As in convert.c */
+    int candidates[CALIBRATION_SIZES + 1];
+    int ncandidates = 0;
+    int d, i, p;
+    calibration_t *best;
+    double best_time = HUGE_VAL;
+
+    if (fft_calibration_file == NULL || ideal < MIN_CALIBRATED_SPECLEN)
+	return;
+
+    if (!calibration_loaded) load_calibration();
+
+    if (calibrated_speclen(ideal, NULL) > 0 || n_calibrated >= MAX_CALIBRATIONS)
+	return;
+
+    /* The nearest few of the sizes that FFTW is good at */
+    for (d = 0; ncandidates < CALIBRATION_SIZES &&
+		ideal + d <= ideal * CALIBRATION_SLACK; d++) {
+	if (is_good_speclen(ideal + d))
+	    candidates[ncandidates++] = ideal + d;
+	if (d > 0 && ncandidates < CALIBRATION_SIZES &&
+	    is_good_speclen(ideal - d))
+	    candidates[ncandidates++] = ideal - d;
+    }
+    /* and the nearest power of two, if it's near enough */
+    for (p = 1; p * 2 <= ideal; p *= 2)
+	;
+    if (ideal - p > p * 2 - ideal) p *= 2;
+    if (p <= ideal * CALIBRATION_SLACK && p * CALIBRATION_SLACK >= ideal) {
+	for (i = 0; i < ncandidates && candidates[i] != p; i++)
+	    ;
+	if (i == ncandidates) candidates[ncandidates++] = p;
+    }
+
+    best = &calibrated[n_calibrated];
+    best->ideal = ideal;
+    best->speclen = candidates[0];
+    best->backend = FFT_FFTW;
+    for (i = 0; i < ncandidates; i++) {
+	fft_backend_t b;
+
+	for (b = 0; b < NUMBER_OF_FFT_BACKENDS; b++) {
+	    double t;
+
+	    if (!fft_backend_can(b, 2 * candidates[i])) continue;
+	    t = time_fft(b, 2 * candidates[i]);
+	    if (t < best_time) {
+		best_time = t;
+		best->speclen = candidates[i];
+		best->backend = b;
+	    }
+	}
+    }
+
+    /* Publish it */
+    __sync_synchronize();
+    n_calibrated++;
+
+    save_calibration();
+}
+
+/*
+ * If calibration has chosen a speclen for this ideal one, return it,
+ * and the backend for it in *backendp if that isn't NULL.
+ * Otherwise return 0.
+ */
+int
+calibrated_speclen(int ideal, fft_backend_t *backendp)
+{
+    int i, n = n_calibrated;
+
+    for (i = 0; i < n; i++) {
+	if (calibrated[i].ideal == ideal) {
+	    if (backendp) *backendp = calibrated[i].backend;
+	    return calibrated[i].speclen;
+	}
+    }
+    return 0;
+}
+
+/* Which backend should do transforms for this speclen? */
+fft_backend_t
+fft_backend_for(int speclen)
+{
+    int i, n = n_calibrated;
+
+    for (i = 0; i < n; i++)
+	if (calibrated[i].speclen == speclen)
+	    return calibrated[i].backend;
+    return FFT_FFTW;
+}
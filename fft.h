@@ -0,0 +1,48 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * fft.h: Declarations for fft.c
+ */
+
+#ifndef FFT_H
+
+typedef enum {
+    FFT_FFTW = 0,
+    FFT_RADIX2,
+    NUMBER_OF_FFT_BACKENDS
+} fft_backend_t;
+
+typedef struct fft_plan fft_plan_t;
+
+extern char *fft_calibration_file;	/* --fft-calibration */
+
+extern const char *fft_backend_name(fft_backend_t backend);
+extern bool fft_backend_can(fft_backend_t backend, int n);
+
+extern fft_plan_t *fft_plan(fft_backend_t backend, int n, int nchannels,
+			    float *in, float *out, int nthreads);
+extern void fft_execute(fft_plan_t *plan);
+extern void fft_destroy(fft_plan_t *plan);
+extern void free_fft_tables(void);
+
+extern void calibrate_fft(double fft_freq, double sample_rate);
+extern int calibrated_speclen(int ideal, fft_backend_t *backendp);
+extern fft_backend_t fft_backend_for(int speclen);
+
+#define FFT_H
+#endif
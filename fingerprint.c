@@ -0,0 +1,571 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * fingerprint.c: An index of spectral peak pairs, to find where else in the
+ * piece the passage between the bar lines is repeated.
+ *
+ * A thread works through the whole audio file doing a small FFT every
+ * tenth of a second, picks the strongest few peaks from each column and
+ * pairs each of them with a few of the peaks in the columns that follow.
+ * Each pair's two frequencies, in quarter-tones, and the columns between
+ * them make a hash, and the index maps each hash to the columns where it
+ * happens.
+ *
+ * To find a passage, we look up the hashes that start and end between the
+ * bar lines and, for every hit, vote for its distance from the original.
+ * Distances with enough votes are where the passage recurs, and that only
+ * takes a few milliseconds however long the recording is.
+ *
+ * The index uses its own column rate and FFT size, not the display's, so it
+ * stays valid when they zoom or change the FFT size. With --fp-index, it is
+ * saved to a file when complete and read back from it next time instead of
+ * being rebuilt. The file is in this machine's byte order.
+ */
+
+#include "spettro.h"
+#include "fingerprint.h"
+
+#include "audio.h"	/* for set_playing_time() */
+#include "barlines.h"	/* for UNDEFINED */
+#include "convert.h"
+#include "lock.h"
+#include "scheduler.h"	/* for take_batch_slot() */
+#include "window.h"
+#include "spectrum.h"
+#include "ui.h"
+
+#include <string.h>	/* for memcpy(), memcmp(), strerror() */
+#include <errno.h>
+#include <unistd.h>	/* for usleep() */
+
+#if ECORE_MAIN
+#include <Ecore.h>
+#elif SDL_MAIN
+#include <SDL.h>
+#include <SDL_thread.h>
+#endif
+
+char *fp_index_file = NULL;
+
+#define FP_PPSEC	10.0	/* Index columns per second */
+#define FP_FFT_FREQ	5.0	/* each of 1/5 of a second of audio */
+#define FP_MIN_FREQ	100.0	/* The range of frequencies to look for peaks */
+#define FP_MAX_FREQ	5000.0
+#define FP_PEAKS	3	/* The most peaks we take from each column */
+#define FP_FLOOR	40.0	/* Ignore peaks this many dB below the loudest */
+#define FP_SILENCE	(-70.0)	/* or below this many dB from full scale */
+#define FP_FAN_DT	8	/* Pair peaks with those up to 8 columns later */
+#define FP_FANOUT	5	/* but with no more than 5 of them */
+#define FP_BUCKETS	65536	/* The size of the hash table */
+#define FP_MIN_VOTES	5	/* A match needs at least this many pairs, */
+#define FP_MIN_SHARE	0.1	/* this fraction of the passage's pairs */
+#define FP_MIN_BEST	0.3	/* and this fraction of the best match's votes */
+
+/* A peak pair's hash: q1 << 12 | q2 << 4 | dt, where q1 and q2 are the
+ * peaks' frequencies in quarter-tones above FP_MIN_FREQ and dt is how
+ * many columns after the first the second one is. */
+#define HASH_DT(hash)	((hash) & 0xF)
+
+typedef struct {
+    unsigned int hash;
+    unsigned int col;	/* The column of the first peak of the pair */
+    int next;		/* The next entry in the same bucket, or -1 */
+} fp_entry_t;
+
+/* The index. The builder thread only adds to it and everything is
+ * protected by the fingerprint lock. */
+static fp_entry_t *entries = NULL;
+static int n_entries = 0;
+static int entries_size = 0;	/* How many entries are allocated */
+static int buckets[FP_BUCKETS];
+static int *col_first = NULL;	/* Index of the first entry whose pair ends
+				 * in each column, with one more at the end */
+static int fp_columns = 0;	/* How many columns the piece has */
+static volatile int fp_done = 0; /* How many of them are indexed */
+static double fp_sample_rate;
+static off_t fp_frames;
+static bool fp_started = FALSE;
+
+/* The first thing in the --fp-index file */
+typedef struct {
+    char magic[8];
+    double sample_rate;
+    off_t frames;
+    int columns;
+    int entries;
+} fp_header_t;
+
+#define FP_MAGIC "spettFP1"
+
+static volatile bool quit_fingerprint = FALSE;
+
+#if ECORE_MAIN
+static Ecore_Thread *builder = NULL;
+static void ecore_build_index(void *data, Ecore_Thread *thread);
+#elif SDL_MAIN
+static SDL_Thread *builder = NULL;
+static int sdl_build_index(void *data);
+#endif
+
+static void build_index(audio_file_t *af);
+static bool load_index(void);
+static void save_index(void);
+
+/* Add an entry to the index. Called with the lock held. */
+static void
+add_entry(unsigned int hash, unsigned int col)
+{
+    int bucket = hash % FP_BUCKETS;
+
+    if (n_entries == entries_size) {
+	entries_size = entries_size ? entries_size * 2 : 4096;
+	entries = Realloc(entries, entries_size * sizeof(*entries));
+    }
+    entries[n_entries].hash = hash;
+    entries[n_entries].col = col;
+    entries[n_entries].next = buckets[bucket];
+    buckets[bucket] = n_entries;
+    n_entries++;
+}
+
+static void
+clear_index(void)
+{
+    int i;
+
+    free(entries);
+    entries = NULL;
+    n_entries = entries_size = 0;
+    for (i = 0; i < FP_BUCKETS; i++) buckets[i] = -1;
+    free(col_first);
+    col_first = NULL;
+    fp_done = 0;
+}
+
+/* Start building the index for an audio file, or read it from the file */
+void
+start_fingerprint(audio_file_t *af)
+{
+    if (fp_started) return;
+    if (af->live) {
+	fprintf(stderr, "Finding similar passages needs an audio file, not live input.\n");
+	return;
+    }
+    fp_started = TRUE;
+
+    fp_sample_rate = af->sample_rate;
+    fp_frames = af->frames;
+    fp_columns = llrint(floor(af->frames * FP_PPSEC / af->sample_rate)) + 1;
+
+    lock_fingerprint();
+    clear_index();
+    col_first = Malloc((fp_columns + 1) * sizeof(*col_first));
+    col_first[0] = 0;
+    unlock_fingerprint();
+
+    if (fp_index_file != NULL && load_index()) return;
+
+    quit_fingerprint = FALSE;
+#if ECORE_MAIN
+    builder = ecore_thread_run(ecore_build_index, NULL, NULL, af);
+#elif SDL_MAIN
+    builder = SDL_CreateThread(sdl_build_index,
+# if SDL2
+			       "fingerprint",
+# endif
+			       af);
+#endif
+    if (builder == NULL) {
+	fprintf(stderr, "Cannot start the fingerprinting thread.\n");
+    }
+}
+
+void
+stop_fingerprint(void)
+{
+    quit_fingerprint = TRUE;
+#if ECORE_MAIN
+    if (builder != NULL) {
+	ecore_thread_cancel(builder);
+	while (ecore_thread_active_get() > 0) usleep(100000);
+    }
+#elif SDL_MAIN
+    if (builder != NULL) SDL_WaitThread(builder, NULL);
+#endif
+    builder = NULL;
+
+    lock_fingerprint();
+    clear_index();
+    unlock_fingerprint();
+    fp_started = FALSE;
+}
+
+#if ECORE_MAIN
+static void
+ecore_build_index(void *data, Ecore_Thread *thread)
+{
+    build_index((audio_file_t *) data);
+}
+#elif SDL_MAIN
+static int
+sdl_build_index(void *data)
+{
+    build_index((audio_file_t *) data);
+    return 0;
+}
+#endif
+
+/*
+ * Find the strongest peaks in a magnitude spectrum, returning how many
+ * there are and putting their frequencies, in quarter-tones above
+ * FP_MIN_FREQ, in q[].
+ */
+static int
+find_peaks(float *mag, int speclen, int q[FP_PEAKS])
+{
+    double hz_per_bin = fp_sample_rate / (2 * speclen);
+    int kmin = ceil(FP_MIN_FREQ / hz_per_bin);
+    int kmax = floor(FP_MAX_FREQ / hz_per_bin);
+    float peak[FP_PEAKS];	/* Magnitudes of the loudest so far, */
+    int bin[FP_PEAKS];		/* loudest first */
+    int n = 0;
+    float floor_mag;
+    int i, k;
+
+    if (kmin < 1) kmin = 1;
+    if (kmax > speclen - 1) kmax = speclen - 1;
+
+    for (k = kmin; k <= kmax; k++) {
+	if (mag[k] <= mag[k - 1] || mag[k] < mag[k + 1]) continue;
+
+	/* Insert it in order of loudness */
+	for (i = n; i > 0 && mag[k] > peak[i - 1]; i--) {
+	    if (i < FP_PEAKS) {
+		peak[i] = peak[i - 1];
+		bin[i] = bin[i - 1];
+	    }
+	}
+	if (i < FP_PEAKS) {
+	    peak[i] = mag[k];
+	    bin[i] = k;
+	    if (n < FP_PEAKS) n++;
+	}
+    }
+
+    /* Magnitudes are divided by speclen to put full scale at about 0dB */
+    if (n == 0 || 20.0 * log10(peak[0] / speclen) < FP_SILENCE) return 0;
+    floor_mag = peak[0] * pow(10.0, -FP_FLOOR / 20.0);
+
+    for (i = 0; i < n && peak[i] >= floor_mag; i++)
+	q[i] = lrint(24.0 * log2(bin[i] * hz_per_bin / FP_MIN_FREQ));
+
+    return i;
+}
+
+/* The body of the index-building thread */
+static void
+build_index(audio_file_t *main_af)
+{
+    audio_file_t *af;
+    int speclen = fft_freq_to_speclen(FP_FFT_FREQ, fp_sample_rate);
+    int fftsize = speclen * 2;
+    spectrum *spec;
+    /* The peaks of the last FP_FAN_DT+1 columns, indexed by column modulo
+     * that, and how many pairs each peak has made */
+    int q[FP_FAN_DT + 1][FP_PEAKS];
+    int npeaks[FP_FAN_DT + 1];
+    int fanned[FP_FAN_DT + 1][FP_PEAKS];
+    int col;
+
+    set_thread_role(ROLE_CALC);
+
+    af = dup_audio_file(main_af);
+    if (af == NULL) {
+	fprintf(stderr, "The fingerprinting thread cannot open %s\n",
+		main_af->filename);
+	return;
+    }
+    spec = create_spectrum(speclen, 1, HANN, 1);
+    if (spec == NULL) {
+	close_audio_file(af);
+	return;
+    }
+
+    for (col = 0; col < fp_columns && !quit_fingerprint; col++) {
+	off_t start = llrint(col * fp_sample_rate / FP_PPSEC) - fftsize/2;
+	int this = col % (FP_FAN_DT + 1);
+	int dt, i, j;
+
+	if (!take_batch_slot(&quit_fingerprint)) break;
+	read_audio_file(af, (char *) spec->time_domain, af_float, 1,
+			start, fftsize);
+	calc_magnitude_spectrum(spec);
+	npeaks[this] = find_peaks(spec->mag_spec, speclen, q[this]);
+	give_batch_slot();
+	for (i = 0; i < npeaks[this]; i++) fanned[this][i] = 0;
+
+	/* Pair this column's peaks with those of the columns before it,
+	 * nearest first so that each peak pairs with the next ones */
+	lock_fingerprint();
+	for (dt = 1; dt <= FP_FAN_DT && dt <= col; dt++) {
+	    int anchor = (col - dt) % (FP_FAN_DT + 1);
+
+	    for (i = 0; i < npeaks[anchor]; i++) {
+		for (j = 0; j < npeaks[this] && fanned[anchor][i] < FP_FANOUT;
+		     j++) {
+		    add_entry(q[anchor][i] << 12 | q[this][j] << 4 | dt,
+			      col - dt);
+		    fanned[anchor][i]++;
+		}
+	    }
+	}
+	col_first[col + 1] = n_entries;
+	fp_done = col + 1;
+	unlock_fingerprint();
+    }
+
+    destroy_spectrum(spec);
+    close_audio_file(af);
+
+    if (fp_done == fp_columns && fp_index_file != NULL) save_index();
+}
+
+/*
+ * The --fp-index file
+ */
+
+static bool
+load_index(void)
+{
+    FILE *fp = fopen(fp_index_file, "rb");
+    fp_header_t h;
+    bool ok = FALSE;
+
+    if (fp == NULL) return FALSE;	/* Not made yet */
+
+    lock_fingerprint();
+    if (fread(&h, sizeof(h), 1, fp) != 1 ||
+	memcmp(h.magic, FP_MAGIC, sizeof(h.magic)) != 0 ||
+	h.sample_rate != fp_sample_rate || h.frames != fp_frames ||
+	h.columns != fp_columns || h.entries < 0) {
+	fprintf(stderr, "%s is not the index for this audio; rebuilding it.\n",
+		fp_index_file);
+    } else {
+	int i;
+
+	entries_size = h.entries > 0 ? h.entries : 1;
+	entries = Malloc(entries_size * sizeof(*entries));
+	if (fread(col_first, sizeof(*col_first), fp_columns + 1, fp)
+		== fp_columns + 1 &&
+	    fread(entries, sizeof(*entries), h.entries, fp) == h.entries) {
+	    /* The chains are rebuilt rather than trusted */
+	    n_entries = h.entries;
+	    for (i = 0; i < n_entries; i++) {
+		int bucket = entries[i].hash % FP_BUCKETS;
+		entries[i].next = buckets[bucket];
+		buckets[bucket] = i;
+	    }
+	    fp_done = fp_columns;
+	    ok = TRUE;
+	} else {
+	    fprintf(stderr, "%s is truncated; rebuilding it.\n", fp_index_file);
+	    free(entries);
+	    entries = NULL;
+	    entries_size = 0;
+	}
+    }
+    unlock_fingerprint();
+
+    fclose(fp);
+    return ok;
+}
+
+/* Called by the builder thread when the index is complete */
+static void
+save_index(void)
+{
+    FILE *fp = fopen(fp_index_file, "wb");
+    fp_header_t h;
+
+    if (fp == NULL) {
+	fprintf(stderr, "Cannot save the fingerprint index in %s: %s\n",
+		fp_index_file, strerror(errno));
+	return;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, FP_MAGIC, sizeof(h.magic));
+    h.sample_rate = fp_sample_rate;
+    h.frames = fp_frames;
+    h.columns = fp_columns;
+
+    lock_fingerprint();
+    h.entries = n_entries;
+    if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+	fwrite(col_first, sizeof(*col_first), fp_columns + 1, fp)
+		!= fp_columns + 1 ||
+	fwrite(entries, sizeof(*entries), n_entries, fp) != n_entries) {
+	fprintf(stderr, "Cannot write the fingerprint index to %s: %s\n",
+		fp_index_file, strerror(errno));
+    }
+    unlock_fingerprint();
+
+    if (fclose(fp) != 0) {
+	fprintf(stderr, "Cannot write the fingerprint index to %s: %s\n",
+		fp_index_file, strerror(errno));
+    }
+}
+
+/*
+ * Finding the passage
+ */
+
+static int
+compare_ints(const void *a, const void *b)
+{
+    int ia = *(const int *)a, ib = *(const int *)b;
+
+    return ia < ib ? -1 : ia > ib ? 1 : 0;
+}
+
+/*
+ * Look for the passage between the bar lines elsewhere and move to the
+ * next (or previous) place it recurs after (or before) the current time.
+ */
+void
+find_similar(bool backward)
+{
+    double from, to;
+    int qa, qb;		/* The first and last columns of the passage */
+    int *offsets = NULL;
+    int *n_votes;	/* Votes for each offset and the one after it */
+    int n_offsets = 0, offsets_size = 0;
+    int n_pairs = 0;	/* How many pairs the passage has */
+    int min_votes;
+    int now;		/* The current time in index columns */
+    int best = 0;	/* The nearest match's offset, or 0 if none */
+    int best_votes = 0;
+    int t, i;
+
+    if (left_bar_time == UNDEFINED || right_bar_time == UNDEFINED) {
+	fprintf(stderr, "Set the left and right bar lines around the passage to look for.\n");
+	return;
+    }
+    if (!fp_started) start_fingerprint(current_audio_file());
+    if (!fp_started) return;
+
+    from = MIN(left_bar_time, right_bar_time);
+    to = MAX(left_bar_time, right_bar_time);
+    qa = ceil(from * FP_PPSEC);
+    qb = floor(to * FP_PPSEC);
+    if (qb >= fp_columns) qb = fp_columns - 1;
+    if (qb - qa < 2) {
+	fprintf(stderr, "The passage between the bar lines is too short.\n");
+	return;
+    }
+    now = lrint(get_playing_time() * FP_PPSEC);
+
+    lock_fingerprint();
+    if (fp_done <= qb) {
+	unlock_fingerprint();
+	printf("Still indexing: %d%% done\n", fp_done * 100 / fp_columns);
+	return;
+    }
+
+    /* Every pair that starts and ends in the passage votes for each
+     * other place where the same pair happens */
+    for (t = qa + 1; t <= qb; t++) {
+	for (i = col_first[t]; i < col_first[t + 1]; i++) {
+	    unsigned int hash = entries[i].hash;
+	    int anchor = entries[i].col;
+	    int e;
+
+	    if (anchor < qa) continue;
+	    n_pairs++;
+
+	    for (e = buckets[hash % FP_BUCKETS]; e >= 0; e = entries[e].next) {
+		int offset;
+
+		if (entries[e].hash != hash) continue;
+		offset = (int) entries[e].col - anchor;
+		/* Skip the passage itself and places that overlap it */
+		if (abs(offset) <= qb - qa) continue;
+
+		if (n_offsets == offsets_size) {
+		    offsets_size = offsets_size ? offsets_size * 2 : 1024;
+		    offsets = Realloc(offsets, offsets_size * sizeof(*offsets));
+		}
+		offsets[n_offsets++] = offset;
+	    }
+	}
+    }
+    unlock_fingerprint();
+
+    /* Count the votes for each offset, allowing a column either way
+     * because the repeat won't line up exactly with our columns. */
+    qsort(offsets, n_offsets, sizeof(*offsets), compare_ints);
+    n_votes = Malloc((n_offsets + 1) * sizeof(*n_votes));
+    min_votes = 0;
+    for (i = 0; i < n_offsets; i++) {
+	int j;
+
+	for (j = i; j < n_offsets && offsets[j] <= offsets[i] + 1; j++)
+	    ;
+	n_votes[i] = j - i;
+	if (n_votes[i] > min_votes) min_votes = n_votes[i];
+    }
+    min_votes = MAX(MAX(FP_MIN_VOTES, lrint(n_pairs * FP_MIN_SHARE)),
+		    lrint(min_votes * FP_MIN_BEST));
+
+    /* Of the offsets with enough votes, choose the nearest one in the
+     * direction we're going, and of runs of neighbouring ones, the best. */
+    for (i = 0; i < n_offsets; i++) {
+	int o = offsets[i];
+	int votes = n_votes[i];
+	int start;	/* Where this match starts, in index columns */
+
+	if (i > 0 && offsets[i - 1] == o) continue;
+	if (votes < min_votes) continue;
+	/* Skip the match we're at, if any, which is anywhere near now */
+	start = qa + o;
+	if (backward ? start >= now - (qb - qa) / 2
+		     : start <= now + (qb - qa) / 2) continue;
+
+	if (best == 0 ||
+	    /* A neighbour of the best so far with more votes */
+	    (abs(o - best) <= qb - qa && votes > best_votes) ||
+	    /* or a clearly different place nearer to now */
+	    (abs(o - best) > qb - qa && (backward ? o > best : o < best))) {
+	    best = o;
+	    best_votes = votes;
+	}
+    }
+    free(offsets);
+    free(n_votes);
+
+    if (best == 0) {
+	printf("No %s match for the passage between the bar lines\n",
+	       backward ? "earlier" : "later");
+	return;
+    }
+
+    printf("Similar passage at %s (%d votes from %d peak pairs)\n",
+	   seconds_to_string((qa + best) / FP_PPSEC), best_votes, n_pairs);
+    set_playing_time((qa + best) / FP_PPSEC);
+    if (playing == STOPPED) playing = PAUSED;
+}
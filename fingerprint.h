@@ -0,0 +1,33 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * fingerprint.h: Declarations for fingerprint.c
+ */
+
+#ifndef FINGERPRINT_H
+
+#include "audio_file.h"
+
+extern char *fp_index_file;	/* --fp-index: Where to keep the index */
+
+extern void start_fingerprint(audio_file_t *af);
+extern void stop_fingerprint(void);
+extern void find_similar(bool backward);
+
+#define FINGERPRINT_H
+#endif
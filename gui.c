@@ -26,15 +26,14 @@
 #include "axes.h"
 #include "key.h"
 #include "mouse.h"
-#include "paint.h"	/* for do_scroll() */
+#include "paint.h"	/* for do_scroll() and repaint_column() */
 #include "scheduler.h"
 #include "timer.h"
 #include "ui.h"
 
 /* Libraries' header files. See config.h for working combinations of defines */
 
-#include <png.h>
-#include <errno.h>
+#include <string.h>	/* for memcpy() */
 
 #if ECORE_TIMER || EVAS_VIDEO || ECORE_MAIN
 #include <Ecore.h>
@@ -173,7 +172,7 @@ gui_init(char *filename)
     evas_object_image_colorspace_set(image, EVAS_COLORSPACE_ARGB8888);
     evas_object_image_size_set(image, disp_width, disp_height);
     imagestride = evas_object_image_stride_get(image);
-    imagedata = Malloc(imagestride * disp_height);
+    imagedata = Tmalloc(MEM_FRAMEBUFFER, imagestride * disp_height);
 
     /* Clear the image buffer to the background color */
     {	register int i;
@@ -266,6 +265,8 @@ gui_init(char *filename)
 
     screen = SDL_GetWindowSurface(window);
 # endif
+    /* SDL allocates the screen's pixels; count them as ours */
+    mem_account(MEM_FRAMEBUFFER, (long) screen->pitch * screen->h);
 
     background	= RGB_to_color(0x80, 0x80, 0x80);	/* 50% gray */
     green	= RGB_to_color(0x00, 0xFF, 0x00);
@@ -578,10 +579,11 @@ gui_deinit()
     ecore_evas_shutdown();
 #endif
 #if EVAS_VIDEO
-    free(imagedata);
+    Tfree(MEM_FRAMEBUFFER, imagedata, imagestride * disp_height);
 #endif
 
 #if SDL_VIDEO
+    mem_account(MEM_FRAMEBUFFER, -(long) screen->pitch * screen->h);
 # if SDL2
     SDL_DestroyWindow(window);
 # endif
@@ -819,67 +821,70 @@ gui_putpixel(int x, int y, color_t color)
 # endif
 }
 
-/* Dump the current screen contents to a PNG file.
- *
- * Returns TRUE on success, FALSE on failure
- */
-bool
-gui_output_png_file(const char *filename)
+/* Write a column of pixels from from_y up to to_y, colors[0] being the
+ * one at from_y. It's one walk down the frame buffer a row at a time.
+ * Calls to this should be bracketed by gui_lock() and gui_unlock(). */
+void
+gui_put_column(int x, int from_y, int to_y, const color_t *colors)
 {
-    png_bytepp  png_rows = Malloc(disp_height * sizeof(*png_rows));
-    png_structp png      = png_create_write_struct(PNG_LIBPNG_VER_STRING, 0, 0,0);
-    png_infop   png_info = png_create_info_struct(png);
-    FILE *file = fopen(filename, "wb");
+    unsigned char *p;	/* The pixel at to_y, as we're writing downwards */
+    size_t stride;	/* Bytes from one row to the next */
     int y;
 
-    if (file == NULL) {
-      fprintf(stderr, "Can't open \"%s\": %s\n", filename, strerror(errno));
-      return FALSE;
+    if (x < 0 || x >= disp_width) return;
+    if (from_y < 0) {
+	colors -= from_y;
+	from_y = 0;
     }
+    if (to_y >= disp_height) to_y = disp_height - 1;
 
-    if (png == NULL || png_info == NULL) {
-    	fprintf(stderr, "Can't create PNG write structure.\n");
-	return FALSE;
-    }
+#if EVAS_VIDEO
+    stride = imagestride;
+    p = &imagedata[stride * ((disp_height-1) - to_y)];
+#elif SDL_VIDEO
+    stride = screen->pitch;
+    p = (unsigned char *)screen->pixels + stride * ((disp_height-1) - to_y);
+#endif
+    p += x * sizeof(color_t);
 
-    green_line_off = TRUE;
-    repaint_display(TRUE);	/* repainting all reflects a changed logmax */
+    for (y = to_y; y >= from_y; y--, p += stride)
+	*(color_t *)p = colors[y - from_y];
+}
 
-    png_init_io(png, file);
-    png_set_IHDR(png, png_info,
-    		 (png_uint_32)disp_width, (png_uint_32)disp_height,
-		 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_ADAM7,
-      		 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+/* Copy the screen into a buffer of disp_width * disp_height 32-bit pixels,
+ * top row first, each with blue, green, red and an unused byte, for dump.c
+ * and video.c. The green line is left out unless "green_line" is TRUE.
+ */
+unsigned char *
+gui_snapshot(bool green_line)
+{
+    size_t row_bytes = disp_width * 4;
+    unsigned char *pixels = Tmalloc(MEM_FRAMEBUFFER, row_bytes * disp_height);
+    int y;
+
+    /* Paint the spectrogram where the green line is, copy the screen
+     * and put the line back before it's seen */
+    if (!green_line) {
+	green_line_off = TRUE;
+	repaint_column(disp_offset, min_y, max_y, FALSE);
+    }
 
+    gui_lock();
     for (y = 0; y < disp_height; y++) {
-	png_bytep row = (png_bytep)
+	memcpy(pixels + row_bytes * y,
 #if EVAS_VIDEO
-	    (&imagedata[imagestride * y]);
+	       &imagedata[imagestride * y],
 #elif SDL_VIDEO
-	    ((Uint8 *)screen->pixels + (y) * screen->pitch);
-	{
-	    int x;
-	    for (x=0; x < disp_width; x++)
-		((unsigned long *)row)[x] |= 0xFF000000; /* Set alpha to 100% */
-	}
+	       (Uint8 *)screen->pixels + y * screen->pitch,
 #endif
-	png_rows[y] = row;
+	       row_bytes);
     }
+    gui_unlock();
 
-    png_set_rows(png, png_info, png_rows);
-    png_write_png(png, png_info, PNG_TRANSFORM_BGR, NULL);
-    png_destroy_write_struct(&png, &png_info);
-    free(png_rows);
-    fclose(file);
-
-    /* If just outputting a PNG and quitting (-o), no need to restore display */
-    if (!output_file) {
+    if (!green_line) {
 	green_line_off = FALSE;
-	repaint_column(disp_offset, min_y, max_y, TRUE);
-	gui_update_column(disp_offset);
+	repaint_column(disp_offset, min_y, max_y, FALSE);
     }
 
-    printf("Dumped the window to %s\n", filename);
-
-    return TRUE;
+    return pixels;
 }
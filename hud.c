@@ -0,0 +1,292 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * hud.c - Performance figures shown in place of the status line
+ *
+ * Other modules report what they are doing with the hud_*() functions, which
+ * only cost anything when the HUD is showing. The main loop calls
+ * update_hud() every frame but it only recalculates the figures a few
+ * times a second and only repaints the fields whose text has changed.
+ */
+
+#include "spettro.h"
+#include "hud.h"
+
+#include "cache.h"
+#include "gui.h"
+#include "scheduler.h"
+#include "text.h"
+#include "ui.h"
+
+#include <string.h>
+#include <sys/time.h>	/* for gettimeofday() */
+
+bool show_hud = FALSE;
+
+/* How often to recalculate the figures, in seconds */
+#define HUD_INTERVAL 0.25
+
+/* The counters, updated by whichever thread does the work.
+ * Each is only written by one thread, so they need no locking;
+ * at worst we see a count that's one behind. */
+static unsigned long columns = 0;	/* Results delivered (main thread) */
+static unsigned long frames = 0;	/* Scroll frames painted (main) */
+static double frame_time = 0.0;		/* Total time they took (main) */
+static double max_frame_time = 0.0;	/* and the slowest one (main) */
+static unsigned long missed = 0;	/* Scroll frames dropped (timer) */
+static unsigned long underruns = 0;	/* Late audio buffer fills (audio) */
+static unsigned long *busy = NULL;	/* Per calc thread, microseconds */
+static unsigned long *idle = NULL;
+static int nthreads = 0;
+
+/* The same at the last update, to turn them into rates */
+static unsigned long last_columns = 0;
+static unsigned long last_lookups = 0, last_hits = 0;
+static unsigned long *last_busy = NULL, *last_idle = NULL;
+static struct timeval last_update = { 0, 0 };
+
+/*
+ * The HUD is a row of fields, each in a fixed-width slot so that one can be
+ * repainted without disturbing its neighbours. The widths are those of the
+ * widest text we expect; the last field has the rest of the line.
+ */
+typedef enum {
+    HUD_COLUMNS, HUD_QUEUE, HUD_LAG, HUD_CACHE, HUD_HITS, HUD_FRAME,
+    HUD_MISSED, HUD_UNDERRUNS, HUD_BUSY, N_HUD_FIELDS
+} hud_field_t;
+
+static char *widest[N_HUD_FIELDS] = {
+    "COLS 00000", "QUEUE 0000/000+00 B00", "LAG 0000/0000MS",
+    "CACHE 0000.0MB", "HIT 100",
+    "FRAME 000.0 MAX 000.0MS", "MISSED 00000", "XRUNS 00000", NULL,
+};
+#define HUD_GAP 8	/* Pixels between fields */
+
+static char shown[N_HUD_FIELDS][128];	/* What is on-screen now */
+
+/* Forget what's on-screen so that the next update repaints every field */
+static void
+hud_invalidate()
+{
+    int i;
+
+    for (i = 0; i < N_HUD_FIELDS; i++) shown[i][0] = '\0';
+}
+
+static double
+elapsed(struct timeval *from, struct timeval *to)
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_usec - from->tv_usec) / 1000000.0;
+}
+
+/* Repaint one field if its text has changed */
+static void
+draw_field(hud_field_t field, int x, char *text)
+{
+    int right;	/* Rightmost column of the field's slot */
+
+    if (strcmp(text, shown[field]) == 0) return;
+
+    right = (widest[field] != NULL) ? x + text_width(widest[field]) - 1
+				    : max_x;
+    if (x > max_x) return;
+    if (right > max_x) right = max_x;
+
+    gui_paint_rect(x, max_y + 1, right, disp_height - 1, black);
+    gui_lock();
+    draw_text(text, x, max_y + 2, LEFT, BOTTOM);
+    gui_unlock();
+    gui_update_rect(x, max_y + 1, right, disp_height - 1);
+
+    strncpy(shown[field], text, sizeof(shown[field]) - 1);
+}
+
+/* Recalculate the figures and repaint whichever have changed */
+static void
+draw_fields(double interval)
+{
+    char s[128], lag[128];
+    int x = min_x;
+    int i;
+    size_t bytes;
+    unsigned long lookups, hits;
+
+    sprintf(s, "COLS %ld", lrint((columns - last_columns) / interval));
+    draw_field(HUD_COLUMNS, x, s);
+    x += text_width(widest[HUD_COLUMNS]) + HUD_GAP;
+    last_columns = columns;
+
+    /* Queue depth and time from schedule() to result for the display's
+     * classes, visible/lookahead, and how many threads do batch work */
+    {
+	char *q = s, *l = lag;
+	priority_t pri;
+	int queued, running;
+	double latency;
+
+	q += sprintf(q, "QUEUE");
+	l += sprintf(l, "LAG");
+	for (pri = 0; pri < PRI_BATCH; pri++) {
+	    scheduler_stats(pri, &queued, &running, &latency);
+	    q += sprintf(q, pri == 0 ? " %d" : "/%d", queued);
+	    if (latency < 0.0)
+		l += sprintf(l, pri == 0 ? " -" : "/-");
+	    else
+		l += sprintf(l, pri == 0 ? " %ld" : "/%ld",
+			     lrint(latency * 1000.0));
+	}
+	scheduler_stats(PRI_BATCH, &queued, &running, &latency);
+	sprintf(q, "+%d B%d", jobs_in_flight, running);
+	strcpy(l, "MS");
+    }
+    draw_field(HUD_QUEUE, x, s);
+    x += text_width(widest[HUD_QUEUE]) + HUD_GAP;
+    draw_field(HUD_LAG, x, lag);
+    x += text_width(widest[HUD_LAG]) + HUD_GAP;
+
+    cache_stats(&bytes, &lookups, &hits);
+    sprintf(s, "CACHE %.1fMB", bytes / (1024.0 * 1024.0));
+    draw_field(HUD_CACHE, x, s);
+    x += text_width(widest[HUD_CACHE]) + HUD_GAP;
+
+    if (lookups > last_lookups)
+	sprintf(s, "HIT %ld", lrint(100.0 * (hits - last_hits)
+					   / (lookups - last_lookups)));
+    else
+	sprintf(s, "HIT -");
+    draw_field(HUD_HITS, x, s);
+    x += text_width(widest[HUD_HITS]) + HUD_GAP;
+    last_lookups = lookups; last_hits = hits;
+
+    if (frames > 0)
+	sprintf(s, "FRAME %.1f MAX %.1fMS", frame_time / frames * 1000.0,
+		max_frame_time * 1000.0);
+    else
+	sprintf(s, "FRAME -");
+    draw_field(HUD_FRAME, x, s);
+    x += text_width(widest[HUD_FRAME]) + HUD_GAP;
+    frames = 0; frame_time = max_frame_time = 0.0;
+
+    sprintf(s, "MISSED %lu", missed);
+    draw_field(HUD_MISSED, x, s);
+    x += text_width(widest[HUD_MISSED]) + HUD_GAP;
+
+    sprintf(s, "XRUNS %lu", underruns);
+    draw_field(HUD_UNDERRUNS, x, s);
+    x += text_width(widest[HUD_UNDERRUNS]) + HUD_GAP;
+
+    /* Percentage of the time each calc thread was doing an FFT,
+     * as many of them as fit */
+    strcpy(s, "BUSY");
+    for (i = 0; i < nthreads; i++) {
+	unsigned long b = busy[i] - last_busy[i];
+	unsigned long t = b + idle[i] - last_idle[i];
+	char *end = s + strlen(s);
+
+	if (t > 0) sprintf(end, " %ld", lrint(100.0 * b / t));
+	else sprintf(end, " -");
+	if (x + text_width(s) > max_x) {
+	    *end = '\0';
+	    break;
+	}
+	last_busy[i] = busy[i]; last_idle[i] = idle[i];
+    }
+    draw_field(HUD_BUSY, x, s);
+}
+
+/*
+ * Public functions
+ */
+
+/* Called by draw_status_line() when it has blanked the status line */
+void
+draw_hud()
+{
+    hud_invalidate();
+    gettimeofday(&last_update, NULL);
+    draw_fields(HUD_INTERVAL);
+}
+
+/* Called every frame from the main loop */
+void
+update_hud()
+{
+    struct timeval now;
+    double interval;
+
+    if (!show_hud || !show_time_axes) return;
+
+    gettimeofday(&now, NULL);
+    interval = elapsed(&last_update, &now);
+    if (interval < HUD_INTERVAL) return;
+    last_update = now;
+
+    draw_fields(interval);
+}
+
+/* start_scheduler() tells us how many calc threads there are */
+void
+hud_set_threads(int n)
+{
+    /* It's called again when the scheduler is restarted */
+    free(busy); free(idle); free(last_busy); free(last_idle);
+    nthreads = n;
+    busy = Calloc(n, sizeof(*busy));
+    idle = Calloc(n, sizeof(*idle));
+    last_busy = Calloc(n, sizeof(*last_busy));
+    last_idle = Calloc(n, sizeof(*last_idle));
+}
+
+/* A result has arrived from the calc threads */
+void
+hud_column_done()
+{
+    columns++;
+}
+
+/* The main thread took this long to do a scroll frame */
+void
+hud_frame_time(double secs)
+{
+    frames++;
+    frame_time += secs;
+    if (secs > max_frame_time) max_frame_time = secs;
+}
+
+/* The timer fired but the last scroll hadn't been done yet */
+void
+hud_frame_missed()
+{
+    missed++;
+}
+
+/* The audio player asked for more audio later than it should have */
+void
+hud_underrun()
+{
+    underruns++;
+}
+
+/* Calc thread "thread" has spent "secs" seconds working or idling */
+void
+hud_calc_time(int thread, double secs, bool working)
+{
+    if (thread < 0 || thread >= nthreads) return;
+    if (working) busy[thread] += lrint(secs * 1000000.0);
+    else	 idle[thread] += lrint(secs * 1000000.0);
+}
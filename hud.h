@@ -0,0 +1,37 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * hud.h: Declarations for hud.c
+ */
+
+#ifndef HUD_H
+
+extern bool show_hud;		/* Show performance figures in the status line? */
+
+extern void draw_hud(void);
+extern void update_hud(void);
+
+extern void hud_set_threads(int n);
+extern void hud_column_done(void);
+extern void hud_frame_time(double secs);
+extern void hud_frame_missed(void);
+extern void hud_underrun(void);
+extern void hud_calc_time(int thread, double secs, bool working);
+
+#define HUD_H
+#endif
@@ -139,6 +139,9 @@ sdl_keydown(SDL_Event *eventp)
 	/* Other window function keys */
 	case 'h': key = KEY_H;			break;
 	case 'n': key = KEY_N;			break;
+	case 'v': key = KEY_V;			break;
+	case 'e': key = KEY_E;			break;
+	case 'j': key = KEY_J;			break;
 	/* Avanti! */
 	case '0': key = KEY_0;			break;
 	case '1': key = KEY_1;			break;
@@ -72,6 +72,9 @@ enum key {
     KEY_M,
     KEY_H,
     KEY_N,
+    KEY_V,
+    KEY_E,
+    KEY_J,
     KEY_0,
     KEY_9,
     KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7, KEY_8,
@@ -29,10 +29,13 @@
 #include <errno.h>
 
 /* Open an MP3 file, setting (*afp)->{sample_rate,channels,frames}
+ * If "like" isn't NULL, it's another handle on the same file whose
+ * length we already know, which saves the calc threads from each
+ * scanning the file again.
  * On failure, returns FALSE.
  */
 bool
-libmpg123_open(audio_file_t *af, char *filename)
+libmpg123_open(audio_file_t *af, char *filename, audio_file_t *like)
 {
     int ret;
     static bool initialized = FALSE;
@@ -90,7 +93,9 @@ libmpg123_open(audio_file_t *af, char *filename)
 	 */
 
 	
-	{
+	if (like != NULL) {
+	    length = like->frames;
+	} else {
 	    struct mpg123_frameinfo mi;
 #if MPG123_API_VERSION >= 45
 	    long val;
@@ -108,8 +113,8 @@ libmpg123_open(audio_file_t *af, char *filename)
 		   == MPG123_OK && val != -1)
 #endif
 		   )) (void) mpg123_scan(af->mh);
+	    length = mpg123_length(af->mh);
 	}
-	length = mpg123_length(af->mh);
 	if (length < 0) {
 	    fprintf(stderr, "Can't discover the length of the MP3 file.\n");
 	    goto fail;
@@ -133,9 +138,9 @@ fail2:
  * Returns TRUE on success, FALSE on failure.
  */
 bool
-libmpg123_seek(audio_file_t *af, int start)
+libmpg123_seek(audio_file_t *af, off_t start)
 {
-    if (mpg123_seek(af->mh, (off_t)start, SEEK_SET) == MPG123_ERR) {
+    if (mpg123_seek(af->mh, start, SEEK_SET) == MPG123_ERR) {
 	fprintf(stderr, "Failed to seek in MP3 file: %s\n", mpg123_strerror(af->mh));
 	return FALSE;
     }
@@ -149,16 +154,16 @@ libmpg123_seek(audio_file_t *af, int start)
  *
  * Returns the number of frames written, or a negative value on errors.
  */
-int
+off_t
 libmpg123_read_frames(audio_file_t *af,
 		      void *write_to,
-		      int frames_to_read,
+		      off_t frames_to_read,
 		      af_format_t format)
 {
     /* Size of an input sample frame in bytes */
-    int framesize = sizeof(short) * af->channels;
+    size_t framesize = sizeof(short) * af->channels;
     /* Number of sample frames written into write_to */
-    int frames_written = 0; /* Quieten "may be used uninitialized" warning */
+    off_t frames_written = 0; /* Quieten "may be used uninitialized" warning */
 
     /* Avoid reading past end of file because that makes the whole read fail */
     {
@@ -184,8 +189,9 @@ libmpg123_read_frames(audio_file_t *af,
 	    if (mpg123_read(af->mh, write_to, bytes_to_read, &bytes_written)
 	        != MPG123_OK) return -1;
 	    if (bytes_written != bytes_to_read)
-		fprintf(stderr, "mpg123_read() returned %ul of %ul bytes\n",
-			bytes_written, bytes_to_read);
+		fprintf(stderr, "mpg123_read() returned %lu of %lu bytes\n",
+			(unsigned long)bytes_written,
+			(unsigned long)bytes_to_read);
 
 	    frames_written = bytes_written / framesize;
 	}
@@ -204,7 +210,7 @@ libmpg123_read_frames(audio_file_t *af,
 	    frames_written = bytes_written / framesize;
 
 	    switch (af->channels) {
-	    	float *fp; signed short *sp; int i;
+	    	float *fp; signed short *sp; off_t i;
 	    case 1:
 		sp = buf; fp = write_to;
 		for (i=0; i<frames_written; i++) {
@@ -24,10 +24,10 @@
 
 #include <string.h>	/* for memset() */
 
-static int mix_mono_read_floats(audio_file_t *af, float *data, int frames_to_read);
+static off_t mix_mono_read_floats(audio_file_t *af, float *data, off_t frames_to_read);
 /* Buffer used by the above */
 static float *multi_data = NULL;   /* buffer for incoming samples */
-static int multi_data_samples = 0;  /* length of buffer in samples */
+static size_t multi_data_samples = 0;  /* length of buffer in samples */
 
 bool
 libsndfile_open(audio_file_t *af, char *filename)
@@ -53,7 +53,7 @@ libsndfile_open(audio_file_t *af, char *filename)
  * Returns TRUE on success, FALSE on failure.
  */
 bool
-libsndfile_seek(audio_file_t *af, int start)
+libsndfile_seek(audio_file_t *af, off_t start)
 {
     /* libsndfile doesn't check to see if you're seeking to the same
      * position except for (SEEK_CUR, 0), so check here to avoid
@@ -71,18 +71,18 @@ libsndfile_seek(audio_file_t *af, int start)
  *
  * Returns the number of frames written, or a negative value on errors.
  */
-int
+off_t
 libsndfile_read_frames(audio_file_t *af,
 		      void *write_to,
-		      int frames_to_read,
+		      off_t frames_to_read,
 		      af_format_t format)
 {
-    int total_frames = 0;	/* How many we have writte */
+    off_t total_frames = 0;	/* How many we have writte */
 
     /* Read from the file until we have read all requested samples */
     while (frames_to_read > 0) {
-	int frames;	/* How many frames did the last read() call return? */
-	int framesize; /* How many bytes in one sample frame? */
+	off_t frames;	/* How many frames did the last read() call return? */
+	size_t framesize; /* How many bytes in one sample frame? */
 
 	/* libsndfile's sample frames are a sample for each channel */
 
@@ -140,16 +140,17 @@ libsndfile_close(audio_file_t *af)
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-static int
-mix_mono_read_floats(audio_file_t *af, float *data, int frames_to_read)
+static off_t
+mix_mono_read_floats(audio_file_t *af, float *data, off_t frames_to_read)
 {
     if (af->channels == 1)
 	return sf_read_float(af->sndfile, data, frames_to_read);
 
     /* Read multi-channel data and mix it down to a single channel of floats */
     {
-	int k, ch, frames_read;
-	int dataout = 0;		    /* No of samples written so far */
+	off_t k, frames_read;
+	int ch;
+	off_t dataout = 0;		    /* No of samples written so far */
 
 	lock_buffer();
 
@@ -160,7 +161,7 @@ mix_mono_read_floats(audio_file_t *af, float *data, int frames_to_read)
 
 	while (dataout < frames_to_read) {
 	    /* Number of frames to read from file */
-	    int this_read = frames_to_read - dataout;
+	    off_t this_read = frames_to_read - dataout;
 
 	    /* A sf_readf_float frame is a sample for each channel */
 	    frames_read = sf_readf_float(af->sndfile, multi_data, this_read);
@@ -6,12 +6,12 @@
 
 extern bool libsndfile_open(audio_file_t *af, char *filename);
 
-extern bool libsndfile_seek(audio_file_t *af, int start);
+extern bool libsndfile_seek(audio_file_t *af, off_t start);
 
-extern int libsndfile_read_frames(audio_file_t *af,
-				  void *write_to,
-				  int frames_to_read,
-				  af_format_t format);
+extern off_t libsndfile_read_frames(audio_file_t *af,
+				    void *write_to,
+				    off_t frames_to_read,
+				    af_format_t format);
 
 extern void libsndfile_close(audio_file_t *af);
 
@@ -22,6 +22,8 @@
 #include "spettro.h"
 #include "lock.h"
 
+#include <sys/time.h>	/* for gettimeofday() */
+
 /*
  * Define the lock type and the locking and unlocking functions
  * according to the system we're using
@@ -31,12 +33,19 @@
 # include <Ecore.h>
   typedef Eina_Lock lock_t;
 # define do_lock(lockp)   (eina_lock_take(lockp) == EINA_LOCK_SUCCEED)
+# define do_trylock(lockp) (eina_lock_take_try(lockp) == EINA_LOCK_SUCCEED)
 # define do_unlock(lockp) (eina_lock_release(lockp) == EINA_LOCK_SUCCEED)
 #elif SDL_LOCKS
 # include <SDL.h>
 # include <SDL_thread.h>
   typedef SDL_mutex *lock_t;
 # define do_lock(lockp)   (SDL_mutexP(*lockp) == 0)
+# if SDL2
+#  define do_trylock(lockp) (SDL_TryLockMutex(*lockp) == 0)
+# else
+   /* SDL1 has no trylock, so every acquisition counts as contended */
+#  define do_trylock(lockp) (FALSE)
+# endif
 # define do_unlock(lockp) (SDL_mutexV(*lockp) == 0)
 #else
 # error "Define one of ECORE_LOCKS and SDL_LOCKS"
@@ -59,26 +68,140 @@ initialize(lock_t *lockp, bool *initp)
     return TRUE;
 }
 
+/*
+ * Optional contention statistics, enabled by --lock-stats.
+ *
+ * The counters are only updated by the thread holding the lock, so they
+ * are protected by the lock they describe. When disabled, the only cost
+ * is the test of lock_stats in take() and release().
+ */
+
+bool lock_stats = FALSE;
+
+static __thread thread_role_t thread_role = ROLE_MAIN;
+
+static char *role_name[N_ROLES] = { "main", "calc", "audio", "timer" };
+
+/* Hold times go in power-of-two buckets of microseconds: <1, <2, <4 ...
+ * with the last bucket catching everything longer */
+#define HOLD_BUCKETS 16
+
+typedef struct {
+    char *name;
+    unsigned long acquisitions[N_ROLES];
+    unsigned long contended[N_ROLES];
+    double total_wait[N_ROLES];		/* in seconds */
+    double max_wait[N_ROLES];
+    unsigned long hold[N_ROLES][HOLD_BUCKETS];
+    struct timeval taken;		/* When the current holder got it */
+    thread_role_t holder;		/* and who that is */
+} lock_stats_t;
+
+/* Seconds elapsed between two timevals */
+static double
+elapsed(struct timeval *from, struct timeval *to)
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_usec - from->tv_usec) / 1000000.0;
+}
+
+static bool
+take(lock_t *lockp, lock_stats_t *s)
+{
+    struct timeval before;
+    bool contended;
+    double wait;
+
+    if (!lock_stats) return do_lock(lockp);
+
+    if (do_trylock(lockp)) {
+	contended = FALSE;
+	gettimeofday(&s->taken, NULL);
+	wait = 0.0;
+    } else {
+	contended = TRUE;
+	gettimeofday(&before, NULL);
+	if (!do_lock(lockp)) return FALSE;
+	gettimeofday(&s->taken, NULL);
+	wait = elapsed(&before, &s->taken);
+    }
+
+    s->holder = thread_role;
+    s->acquisitions[thread_role]++;
+    if (contended) s->contended[thread_role]++;
+    s->total_wait[thread_role] += wait;
+    if (wait > s->max_wait[thread_role]) s->max_wait[thread_role] = wait;
+
+    return TRUE;
+}
+
+static bool
+release(lock_t *lockp, lock_stats_t *s)
+{
+    if (lock_stats) {
+	struct timeval now;
+	double usecs;
+	int bucket;
+
+	gettimeofday(&now, NULL);
+	usecs = elapsed(&s->taken, &now) * 1000000.0;
+	for (bucket = 0; bucket < HOLD_BUCKETS - 1 && usecs >= (1 << bucket);
+	     bucket++)
+	    ;
+	s->hold[s->holder][bucket]++;
+    }
+    return do_unlock(lockp);
+}
+
+/* Which kind of thread is this? Called at the start of each thread. */
+void
+set_thread_role(thread_role_t role)
+{
+    thread_role = role;
+}
+
+thread_role_t
+get_thread_role()
+{
+    return thread_role;
+}
+
 /*
  * Private data and public functions for the locks
  */
 
 static lock_t fftw3_lock;
 static bool fftw3_lock_is_initialized = FALSE;
+static lock_stats_t fftw3_lock_stats = { "fftw3" };
 static lock_t audio_cache_lock;
 static bool audio_cache_lock_is_initialized = FALSE;
+static lock_stats_t audio_cache_lock_stats = { "audio_cache" };
 static lock_t list_lock;
 static bool list_lock_is_initialized = FALSE;
+static lock_stats_t list_lock_stats = { "list" };
 static lock_t window_lock;
 static bool window_lock_is_initialized = FALSE;
+static lock_stats_t window_lock_stats = { "window" };
 static lock_t buffer_lock;
 static bool buffer_lock_is_initialized = FALSE;
+static lock_stats_t buffer_lock_stats = { "buffer" };
+static lock_t pool_lock;
+static bool pool_lock_is_initialized = FALSE;
+static lock_stats_t pool_lock_stats = { "pool" };
+static lock_t stream_lock;
+static bool stream_lock_is_initialized = FALSE;
+static lock_stats_t stream_lock_stats = { "stream" };
+static lock_t memory_lock;
+static bool memory_lock_is_initialized = FALSE;
+static lock_stats_t memory_lock_stats = { "memory" };
+static lock_t fingerprint_lock;
+static bool fingerprint_lock_is_initialized = FALSE;
+static lock_stats_t fingerprint_lock_stats = { "fingerprint" };
 
 void
 lock_fftw3()
 {
     if (!initialize(&fftw3_lock, &fftw3_lock_is_initialized) ||
-	!do_lock(&fftw3_lock)) {
+	!take(&fftw3_lock, &fftw3_lock_stats)) {
 	fprintf(stderr, "Cannot lock FFTW3\n");
 	abort();
     }
@@ -87,7 +210,7 @@ lock_fftw3()
 void
 unlock_fftw3()
 {
-    if (!do_unlock(&fftw3_lock)) {
+    if (!release(&fftw3_lock, &fftw3_lock_stats)) {
 	fprintf(stderr, "Cannot unlock FFTW3\n");
 	abort();
     }
@@ -97,7 +220,7 @@ void
 lock_audio_cache()
 {
     if (!initialize(&audio_cache_lock, &audio_cache_lock_is_initialized) ||
-	!do_lock(&audio_cache_lock)) {
+	!take(&audio_cache_lock, &audio_cache_lock_stats)) {
 	fprintf(stderr, "Cannot lock audio_cache\n");
 	abort();
     }
@@ -106,7 +229,7 @@ lock_audio_cache()
 void
 unlock_audio_cache()
 {
-    if (!do_unlock(&audio_cache_lock)) {
+    if (!release(&audio_cache_lock, &audio_cache_lock_stats)) {
 	fprintf(stderr, "Cannot unlock audio_cache\n");
 	abort();
     }
@@ -118,13 +241,13 @@ lock_list()
     if (!initialize(&list_lock, &list_lock_is_initialized))
 	return FALSE;
     else
-	return do_lock(&list_lock);
+	return take(&list_lock, &list_lock_stats);
 }
 
 bool
 unlock_list()
 {
-    return do_unlock(&list_lock);
+    return release(&list_lock, &list_lock_stats);
 }
 
 bool
@@ -133,13 +256,13 @@ lock_window()
     if (!initialize(&window_lock, &window_lock_is_initialized))
 	return FALSE;
     else
-	return do_lock(&window_lock);
+	return take(&window_lock, &window_lock_stats);
 }
 
 bool
 unlock_window()
 {
-    return do_unlock(&window_lock);
+    return release(&window_lock, &window_lock_stats);
 }
 
 bool
@@ -148,11 +271,110 @@ lock_buffer()
     if (!initialize(&buffer_lock, &buffer_lock_is_initialized))
 	return FALSE;
     else
-	return do_lock(&buffer_lock);
+	return take(&buffer_lock, &buffer_lock_stats);
 }
 
 bool
 unlock_buffer()
 {
-    return do_unlock(&buffer_lock);
+    return release(&buffer_lock, &buffer_lock_stats);
+}
+
+bool
+lock_pool()
+{
+    if (!initialize(&pool_lock, &pool_lock_is_initialized))
+	return FALSE;
+    else
+	return take(&pool_lock, &pool_lock_stats);
+}
+
+bool
+unlock_pool()
+{
+    return release(&pool_lock, &pool_lock_stats);
+}
+
+bool
+lock_stream()
+{
+    if (!initialize(&stream_lock, &stream_lock_is_initialized))
+	return FALSE;
+    else
+	return take(&stream_lock, &stream_lock_stats);
+}
+
+bool
+unlock_stream()
+{
+    return release(&stream_lock, &stream_lock_stats);
+}
+
+bool
+lock_memory()
+{
+    if (!initialize(&memory_lock, &memory_lock_is_initialized))
+	return FALSE;
+    else
+	return take(&memory_lock, &memory_lock_stats);
+}
+
+bool
+unlock_memory()
+{
+    return release(&memory_lock, &memory_lock_stats);
+}
+
+bool
+lock_fingerprint()
+{
+    if (!initialize(&fingerprint_lock, &fingerprint_lock_is_initialized))
+	return FALSE;
+    else
+	return take(&fingerprint_lock, &fingerprint_lock_stats);
+}
+
+bool
+unlock_fingerprint()
+{
+    return release(&fingerprint_lock, &fingerprint_lock_stats);
+}
+
+/* Print the contention statistics for every lock that has been used */
+void
+dump_lock_stats()
+{
+    static lock_stats_t *all[] = {
+	&fftw3_lock_stats, &audio_cache_lock_stats, &list_lock_stats,
+	&window_lock_stats, &buffer_lock_stats, &pool_lock_stats,
+	&stream_lock_stats, &memory_lock_stats, &fingerprint_lock_stats,
+    };
+    int i, role, bucket;
+
+    if (!lock_stats) {
+	printf("Lock statistics are off: use --lock-stats\n");
+	return;
+    }
+
+    printf("%-11s %-5s %9s %9s %10s %10s  hold time histogram (<1,2,4..us)\n",
+	   "lock", "role", "acquired", "contended", "wait secs", "max wait");
+    for (i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+	lock_stats_t *s = all[i];
+
+	for (role = 0; role < N_ROLES; role++) {
+	    int last;	/* The last non-empty bucket */
+
+	    if (s->acquisitions[role] == 0) continue;
+
+	    printf("%-11s %-5s %9lu %9lu %10.6f %10.6f ",
+		   s->name, role_name[role],
+		   s->acquisitions[role], s->contended[role],
+		   s->total_wait[role], s->max_wait[role]);
+	    for (last = HOLD_BUCKETS - 1; last > 0; last--)
+		if (s->hold[role][last] != 0) break;
+	    for (bucket = 0; bucket <= last; bucket++)
+		printf(" %lu", s->hold[role][bucket]);
+	    printf("\n");
+	}
+    }
 }
@@ -17,6 +17,16 @@
 
 /* lock.h: Declarations for lock.c */
 
+/* Which kind of thread is taking a lock, for the contention statistics */
+typedef enum {
+    ROLE_MAIN, ROLE_CALC, ROLE_AUDIO, ROLE_TIMER, N_ROLES
+} thread_role_t;
+
+extern bool lock_stats;		/* --lock-stats: Keep contention statistics */
+extern void set_thread_role(thread_role_t role);
+extern thread_role_t get_thread_role(void);
+extern void dump_lock_stats(void);
+
 extern void lock_fftw3(void);
 extern void unlock_fftw3(void);
 
@@ -31,3 +41,15 @@ extern bool unlock_window(void);
 
 extern bool lock_buffer(void);
 extern bool unlock_buffer(void);
+
+extern bool lock_pool(void);
+extern bool unlock_pool(void);
+
+extern bool lock_stream(void);
+extern bool unlock_stream(void);
+
+extern bool lock_memory(void);
+extern bool unlock_memory(void);
+
+extern bool lock_fingerprint(void);
+extern bool unlock_fingerprint(void);
@@ -74,15 +74,29 @@
  */
 #include "args.h"
 #include "audio.h"
+#include "audio_blocks.h"
 #include "audio_cache.h"
 #include "axes.h"
+#include "barlines.h"
 #include "cache.h"
+#include "col_features.h"
+#include "dump.h"
+#include "fft.h"
+#include "fingerprint.h"
 #include "gui.h"
 #include "interpolate.h"
+#include "lock.h"
 #include "overlay.h"
 #include "paint.h"
+#include "pool.h"	/* for shed_spec_pool() */
+#include "pyramid.h"
 #include "scheduler.h"
+#include "script.h"
+#include "shared_cache.h"
+#include "startup.h"
+#include "stream.h"
 #include "timer.h"
+#include "video.h"
 #include "window.h"	/* for free_windows() */
 #include "ui.h"
 
@@ -107,31 +121,19 @@ main(int argc, char **argv)
 	max_y -= top_margin;
     }
 
-    /* Process the filename argument */
-    if (argc != 1) {
+    /* Process the filename argument, which --capture doesn't need */
+    if (stream_capture && argc == 0) {
+	filename = "capture";
+    } else if (argc != 1) {
 	fprintf(stderr, "You must name one audio file.\n");
 	exit(1);
-    }
-    filename = argv[0];
-
-    if ((af = open_audio_file(filename)) == NULL) {
-	fprintf(stderr, "Cannot read ");
-	perror(filename);
-	exit(1);
-    }
-
-    /* If they set disp_time with -t or --start, check that it's
-     * within the audio and make it coincide with the start of a column.
-     */
-    if (start_time > audio_file_length()) {
-	fprintf(stderr,
-		"Starting time (%g) is beyond the end of the audio (%g).\n",
-		disp_time, audio_file_length());
-	set_disp_time(audio_file_length());
     } else {
-	set_disp_time(start_time);
+	filename = argv[0];
     }
 
+    /* Open the audio file in the background while the window comes up */
+    start_opening(filename);
+
     /* Initialize the graphics subsystem. */
     /* SDL2 in fullscreen mode may change disp_height and disp_width */
     gui_init(filename);
@@ -140,32 +142,76 @@ main(int argc, char **argv)
      * from file to file */
     make_row_overlay();	
 
+    /* The frequency axes don't depend on the audio file either */
+    if (show_freq_axes) draw_freq_axes();
+    gui_update_display();
+    startup_window_shown();
+
+    if ((af = finish_opening()) == NULL) {
+	fprintf(stderr, "Cannot read ");
+	perror(filename);
+	exit(1);
+    }
+    open_shared_cache(af);
+
+    /* In case gui_init() changed the display size */
+    reposition_audio_cache();
+
     /* Initialize the audio subsystem. */
     init_audio(af, filename);
 
     /* Apply the -t flag */
     if (disp_time != 0.0) set_playing_time(disp_time);
 
+    /* When memory is short, let these free what they can.
+     * This must come after finish_opening(), as the startup thread
+     * uses the audio blocks without locking them. */
+    mem_add_shedder(shed_work);
+    mem_add_shedder(shed_results);
+    mem_add_shedder(shed_spec_pool);
+    mem_add_shedder(drop_audio_blocks);
+
     start_scheduler(max_threads);
+    start_pyramid(af);
+    if (fp_index_file != NULL) start_fingerprint(af);
 
-    draw_axes();
+    if (show_time_axes) draw_time_axes();
 
     repaint_display(FALSE); /* Schedules the initial screen refresh */
 
-    start_timer();
+    start_script();
+    /* --video does its own scrolling */
+    if (video_file == NULL) start_timer();
+    else start_video();
+
+    /* Live input always starts off following the newest audio */
+    if (af->live) start_playing();
 
     gui_main();
 
-    stop_timer();
+    /* The -o option's PNG file may still be being written */
+    finish_png_files();
+
+    if (video_file == NULL) stop_timer();
     stop_scheduler();
+    stop_pyramid();
+    stop_fingerprint();
+    close_audio();
+    close_shared_cache();
     gui_quit();
 
+    if (lock_stats) dump_lock_stats();
+
     /* Free memory to make valgrind happier */
     drop_all_work();
     drop_all_results();
     free_interpolate_cache();
     free_row_overlay();
+    free_bar_map();
     free_windows();
+    free_fft_tables();
+    drop_audio_blocks();
+    drop_features();
     close_audio_file(af);
 
     return 0;
@@ -24,7 +24,9 @@
  *
  * The row overlay is implemented by having an array with an element for each
  * pixel of a screen column, with each element saying whether there's an overlay
- * color at that height: 0 means no, 0xFFRRGGBB says of which colour if so.
+ * color at that height: 0 means no, 0xFFRRGGBB says of which colour if so,
+ * and a mask array that is all ones where there is an overlay and 0 where
+ * there isn't, so that paint_column() can apply them without testing each row.
  *
  * When the vertical axis is panned or zoomed, or the vertical window size
  * changes, the row overlay matrix must be recalculated.
@@ -45,12 +47,12 @@ static void overlay_row(int magindex, color_t color);
  * indexed the graphic's y-coordinate (not the whole screen's)
  */
 static color_t	*row_overlay = NULL;
-static bool	*row_is_overlaid = NULL;
+static color_t	*row_overlay_mask = NULL;
 static int       row_overlay_maglen = 0;
 
 /* and we remember what parameters we calculated it for so as to recalculate it
  * automatically if anything changes.
- * -1.0 forces a call to make_row_overlay() in first call to get_row_overlay()
+ * -1.0 forces a call to make_row_overlay() in first call to check_row_overlay()
  */
 static double row_overlay_min_freq = -1.0;
 static double row_overlay_max_freq = -1.0;
@@ -67,11 +69,11 @@ make_row_overlay()
     /* Check for resize */
     if (row_overlay_maglen != maglen) {
       row_overlay = Realloc(row_overlay, maglen * sizeof(*row_overlay));
-      row_is_overlaid = Realloc(row_is_overlaid, maglen * sizeof(*row_is_overlaid));
+      row_overlay_mask = Realloc(row_overlay_mask, maglen * sizeof(*row_overlay_mask));
       row_overlay_maglen = maglen;
     }
     memset(row_overlay, 0, maglen * sizeof(*row_overlay));
-    memset(row_is_overlaid, 0, maglen * sizeof(*row_is_overlaid));
+    memset(row_overlay_mask, 0, maglen * sizeof(*row_overlay_mask));
 
     if (piano_lines) {
 	/* Run up the piano keyboard blatting the pixels they hit */
@@ -137,7 +139,7 @@ overlay_row(int magindex, color_t color)
 {
     if (magindex >= 0 && magindex < maglen) {
 	row_overlay[magindex] = color;
-	row_is_overlaid[magindex] = TRUE;
+	row_overlay_mask[magindex] = ~(color_t)0;
     }
 }
 
@@ -145,19 +147,16 @@ void
 free_row_overlay()
 {
     free(row_overlay);
-    row_overlay = NULL;
+    free(row_overlay_mask);
+    row_overlay = row_overlay_mask = NULL;
 }
 
-/* What colour overlays this pixel row?
- * 
- * Returns TRUE if this row is overlaid and fills "ov" if non-NULL
- * Returns FALSE if there is no overlay on this row.
+/* Make sure the overlay is for the current frequency range.
+ * Returns FALSE if there is no overlay.
  */
-bool
-get_row_overlay(int y, color_t *colorp)
+static bool
+check_row_overlay()
 {
-    int magindex = y - min_y;
-
     if (row_overlay == NULL) return FALSE;
 
     /* If anything moved, recalculate the overlay.
@@ -176,8 +175,19 @@ get_row_overlay(int y, color_t *colorp)
 	row_overlay_max_freq = max_freq;
 	row_overlay_maglen = maglen;
     }
+    return TRUE;
+}
 
-    if (row_is_overlaid[magindex] && colorp != NULL)
-	*colorp = row_overlay[magindex];
-    return row_is_overlaid[magindex];
+/* The whole overlay for paint_column(): the colors and masks for each row
+ * of the graphic, indexed by y - min_y, or NULLs if there is none.
+ */
+void
+get_row_overlays(const color_t **colorsp, const color_t **masksp)
+{
+    if (check_row_overlay()) {
+	*colorsp = row_overlay;
+	*masksp = row_overlay_mask;
+    } else {
+	*colorsp = *masksp = NULL;
+    }
 }
@@ -20,5 +20,5 @@
 #include "gui.h"	/* for color_t */
 
 extern void make_row_overlay(void);
-extern bool get_row_overlay(int y, color_t *colorp);
+extern void get_row_overlays(const color_t **colorsp, const color_t **masksp);
 extern void free_row_overlay(void);
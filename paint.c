@@ -30,23 +30,69 @@
 #include "convert.h"
 #include "colormap.h"
 #include "gui.h"
+#include "hud.h"
 #include "interpolate.h"
 #include "overlay.h"
+#include "pool.h"
+#include "pyramid.h"
 #include "scheduler.h"
+#include "script.h"
 #include "timer.h"	/* for scroll_event_pending */
 #include "ui.h"
+#include "ui_funcs.h"	/* for apply_view_changes() */
 
-/* Local function */
+#include <sys/time.h>	/* for gettimeofday() */
+
+/* Local functions */
 static void calc_column(int col);
+static void scroll(void);
 
 /*
- * Really scroll the screen
+ * Called from the timer, via the main loop, to scroll the screen.
+ * When the HUD is showing, time how long it takes and update the HUD.
  */
 void
 do_scroll()
+{
+    struct timeval before, after;
+
+    /* Free memory if another thread is waiting for some */
+    mem_shed_if_wanted();
+
+    if (!show_hud) {
+	update_view();
+	run_script();
+	return;
+    }
+
+    gettimeofday(&before, NULL);
+    update_view();
+    gettimeofday(&after, NULL);
+    hud_frame_time((after.tv_sec - before.tv_sec) +
+		   (after.tv_usec - before.tv_usec) / 1000000.0);
+    update_hud();
+    run_script();
+}
+
+/*
+ * Apply the pans and zooms that have been asked for and scroll to the
+ * playing time, painting whatever that changes.
+ */
+void
+update_view()
+{
+    apply_view_changes();
+    scroll();
+}
+
+/*
+ * Really scroll the screen
+ */
+static void
+scroll()
 {
     double new_disp_time;	/* Where we reposition to */
-    int scroll_by;		/* How many pixels to scroll by.
+    off_t scroll_by;		/* How many pixels to scroll by.
 				 * +ve = move forward in time, move display left
 				 * +ve = move back in time, move display right
 				 */
@@ -56,6 +102,10 @@ do_scroll()
 
     new_disp_time = get_playing_time();
 
+    /* This frame will be on-screen until the next one, so show where the
+     * sound will be half way through that */
+    if (low_latency && playing == PLAYING) new_disp_time += 0.5 / fps;
+
     if (DELTA_LE(new_disp_time, 0.0))
 	new_disp_time = 0.0;
     if (DELTA_GE(new_disp_time, audio_file_length() - 1/current_sample_rate()))
@@ -80,7 +130,7 @@ do_scroll()
      */
     if (scroll_by == 0) return;
 
-    if (abs(scroll_by) >= max_x - min_x + 1) {
+    if (scroll_by >= max_x - min_x + 1 || -scroll_by >= max_x - min_x + 1) {
 	/* If we're scrolling by more than the display width, repaint it all */
 	set_disp_time(new_disp_time);
 	repaint_display(FALSE);
@@ -207,8 +257,8 @@ repaint_columns(int from_x, int to_x, int from_y, int to_y, bool refresh_only)
 void
 repaint_column(int pos_x, int from_y, int to_y, bool refresh_only)
 {
-    /* What time does this column represent? */
-    double t = screen_column_to_start_time(pos_x);
+    /* What sample frame does this column represent? */
+    off_t frame = screen_column_to_frame(pos_x);
     calc_t *r;
 
     if (pos_x < min_x - LOOKAHEAD || pos_x > max_x + LOOKAHEAD) {
@@ -220,8 +270,9 @@ repaint_column(int pos_x, int from_y, int to_y, bool refresh_only)
      * repaint it from the cache */
 
     /* If the column is before/after the start/end of the piece,
-     * give it the background colour */
-    if (DELTA_LT(t, 0.0) || DELTA_GT(t, audio_file_length())) {
+     * give it the background colour. Live input has no end yet. */
+    if (frame < 0 ||
+	(frame > current_audio_file()->frames && !current_audio_file()->live)) {
 	if (!refresh_only && pos_x >= min_x && pos_x <= max_x)
 	    gui_paint_column(pos_x, min_y, max_y, background);
 	return;
@@ -231,12 +282,18 @@ repaint_column(int pos_x, int from_y, int to_y, bool refresh_only)
 	/* If there's a bar line or green line here, nothing to do */
 	if (get_col_overlay(pos_x, NULL)) return;
 
+	/* Zoomed out to a level that the pyramid has done? */
+	if ((r = pyramid_result(pos_x)) != NULL) {
+	    paint_column(pos_x, from_y, to_y, r);
+	    return;
+	}
+
 	/* If there's any result for this column in the cache, it should be
 	 * displaying something, but it might be for the wrong fftfreq/window.
 	 * We have no way of knowing what it is displaying so force its repaint
 	 * with the current parameters.
 	 */
-	if ((r = recall_result(t, ANY_FFTFREQ, ANY_WINDOW)) != NULL) {
+	if ((r = recall_result(frame, ANY_FFTFREQ, ANY_WINDOW)) != NULL) {
 	    /* There's data for this column. */
 	    if (r->fft_freq == fft_freq && r->window == window_function) {
 		/* Bingo! It's the right result */
@@ -254,18 +311,20 @@ repaint_column(int pos_x, int from_y, int to_y, bool refresh_only)
 	if (get_col_overlay(pos_x, &ov)) {
 	    gui_paint_column(pos_x, from_y, to_y, ov);
 	} else
+	/* If the pyramid has pooled data for this column, use that */
+	if ((r = pyramid_result(pos_x)) != NULL) {
+	    paint_column(pos_x, from_y, to_y, r);
+	} else
 	/* If we have the right spectral data for this column, repaint it */
-	if ((r = recall_result(t, fft_freq, window_function)) != NULL) {
+	if ((r = recall_result(frame, fft_freq, window_function)) != NULL) {
 	    paint_column(pos_x, from_y, to_y, r);
 	} else {
 	    /* ...otherwise paint it with the background color */
 	    if (pos_x >= min_x && pos_x <= max_x)
 		gui_paint_column(pos_x, from_y, to_y, background);
 
-	    /* ...and if it was for a valid time, schedule its calculation */
-	    if (DELTA_GE(t, 0.0) && DELTA_LE(t, audio_file_length())) {
-		calc_column(pos_x);
-	    }
+	    /* ...and schedule its calculation */
+	    calc_column(pos_x);
 	}
     }
 }
@@ -278,10 +337,16 @@ repaint_column(int pos_x, int from_y, int to_y, bool refresh_only)
 void
 paint_column(int pos_x, int from_y, int to_y, calc_t *result)
 {
-    float *logmag;
+    /* Scratch space for the column's magnitudes, kept from call to call.
+     * paint_column() is only ever called from the main loop. */
+    static float *logmag = NULL;
+    static color_t *pixels = NULL;	/* The column's colors, from min_y */
+    static int logmag_size = 0;
     float col_logmax;	/* maximum log magnitude in the column */
-    int y;
+    int k, from_k, to_k;	/* Indices into logmag[] and pixels[] */
     color_t ov;		/* Overlay color */
+    const color_t *ov_colors, *ov_masks;	/* The row overlay */
+    bool green_line;	/* Is this the green line's column? */
     int speclen;
     /* Stuff to detect and report once the presence of out-of-range colors */
     unsigned n_bad_pixels = 0;
@@ -300,9 +365,17 @@ paint_column(int pos_x, int from_y, int to_y, calc_t *result)
 
     speclen = fft_freq_to_speclen(fft_freq, current_sample_rate());
 
-    logmag = Calloc(maglen, sizeof(*logmag));
-    col_logmax = interpolate(logmag, result->spec, from_y, to_y,
-    			     current_sample_rate(), speclen);
+    /* interpolate() fills logmag[from_y-min_y..to_y-min_y], which is all
+     * we read, so there is no need to clear it. */
+    if (maglen > logmag_size) {
+	logmag = Realloc(logmag, maglen * sizeof(*logmag));
+	pixels = Realloc(pixels, maglen * sizeof(*pixels));
+	logmag_size = maglen;
+    }
+    col_logmax = interpolate(logmag,
+			     result->channels == 1 ? result->spec
+			     : result->spec + show_channel * (speclen + 1),
+			     from_y, to_y, current_sample_rate(), speclen);
 
     /* Auto-adjust brightness if some pixel is brighter than current maximum */
     if (col_logmax > logmax) logmax = col_logmax;
@@ -310,9 +383,11 @@ paint_column(int pos_x, int from_y, int to_y, calc_t *result)
     /* For now, we just normalize each column to the maximum seen so far.
      * Really we need to add max_db and have brightness/contrast control.
      */
-    gui_lock();		/* Allow pixel-writing access */
-    for (y=from_y; y <= to_y; y++) {
-        int k = y - min_y;
+    from_k = from_y - min_y;
+    to_k = to_y - min_y;
+    green_line = !green_line_off && pos_x == disp_offset;
+
+    for (k=from_k; k <= to_k; k++) {
 	float value = (float)20.0 * (logmag[k] - logmax);
 	color_t color = colormap(value);
 	if (color == no_color) {
@@ -321,15 +396,25 @@ paint_column(int pos_x, int from_y, int to_y, calc_t *result)
 	     * error messages. */
 	    if (n_bad_pixels++ == 0) a_bad_value = value;
 	}
-	/* Apply row overlay, if any, otherwise paint the pixel
-	 * but don't overlay the green line */
-	gui_putpixel(pos_x, y,
-		     ((green_line_off || pos_x != disp_offset) && get_row_overlay(y, &ov))
-		     ? ov :
-		     /* OR in the green line if it's on */
-		     ((!green_line_off && pos_x == disp_offset) ? green : 0)
-		     | color);
+	pixels[k] = color;
     }
+
+    /* OR in the green line if it's on, otherwise apply the row overlay.
+     * The masks make these branch-free loops, which gcc -O3 vectorizes.
+     */
+    if (green_line) {
+	for (k=from_k; k <= to_k; k++)
+	    pixels[k] |= green;
+    } else {
+	get_row_overlays(&ov_colors, &ov_masks);
+	if (ov_colors != NULL)
+	    for (k=from_k; k <= to_k; k++)
+		pixels[k] = (pixels[k] & ~ov_masks[k])
+			  | (ov_colors[k] & ov_masks[k]);
+    }
+
+    gui_lock();		/* Allow pixel-writing access */
+    gui_put_column(pos_x, from_y, to_y, pixels + from_k);
     gui_unlock();
 
     /* Blurt one error message per column, not 480 */
@@ -338,8 +423,6 @@ paint_column(int pos_x, int from_y, int to_y, calc_t *result)
 		n_bad_pixels, pos_x, (double)a_bad_value);
     }
 
-    free(logmag);
-
     /* If the maximum amplitude changed, we should repaint the already-drawn
      * columns at the new brightness. We tried this calling repaint_display here
      * but, apart from causing a jumpy pause in the scrolling, there was worse:
@@ -359,11 +442,12 @@ paint_column(int pos_x, int from_y, int to_y, calc_t *result)
 static void
 calc_column(int col)
 {
-    calc_t *calc = Malloc(sizeof(calc_t));
+    calc_t *calc = new_calc();
 
     calc->fft_freq   = fft_freq;
     calc->window     = window_function;
-    calc->t	     = screen_column_to_start_time(col);
+    calc->channels   = calc_channels();
+    calc->frame      = screen_column_to_frame(col);
 
     schedule(calc);
 }
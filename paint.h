@@ -24,6 +24,7 @@
 #include "calc.h"		/* for calc_t */
 
 extern void do_scroll(void);
+extern void update_view(void);
 extern void repaint_display(bool repaint_all);
 extern void repaint_columns(int from_x, int to_x, int from_y, int to_y, bool refresh_only);
 extern void repaint_column(int column, int min_y, int max_y, bool refresh_only);
@@ -0,0 +1,510 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * pcmfile.c: Read uncompressed WAV, AIFF and raw PCM files by mapping them
+ * into memory.
+ *
+ * The header is parsed once when the file is opened and after that, sample
+ * frames are converted straight from the mapping into whatever the caller
+ * wants, so seeking costs nothing and there is no need for the audio cache.
+ * Formats we don't understand are left for libsndfile.
+ */
+
+#include "spettro.h"
+#include "pcmfile.h"
+
+#include "stream.h"	/* for stream_format */
+
+#include <string.h>	/* for memcmp(), memcpy(), memset() */
+#include <stdint.h>
+#include <fcntl.h>	/* for open() */
+#include <unistd.h>	/* for close() and sysconf() */
+#include <sys/mman.h>	/* for mmap() and madvise() */
+#include <sys/stat.h>	/* for fstat() */
+
+/* How far ahead of the reading position to ask the kernel to read */
+#define READAHEAD_SECONDS 2
+
+struct pcmfile {
+    int fd;
+    unsigned char *map;		/* The whole file, mapped into memory */
+    size_t map_size;
+    unsigned char *data;	/* Where the sample frames start in the map */
+    pcm_format_t fmt;
+    size_t framesize;		/* Bytes per sample frame */
+    off_t last_start;		/* Where the last read started, in frames */
+    off_t advised_from, advised_to; /* The region last passed to madvise() */
+};
+
+static bool parse_wav(struct pcmfile *p, off_t *frames);
+static bool parse_aiff(struct pcmfile *p, off_t *frames);
+
+static const int one = 1;
+#define HOST_IS_BIG_ENDIAN (*(char *)&one == 0)
+
+/*
+ * Parse a raw format description "rate:channels:format" where format is
+ * u8, s8, s16, s24, s32, f32 or f64, optionally followed by "le" or "be"
+ * if it isn't in our byte order.
+ */
+bool
+parse_raw_format(char *spec, pcm_format_t *fmt)
+{
+    char type[16];
+    size_t len;
+
+    if (sscanf(spec, "%lf:%d:%15s", &fmt->sample_rate, &fmt->channels,
+	       type) != 3 ||
+	!(fmt->sample_rate > 0.0) || fmt->channels < 1) {
+	fprintf(stderr, "--raw wants rate:channels:format, for example 48000:2:s16\n");
+	return FALSE;
+    }
+
+    fmt->big_endian = HOST_IS_BIG_ENDIAN;
+    len = strlen(type);
+    if (len > 2 && (strcmp(type + len - 2, "le") == 0 ||
+		    strcmp(type + len - 2, "be") == 0)) {
+	fmt->big_endian = (type[len - 2] == 'b');
+	type[len - 2] = '\0';
+    }
+
+    if      (strcmp(type, "u8") == 0)  fmt->type = PCM_U8,  fmt->bytes = 1;
+    else if (strcmp(type, "s8") == 0)  fmt->type = PCM_S8,  fmt->bytes = 1;
+    else if (strcmp(type, "s16") == 0) fmt->type = PCM_S16, fmt->bytes = 2;
+    else if (strcmp(type, "s24") == 0) fmt->type = PCM_S24, fmt->bytes = 3;
+    else if (strcmp(type, "s32") == 0) fmt->type = PCM_S32, fmt->bytes = 4;
+    else if (strcmp(type, "f32") == 0) fmt->type = PCM_F32, fmt->bytes = 4;
+    else if (strcmp(type, "f64") == 0) fmt->type = PCM_F64, fmt->bytes = 8;
+    else {
+	fprintf(stderr, "Unknown raw sample format \"%s\": use u8, s8, s16, s24, s32, f32 or f64, optionally followed by le or be.\n", type);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Fetch one sample in the range -1.0 to +1.0 */
+static float
+get_sample(const unsigned char *in, const pcm_format_t *fmt)
+{
+    uint64_t u = 0;
+    int k;
+
+    switch (fmt->type) {
+    case PCM_U8:
+	return (in[0] - 128) / 128.0f;
+    case PCM_S8:
+	return (signed char) in[0] / 128.0f;
+    default:
+	break;
+    }
+
+    /* Assemble the bytes into an integer, most significant first */
+    for (k = 0; k < fmt->bytes; k++)
+	u = (u << 8) | in[fmt->big_endian ? k : fmt->bytes - 1 - k];
+
+    switch (fmt->type) {
+    case PCM_S16:
+	return (int16_t) u / 32768.0f;
+    case PCM_S24:
+	return (int32_t) (u << 8) / 2147483648.0f;
+    case PCM_S32:
+	return (int32_t) u / 2147483648.0f;
+    case PCM_F32:
+	{ uint32_t u32 = u; float f; memcpy(&f, &u32, sizeof(f)); return f; }
+    case PCM_F64:
+	{ double d; memcpy(&d, &u, sizeof(d)); return d; }
+    default:
+	return 0.0f;
+    }
+}
+
+static short
+float_to_short(float f)
+{
+    f *= 32768.0f;
+    return f >= 32767.0f ? 32767 : f <= -32768.0f ? -32768 : lrintf(f);
+}
+
+/* Is the data 16-bit native-endian that we can use as it is? */
+#define IS_NATIVE_S16(fmt) \
+	((fmt)->type == PCM_S16 && (fmt)->big_endian == HOST_IS_BIG_ENDIAN)
+
+/* Convert raw samples to 16-bit native-endian ones */
+void
+pcm_to_shorts(const unsigned char *in, short *out, size_t nsamples,
+	      const pcm_format_t *fmt)
+{
+    size_t i;
+
+    if (IS_NATIVE_S16(fmt)) {
+	memcpy(out, in, nsamples * sizeof(short));
+	return;
+    }
+    for (i = 0; i < nsamples; i++, in += fmt->bytes)
+	out[i] = float_to_short(get_sample(in, fmt));
+}
+
+/*
+ * Convert frames to mono floats (plane < 0) or to the floats of one channel.
+ * The native 16-bit case is written so that the compiler can vectorize it.
+ */
+static void
+pcm_to_floats(const unsigned char *in, float *out, off_t nframes,
+	      int plane, const pcm_format_t *fmt)
+{
+    int channels = fmt->channels;
+    size_t framesize = fmt->bytes * channels;
+    off_t i;
+
+    if (IS_NATIVE_S16(fmt) && (uintptr_t) in % sizeof(short) == 0) {
+	const short *sp = (const short *) in;
+
+	if (plane >= 0) {
+	    for (i = 0; i < nframes; i++)
+		out[i] = sp[i * channels + plane] / 32768.0f;
+	} else if (channels == 1) {
+	    for (i = 0; i < nframes; i++)
+		out[i] = sp[i] / 32768.0f;
+	} else if (channels == 2) {
+	    for (i = 0; i < nframes; i++)
+		out[i] = (sp[2 * i] + sp[2 * i + 1]) / 65536.0f;
+	} else {
+	    for (i = 0; i < nframes; i++) {
+		int c, total = 0;
+		for (c = 0; c < channels; c++) total += sp[i * channels + c];
+		out[i] = (float) total / (32768 * channels);
+	    }
+	}
+	return;
+    }
+
+    for (i = 0; i < nframes; i++, in += framesize) {
+	if (plane >= 0) {
+	    out[i] = get_sample(in + plane * fmt->bytes, fmt);
+	} else {
+	    float total = 0.0f;
+	    int c;
+	    for (c = 0; c < channels; c++)
+		total += get_sample(in + c * fmt->bytes, fmt);
+	    out[i] = total / channels;
+	}
+    }
+}
+
+bool
+pcmfile_open(audio_file_t *af, char *filename)
+{
+    struct pcmfile *p;
+    struct stat st;
+    off_t frames;
+
+    p = Malloc(sizeof(*p));
+    if ((p->fd = open(filename, O_RDONLY)) < 0) {
+	free(p);
+	return FALSE;
+    }
+    if (fstat(p->fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+	(off_t)(size_t) st.st_size != st.st_size) {
+	/* Not a file we can map, or too big for our address space */
+	close(p->fd);
+	free(p);
+	return FALSE;
+    }
+    p->map_size = st.st_size;
+    p->map = mmap(NULL, p->map_size, PROT_READ, MAP_SHARED, p->fd, 0);
+    if (p->map == MAP_FAILED) {
+	close(p->fd);
+	free(p);
+	return FALSE;
+    }
+
+    if (stream_format != NULL) {
+	/* A raw file. The format was given on the command line. */
+	if (!parse_raw_format(stream_format, &p->fmt)) exit(1);
+	p->data = p->map;
+	frames = p->map_size / (p->fmt.bytes * p->fmt.channels);
+    } else if (!parse_wav(p, &frames) && !parse_aiff(p, &frames)) {
+	/* Leave it to libsndfile */
+	munmap(p->map, p->map_size);
+	close(p->fd);
+	free(p);
+	return FALSE;
+    }
+    p->framesize = p->fmt.bytes * p->fmt.channels;
+    p->last_start = 0;
+    p->advised_from = p->advised_to = 0;
+
+    af->filename = filename;
+    af->pcm = p;
+    af->sample_rate = p->fmt.sample_rate;
+    af->channels = p->fmt.channels;
+    af->frames = frames;
+
+    return TRUE;
+}
+
+/* Little- and big-endian integers in file headers */
+#define LE16(b) ((b)[0] | (b)[1] << 8)
+#define LE32(b) ((uint32_t)(b)[0] | (uint32_t)(b)[1] << 8 | \
+		 (uint32_t)(b)[2] << 16 | (uint32_t)(b)[3] << 24)
+#define BE16(b) ((b)[0] << 8 | (b)[1])
+#define BE32(b) ((uint32_t)(b)[0] << 24 | (uint32_t)(b)[1] << 16 | \
+		 (uint32_t)(b)[2] << 8 | (uint32_t)(b)[3])
+
+/* Parse a RIFF WAVE header. Returns FALSE if we can't read it. */
+static bool
+parse_wav(struct pcmfile *p, off_t *frames)
+{
+    unsigned char *end = p->map + p->map_size;
+    unsigned char *chunk;
+    bool have_fmt = FALSE;
+    int format = 0, bits = 0, block_align = 0;
+
+    if (p->map_size < 12 || memcmp(p->map, "RIFF", 4) != 0 ||
+	memcmp(p->map + 8, "WAVE", 4) != 0)
+	return FALSE;
+
+    for (chunk = p->map + 12; end - chunk >= 8;
+	 chunk += 8 + LE32(chunk + 4) + (LE32(chunk + 4) & 1)) {
+	uint32_t size = LE32(chunk + 4);
+	unsigned char *body = chunk + 8;
+
+	if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16 && end - body >= 16) {
+	    format = LE16(body);
+	    p->fmt.channels = LE16(body + 2);
+	    p->fmt.sample_rate = LE32(body + 4);
+	    block_align = LE16(body + 12);
+	    bits = LE16(body + 14);
+	    /* WAVE_FORMAT_EXTENSIBLE has the real format in its GUID */
+	    if (format == 0xFFFE && size >= 40 && end - body >= 40)
+		format = LE16(body + 24);
+	    have_fmt = TRUE;
+	} else if (memcmp(chunk, "data", 4) == 0 && have_fmt) {
+	    p->fmt.big_endian = FALSE;
+	    switch (format) {
+	    case 1:	/* Integer PCM */
+		switch (bits) {
+		case 8:  p->fmt.type = PCM_U8;  break;
+		case 16: p->fmt.type = PCM_S16; break;
+		case 24: p->fmt.type = PCM_S24; break;
+		case 32: p->fmt.type = PCM_S32; break;
+		default: return FALSE;
+		}
+		break;
+	    case 3:	/* IEEE float */
+		switch (bits) {
+		case 32: p->fmt.type = PCM_F32; break;
+		case 64: p->fmt.type = PCM_F64; break;
+		default: return FALSE;
+		}
+		break;
+	    default:	/* Compressed */
+		return FALSE;
+	    }
+	    p->fmt.bytes = bits / 8;
+	    if (p->fmt.channels < 1 || p->fmt.sample_rate <= 0 ||
+		block_align != p->fmt.bytes * p->fmt.channels)
+		return FALSE;
+
+	    /* Streamed WAVs can have a size of 0 or 0xFFFFFFFF */
+	    if (size == 0 || size > (uint32_t)(end - body)) size = end - body;
+	    p->data = body;
+	    *frames = size / block_align;
+	    return TRUE;
+	}
+	if (size > (uint32_t)(end - body)) break;
+    }
+    return FALSE;
+}
+
+/* Convert an 80-bit IEEE 754 extended-precision number to a double */
+static double
+extended_to_double(const unsigned char *b)
+{
+    int exponent = ((b[0] & 0x7F) << 8) | b[1];
+    uint64_t mantissa = (uint64_t) BE32(b + 2) << 32 | BE32(b + 6);
+    double value;
+
+    if (exponent == 0 && mantissa == 0) return 0.0;
+    value = ldexp((double) mantissa, exponent - 16383 - 63);
+    return (b[0] & 0x80) ? -value : value;
+}
+
+/* Parse an AIFF or uncompressed AIFF-C header */
+static bool
+parse_aiff(struct pcmfile *p, off_t *frames)
+{
+    unsigned char *end = p->map + p->map_size;
+    unsigned char *chunk;
+    bool aifc;
+    bool have_comm = FALSE;
+    int bits = 0;
+    off_t nframes = 0;
+
+    if (p->map_size < 12 || memcmp(p->map, "FORM", 4) != 0)
+	return FALSE;
+    if (memcmp(p->map + 8, "AIFF", 4) == 0) aifc = FALSE;
+    else if (memcmp(p->map + 8, "AIFC", 4) == 0) aifc = TRUE;
+    else return FALSE;
+
+    for (chunk = p->map + 12; end - chunk >= 8;
+	 chunk += 8 + BE32(chunk + 4) + (BE32(chunk + 4) & 1)) {
+	uint32_t size = BE32(chunk + 4);
+	unsigned char *body = chunk + 8;
+
+	if (memcmp(chunk, "COMM", 4) == 0 && size >= 18 && end - body >= 18) {
+	    p->fmt.channels = BE16(body);
+	    nframes = BE32(body + 2);
+	    bits = BE16(body + 6);
+	    p->fmt.sample_rate = extended_to_double(body + 8);
+	    p->fmt.big_endian = TRUE;
+	    switch (bits) {
+	    case 8:  p->fmt.type = PCM_S8;  break;
+	    case 16: p->fmt.type = PCM_S16; break;
+	    case 24: p->fmt.type = PCM_S24; break;
+	    case 32: p->fmt.type = PCM_S32; break;
+	    default: return FALSE;
+	    }
+	    if (aifc) {
+		if (size < 22 || end - body < 22) return FALSE;
+		if (memcmp(body + 18, "NONE", 4) == 0) {
+		    ;
+		} else if (memcmp(body + 18, "sowt", 4) == 0) {
+		    p->fmt.big_endian = FALSE;
+		} else if (memcmp(body + 18, "fl32", 4) == 0 ||
+			   memcmp(body + 18, "FL32", 4) == 0) {
+		    p->fmt.type = PCM_F32; bits = 32;
+		} else if (memcmp(body + 18, "fl64", 4) == 0 ||
+			   memcmp(body + 18, "FL64", 4) == 0) {
+		    p->fmt.type = PCM_F64; bits = 64;
+		} else {
+		    return FALSE;	/* Compressed */
+		}
+	    }
+	    p->fmt.bytes = bits / 8;
+	    have_comm = TRUE;
+	} else if (memcmp(chunk, "SSND", 4) == 0 && have_comm && size >= 8) {
+	    unsigned char *data = body + 8 + BE32(body);
+	    off_t available;
+
+	    if (p->fmt.channels < 1 || p->fmt.sample_rate <= 0 || data > end)
+		return FALSE;
+	    p->data = data;
+	    available = (end - data) / (p->fmt.bytes * p->fmt.channels);
+	    *frames = MIN(nframes, available);
+	    return TRUE;
+	}
+	if (size > (uint32_t)(end - body)) break;
+    }
+    return FALSE;
+}
+
+/*
+ * Ask the kernel to read ahead of where we are reading in the direction
+ * we seem to be going. We ask for twice as much as we need so as not to
+ * make a system call for every read.
+ */
+static void
+read_ahead(audio_file_t *af, off_t start, off_t end)
+{
+    struct pcmfile *p = af->pcm;
+    off_t ahead = llrint(READAHEAD_SECONDS * p->fmt.sample_rate);
+    off_t from, to;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    uintptr_t addr_from, addr_to;
+
+    if (start >= p->last_start) {
+	if (end + ahead <= p->advised_to) goto done;
+	from = end; to = end + 2 * ahead;
+    } else {
+	if (start - ahead >= p->advised_from) goto done;
+	from = start - 2 * ahead; to = start;
+    }
+    if (from < 0) from = 0;
+    if (to > af->frames) to = af->frames;
+    if (from >= to) goto done;
+
+    addr_from = (uintptr_t) (p->data + from * p->framesize) & ~(pagesize - 1);
+    addr_to = (uintptr_t) (p->data + to * p->framesize);
+    (void) madvise((void *) addr_from, addr_to - addr_from, MADV_WILLNEED);
+    p->advised_from = from;
+    p->advised_to = to;
+done:
+    p->last_start = start;
+}
+
+/*
+ * Read sample frames from the mapping as mono floats (af_float, channels==1),
+ * as one plane of floats per channel (af_float, channels>1) or as 16-bit
+ * samples with the file's number of channels (af_signed).
+ * Frames before the start or after the end of the file read as silence.
+ * Returns the number of frames written, which is always frames_to_read.
+ */
+off_t
+pcmfile_read_frames(audio_file_t *af, void *write_to,
+		    af_format_t format, int channels,
+		    off_t start, off_t frames_to_read)
+{
+    struct pcmfile *p = af->pcm;
+    off_t first = MAX(start, 0);	/* The part that's in the file */
+    off_t last = MIN(start + frames_to_read, af->frames);
+    off_t before = MIN(first - start, frames_to_read); /* Leading silence */
+    off_t n = last > first ? last - first : 0;
+    off_t after = frames_to_read - before - n;	    /* Trailing silence */
+    unsigned char *in = p->data + first * p->framesize;
+
+    if (format == af_signed) {
+	short *sp = (short *) write_to;
+	size_t samples_per_frame = p->fmt.channels;
+
+	memset(sp, 0, before * samples_per_frame * sizeof(short));
+	sp += before * samples_per_frame;
+	pcm_to_shorts(in, sp, n * samples_per_frame, &p->fmt);
+	sp += n * samples_per_frame;
+	memset(sp, 0, after * samples_per_frame * sizeof(short));
+    } else {
+	int plane;
+
+	for (plane = (channels > 1 ? 0 : -1); plane < channels; plane++) {
+	    float *fp = (float *) write_to + (plane < 0 ? 0 : plane * frames_to_read);
+
+	    memset(fp, 0, before * sizeof(float));
+	    fp += before;
+	    pcm_to_floats(in, fp, n, plane, &p->fmt);
+	    fp += n;
+	    memset(fp, 0, after * sizeof(float));
+	    if (plane < 0) break;
+	}
+    }
+
+    if (n > 0) read_ahead(af, first, last);
+
+    return frames_to_read;
+}
+
+void
+pcmfile_close(audio_file_t *af)
+{
+    struct pcmfile *p = af->pcm;
+
+    munmap(p->map, p->map_size);
+    close(p->fd);
+    free(p);
+    af->pcm = NULL;
+}
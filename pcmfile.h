@@ -0,0 +1,50 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * pcmfile.h: Declarations for pcmfile.c
+ */
+
+#ifndef PCMFILE_H
+
+#include "audio_file.h"
+
+/* The uncompressed sample formats we understand */
+typedef enum {
+    PCM_U8, PCM_S8, PCM_S16, PCM_S24, PCM_S32, PCM_F32, PCM_F64
+} pcm_type_t;
+
+typedef struct {
+    pcm_type_t type;
+    int bytes;			/* Bytes per sample */
+    bool big_endian;
+    int channels;
+    double sample_rate;
+} pcm_format_t;
+
+extern bool parse_raw_format(char *spec, pcm_format_t *fmt);
+extern void pcm_to_shorts(const unsigned char *in, short *out,
+			  size_t nsamples, const pcm_format_t *fmt);
+
+extern bool  pcmfile_open(audio_file_t *af, char *filename);
+extern off_t pcmfile_read_frames(audio_file_t *af, void *write_to,
+				 af_format_t format, int channels,
+				 off_t start, off_t frames_to_read);
+extern void  pcmfile_close(audio_file_t *af);
+
+#define PCMFILE_H
+#endif
@@ -0,0 +1,314 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * pool.c: Recycle the calc_t structures and the spectrum buffers that we
+ * allocate and free for every column we calculate.
+ *
+ * Both are carved out of big slabs obtained from Malloc() and, when freed,
+ * go onto free lists to be handed out again, so that malloc() doesn't appear
+ * in the profile and long sessions don't fragment the heap.
+ * Spectrum buffers are kept in a separate free list for each speclen.
+ *
+ * calc_t slabs are never given back: that pool stays at its high-water
+ * mark, which is a few screenfuls of results. Spectrum slabs, which are
+ * much bigger, are given back when all their buffers are free.
+ *
+ * They are called from the calculation threads as well as the main loop,
+ * so all access is under lock_pool().
+ *
+ * Slabs are allocated with the lock released because, under --max-memory,
+ * making room for them can free cached results back into the pool.
+ */
+
+#include "spettro.h"
+#include "pool.h"
+
+#include "lock.h"
+
+#include <string.h>	/* for memset() */
+
+/*
+ * calc_t structures, which are allocated CALCS_PER_SLAB at a time
+ * and are chained through their "next" field when they are free.
+ */
+#define CALCS_PER_SLAB 256
+
+static calc_t *free_calcs = NULL;
+
+/* Return a calc_t with all fields zeroed */
+calc_t *
+new_calc(void)
+{
+    calc_t *calc;
+
+    lock_pool();
+    while (free_calcs == NULL) {
+	size_t size = CALCS_PER_SLAB * sizeof(calc_t);
+	calc_t *slab;
+	int i;
+
+	unlock_pool();
+	if (!mem_room(MEM_WORK, size)) {
+	    /* Use whatever shedding gave back; if nothing, Tmalloc() dies */
+	    lock_pool();
+	    if (free_calcs != NULL) break;
+	    unlock_pool();
+	}
+	slab = Tmalloc(MEM_WORK, size);
+	lock_pool();
+
+	for (i = 0; i < CALCS_PER_SLAB - 1; i++)
+	    slab[i].next = &slab[i+1];
+	slab[CALCS_PER_SLAB - 1].next = free_calcs;
+	free_calcs = slab;
+    }
+    calc = free_calcs;
+    free_calcs = calc->next;
+    unlock_pool();
+
+    memset(calc, 0, sizeof(*calc));
+
+    return calc;
+}
+
+/* Return a calc_t to the pool, with its spectral data if it has any */
+void
+free_calc(calc_t *calc)
+{
+    if (calc->spec != NULL) free_spec(calc->spec);
+
+    lock_pool();
+    calc->next = free_calcs;
+    free_calcs = calc;
+    unlock_pool();
+}
+
+/*
+ * Spectrum buffers of speclen+1 floats, or of nspectra such arrays one after
+ * the other for the per-channel spectra.
+ *
+ * Each one is preceded by a header saying which slab it came from,
+ * so that free_spec() doesn't need to be told its size.
+ * The union with a double keeps the float data 8-byte aligned.
+ *
+ * Each slab keeps its own free list so that, when all its buffers are free,
+ * it can be given back. Each size class keeps a list of the slabs that have
+ * free buffers and holds on to one empty slab, so that a column freed and
+ * reallocated doesn't free and reallocate a whole slab; shed_spec_pool()
+ * gives back the empty ones too, which also drops classes no longer in use.
+ */
+typedef union spec_hdr {
+    struct {
+	union spec_hdr *next;	/* Next in the slab's free list */
+	struct spec_slab *slab;
+    } h;
+    double align;
+} spec_hdr_t;
+
+typedef struct spec_slab {
+    struct spec_class *class;
+    spec_hdr_t *free;		/* Free list of buffers in this slab */
+    int nfree;			/* How many buffers are on it */
+    int nbufs;			/* and how many the slab holds */
+    size_t bytes;		/* Size of the slab, for Tfree() */
+    struct spec_slab *prev, *next; /* In the class's list of slabs with
+				 * free buffers */
+} spec_slab_t;
+
+/* Size of a slab's header, keeping the buffers after it aligned */
+#define SLAB_HDR_SIZE ((sizeof(spec_slab_t) + sizeof(spec_hdr_t) - 1) \
+		       / sizeof(spec_hdr_t) * sizeof(spec_hdr_t))
+
+typedef struct spec_class {
+    int speclen;
+    int nspectra;
+    size_t size;		/* Bytes per buffer including the header */
+    spec_slab_t *avail;		/* Slabs that have free buffers */
+    int empty;			/* How many of them are entirely free */
+    int nslabs;			/* How many slabs it has in all */
+    int pending;		/* Threads making a slab for it, during which
+				 * shed_spec_pool() mustn't free it */
+    struct spec_class *next;	/* List of size classes */
+} spec_class_t;
+
+static spec_class_t *classes = NULL;
+
+/* Try to allocate about this many bytes of spectrum buffers at a time */
+#define SPEC_SLAB_SIZE (1024 * 1024)
+
+static void
+unlink_slab(spec_slab_t *s)
+{
+    spec_class_t *c = s->class;
+
+    if (s->prev) s->prev->next = s->next;
+    else c->avail = s->next;
+    if (s->next) s->next->prev = s->prev;
+}
+
+/*
+ * Return a spectrum buffer, or NULL if there isn't room for another slab
+ * under --max-memory, in which case the column will be calculated again
+ * when there is.
+ */
+float *
+new_spec(int speclen, int nspectra)
+{
+    spec_class_t *c;
+    spec_slab_t *s;
+    spec_hdr_t *hdr;
+
+    lock_pool();
+
+    /* There are only ever a few, for the FFT frequencies they've used */
+    for (c = classes;
+	 c != NULL && (c->speclen != speclen || c->nspectra != nspectra);
+	 c = c->next)
+	;
+    if (c == NULL) {
+	c = Malloc(sizeof(*c));
+	c->speclen = speclen;
+	c->nspectra = nspectra;
+	/* Round up to a multiple of the header size to keep alignment */
+	c->size = sizeof(spec_hdr_t) +
+		  ((speclen + 1) * nspectra * sizeof(float)
+		   + sizeof(spec_hdr_t) - 1)
+		  / sizeof(spec_hdr_t) * sizeof(spec_hdr_t);
+	c->avail = NULL;
+	c->empty = 0;
+	c->nslabs = 0;
+	c->pending = 0;
+	c->next = classes;
+	classes = c;
+    }
+
+    while (c->avail == NULL) {
+	int n = (SPEC_SLAB_SIZE - SLAB_HDR_SIZE) / c->size;
+	size_t bytes;
+	char *mem;
+	int i;
+
+	if (n < 1) n = 1;
+	bytes = SLAB_HDR_SIZE + n * c->size;
+	c->pending++;
+	unlock_pool();
+	if (!mem_room(MEM_RESULTS, bytes)) {
+	    /* Use whatever shedding gave back; if nothing, give up for now */
+	    lock_pool();
+	    c->pending--;
+	    if (c->avail != NULL) break;
+	    unlock_pool();
+	    return NULL;
+	}
+	/* Not Tmalloc(), which would die if another thread beat us to it */
+	mem = Malloc(bytes);
+	mem_account(MEM_RESULTS, (long) bytes);
+	lock_pool();
+	c->pending--;
+
+	s = (spec_slab_t *) mem;
+	s->class = c;
+	s->free = NULL;
+	for (i = 0; i < n; i++) {
+	    hdr = (spec_hdr_t *)(mem + SLAB_HDR_SIZE + i * c->size);
+	    hdr->h.slab = s;
+	    hdr->h.next = s->free;
+	    s->free = hdr;
+	}
+	s->nfree = s->nbufs = n;
+	s->bytes = bytes;
+	s->prev = NULL;
+	s->next = c->avail;
+	if (c->avail) c->avail->prev = s;
+	c->avail = s;
+	c->empty++;
+	c->nslabs++;
+    }
+    s = c->avail;
+    hdr = s->free;
+    s->free = hdr->h.next;
+    if (s->nfree-- == s->nbufs) c->empty--;
+    if (s->nfree == 0) unlink_slab(s);
+
+    unlock_pool();
+
+    return (float *)(hdr + 1);
+}
+
+void
+free_spec(float *spec)
+{
+    spec_hdr_t *hdr = (spec_hdr_t *)spec - 1;
+    spec_slab_t *s = hdr->h.slab;
+    spec_class_t *c = s->class;
+
+    lock_pool();
+    hdr->h.next = s->free;
+    s->free = hdr;
+    if (s->nfree++ == 0) {
+	/* It has free buffers again */
+	s->prev = NULL;
+	s->next = c->avail;
+	if (c->avail) c->avail->prev = s;
+	c->avail = s;
+    }
+    if (s->nfree == s->nbufs) {
+	if (c->empty > 0) {
+	    /* Keep one empty slab per class, give the rest back */
+	    unlink_slab(s);
+	    c->nslabs--;
+	    unlock_pool();
+	    Tfree(MEM_RESULTS, s, s->bytes);
+	    return;
+	}
+	c->empty++;
+    }
+    unlock_pool();
+}
+
+/*
+ * Memory shedder: give back all the empty spectrum slabs, including the
+ * ones kept in reserve, and forget size classes that have none left.
+ * It runs after the result cache's shedder has freed what it can.
+ */
+void
+shed_spec_pool(void)
+{
+    spec_class_t **cp;
+
+    lock_pool();
+    for (cp = &classes; *cp != NULL; ) {
+	spec_class_t *c = *cp;
+	spec_slab_t *s, *next;
+
+	for (s = c->avail; s != NULL; s = next) {
+	    next = s->next;
+	    if (s->nfree == s->nbufs) {
+		unlink_slab(s);
+		c->nslabs--;
+		Tfree(MEM_RESULTS, s, s->bytes);
+	    }
+	}
+	c->empty = 0;
+	if (c->nslabs == 0 && c->pending == 0) {
+	    *cp = c->next;
+	    free(c);
+	} else cp = &c->next;
+    }
+    unlock_pool();
+}
@@ -0,0 +1,34 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * pool.h: Declarations for pool.c
+ */
+
+#ifndef POOL_H
+
+#include "calc.h"
+
+extern calc_t *new_calc(void);
+extern void	free_calc(calc_t *calc);
+
+extern float  *new_spec(int speclen, int nspectra);
+extern void	free_spec(float *spec);
+extern void	shed_spec_pool(void);
+
+#define POOL_H
+#endif
@@ -0,0 +1,410 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * pyramid.c: A background-built pyramid of pooled columns, so that zoomed-out
+ * views of long recordings can be painted without doing an FFT for every
+ * column and without having all the visible audio in the audio cache.
+ *
+ * With --pyramid, a thread works through the whole audio file doing an FFT
+ * for every column at the starting ppsec, with the starting FFT frequency
+ * and window function, and pools them into columns that each cover 2^k of
+ * those, keeping the loudest value of each frequency bin and their average.
+ * Each level of the pyramid has columns twice as wide as the one below it,
+ * so time_zoom_by()'s halving of ppsec takes you up one level.
+ *
+ * We don't keep the bottom levels because they would be as big as the audio,
+ * and zoomed-in views are quick to calculate from live FFTs anyway;
+ * the first level we keep is the one with at most MAX_BASE_COLUMNS columns.
+ *
+ * The pooled spectra are kept as one byte per frequency bin, in half-dB
+ * steps, in an unlinked temporary file that is mmap()ed so that the system
+ * can page it in and out as the view moves around.
+ *
+ * Columns become usable as soon as they are done, from the start of the
+ * piece onwards; repaint_column() uses them when the display's parameters
+ * match those the pyramid was built with and falls back to live FFTs when not.
+ */
+
+#include "spettro.h"
+#include "pyramid.h"
+
+#include "audio_file.h"
+#include "convert.h"
+#include "lock.h"
+#include "scheduler.h"	/* for take_batch_slot() */
+#include "spectrum.h"
+#include "ui.h"
+
+#include <string.h>	/* for memset(), memmove() */
+#include <unistd.h>	/* for mkstemp(), unlink(), ftruncate(), close() */
+#include <sys/mman.h>	/* for mmap() */
+
+#if ECORE_MAIN
+#include <Ecore.h>
+#elif SDL_MAIN
+#include <SDL.h>
+#include <SDL_thread.h>
+#endif
+
+int use_pyramid = PYRAMID_OFF;
+
+#define MAX_BASE_COLUMNS 8192	/* Most columns in the first level we keep */
+#define MAX_LEVELS 32
+
+/* What the pyramid was built with. Level 0 would be at pyr_ppsec. */
+static double pyr_ppsec;
+static double pyr_fft_freq;
+static window_function_t pyr_window;
+static int pyr_speclen;
+static off_t pyr_columns;	/* How many columns the piece has at level 0 */
+
+static int base_level;		/* The first level we keep */
+static int n_levels;		/* How many levels we keep */
+static off_t level_columns[MAX_LEVELS];	/* Indexed by level - base_level */
+static off_t level_start[MAX_LEVELS];	/* Where each level starts, in columns
+					 * from the start of the file */
+/* How many columns of each level are ready? Written by the builder thread. */
+static volatile off_t level_done[MAX_LEVELS];
+
+static size_t column_size;	/* Max plane then mean plane of speclen+1 */
+static unsigned char *map = NULL; /* The mmap()ed pyramid file */
+static size_t map_size;
+static int map_fd = -1;
+
+/* Byte values to magnitudes */
+static float decode[256];
+
+static volatile bool quit_pyramid = FALSE;
+
+#if ECORE_MAIN
+static Ecore_Thread *builder = NULL;
+static void ecore_build_pyramid(void *data, Ecore_Thread *thread);
+#elif SDL_MAIN
+static SDL_Thread *builder = NULL;
+static int sdl_build_pyramid(void *data);
+#endif
+
+static void build_pyramid(audio_file_t *af);
+
+/*
+ * Magnitudes are divided by speclen, which makes a full-scale sine wave
+ * about 0dB whatever the FFT size, then stored in half-dB steps down to
+ * -127dB. 0 means silence.
+ */
+static unsigned char
+encode(float mag)
+{
+    long code;
+
+    if (mag <= 0.0) return 0;
+    code = lrint((20.0 * log10(mag / pyr_speclen) + 127.5) * 2);
+    if (code < 1) return 0;
+    if (code > 255) return 255;
+    return code;
+}
+
+static unsigned char *
+column_address(int level, off_t col)
+{
+    return map + (level_start[level - base_level] + col) * column_size;
+}
+
+void
+start_pyramid(audio_file_t *af)
+{
+    off_t n0;		/* How many columns at level 0 */
+    off_t columns = 0;	/* Total columns in the levels we keep */
+    int level;
+    char *tmpdir = getenv("TMPDIR");
+    char path[1024];
+
+    if (use_pyramid == PYRAMID_OFF) return;
+    if (af->live) {
+	fprintf(stderr, "The pyramid needs an audio file, not live input.\n");
+	return;
+    }
+
+    pyr_ppsec = ppsec;
+    pyr_fft_freq = fft_freq;
+    pyr_window = window_function;
+    pyr_speclen = fft_freq_to_speclen(fft_freq, current_sample_rate());
+    column_size = 2 * (pyr_speclen + 1);
+
+    n0 = pyr_columns = llrint(ceil(af->frames * ppsec / af->sample_rate)) + 1;
+    for (base_level = 1;
+	 (n0 >> base_level) + 1 > MAX_BASE_COLUMNS;
+	 base_level++)
+	;
+    /* Keep going up until a level only has one column */
+    for (n_levels = 0, level = base_level; n_levels < MAX_LEVELS; level++) {
+	off_t n = ((n0 - 1) >> level) + 1;	/* ceil(n0 / 2^level) */
+	level_columns[n_levels] = n;
+	level_start[n_levels] = columns;
+	level_done[n_levels] = 0;
+	columns += n;
+	n_levels++;
+	if (n == 1) break;
+    }
+
+    {
+	int k;
+	decode[0] = 0.0;
+	for (k = 1; k < 256; k++)
+	    decode[k] = pyr_speclen * pow(10.0, (k / 2.0 - 127.5) / 20.0);
+    }
+
+    /* Make the file to keep it in */
+    map_size = columns * column_size;
+    snprintf(path, sizeof(path), "%s/spettro-pyramid-XXXXXX",
+	     tmpdir ? tmpdir : "/tmp");
+    if ((map_fd = mkstemp(path)) < 0) {
+	fprintf(stderr, "Cannot create the pyramid file ");
+	perror(path);
+	return;
+    }
+    unlink(path);
+    if (ftruncate(map_fd, map_size) != 0 ||
+	(map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    map_fd, 0)) == MAP_FAILED) {
+	perror("Cannot map the pyramid file");
+	map = NULL;
+	close(map_fd); map_fd = -1;
+	return;
+    }
+
+    quit_pyramid = FALSE;
+#if ECORE_MAIN
+    builder = ecore_thread_run(ecore_build_pyramid, NULL, NULL, af);
+#elif SDL_MAIN
+    builder = SDL_CreateThread(sdl_build_pyramid,
+# if SDL2
+			       "pyramid",
+# endif
+			       af);
+#endif
+    if (builder == NULL) {
+	fprintf(stderr, "Cannot start the pyramid-building thread.\n");
+	stop_pyramid();
+    }
+}
+
+void
+stop_pyramid(void)
+{
+    quit_pyramid = TRUE;
+#if ECORE_MAIN
+    if (builder != NULL) {
+	ecore_thread_cancel(builder);
+	while (ecore_thread_active_get() > 0) usleep(100000);
+    }
+#elif SDL_MAIN
+    if (builder != NULL) SDL_WaitThread(builder, NULL);
+#endif
+    builder = NULL;
+
+    if (map != NULL) munmap(map, map_size);
+    map = NULL;
+    if (map_fd >= 0) close(map_fd);
+    map_fd = -1;
+}
+
+/*
+ * If the pyramid has the data for screen column pos_x, return it as a
+ * result for paint_column(), otherwise NULL.
+ * The result is overwritten by the next call and must not be cached.
+ */
+calc_t *
+pyramid_result(int pos_x)
+{
+    static calc_t result;
+    static float *spec = NULL;
+    static int spec_size = 0;
+    unsigned char *col;
+    int level;
+    off_t x;
+    int k;
+
+    if (map == NULL || show_channel >= 0 ||
+	fft_freq != pyr_fft_freq || window_function != pyr_window)
+	return NULL;
+
+    /* Are we zoomed out to one of the levels we keep? */
+    level = lrint(log2(pyr_ppsec / ppsec));
+    if (level < base_level || level >= base_level + n_levels ||
+	!DELTA_EQ(ldexp(ppsec, level), pyr_ppsec))
+	return NULL;
+
+    x = screen_column_to_piece_column(pos_x);
+    if (x < 0 || x >= level_done[level - base_level]) return NULL;
+
+    col = column_address(level, x);
+    if (use_pyramid == PYRAMID_MEAN) col += pyr_speclen + 1;
+
+    if (spec_size < pyr_speclen + 1) {
+	spec = Realloc(spec, (pyr_speclen + 1) * sizeof(*spec));
+	spec_size = pyr_speclen + 1;
+    }
+    for (k = 0; k <= pyr_speclen; k++) spec[k] = decode[col[k]];
+
+    result.frame = screen_column_to_frame(pos_x);
+    result.fft_freq = pyr_fft_freq;
+    result.window = pyr_window;
+    result.channels = 1;
+    result.spec = spec;
+
+    return &result;
+}
+
+#if ECORE_MAIN
+static void
+ecore_build_pyramid(void *data, Ecore_Thread *thread)
+{
+    build_pyramid((audio_file_t *) data);
+}
+#elif SDL_MAIN
+static int
+sdl_build_pyramid(void *data)
+{
+    build_pyramid((audio_file_t *) data);
+    return 0;
+}
+#endif
+
+/*
+ * Having finished column "col" of "level", if that completes a pair,
+ * make the column of the level above from them, and so on upward.
+ */
+static void
+pool_upward(int level, off_t col)
+{
+    while (level + 1 < base_level + n_levels) {
+	off_t n = level_columns[level - base_level];
+	unsigned char *a, *b, *out;
+	int k;
+
+	/* Wait for the second of a pair, unless it's the last one */
+	if (col % 2 == 0 && col != n - 1) return;
+
+	a = column_address(level, col & ~(off_t)1);
+	b = (col & 1) ? a + column_size : NULL;
+	out = column_address(level + 1, col / 2);
+
+	for (k = 0; k <= pyr_speclen; k++) {
+	    /* The loudest of the loudest */
+	    out[k] = (b != NULL && b[k] > a[k]) ? b[k] : a[k];
+	    /* and the average of the averages, in the linear domain */
+	    out[pyr_speclen + 1 + k] = (b == NULL) ? a[pyr_speclen + 1 + k]
+		: encode((decode[a[pyr_speclen + 1 + k]] +
+			  decode[b[pyr_speclen + 1 + k]]) / 2);
+	}
+
+	level_done[level + 1 - base_level] = col / 2 + 1;
+	level++;
+	col /= 2;
+    }
+}
+
+/* The body of the pyramid-building thread */
+static void
+build_pyramid(audio_file_t *main_af)
+{
+    audio_file_t *af;
+    int fftsize = pyr_speclen * 2;
+    spectrum *spec;
+    float *audio;		/* Sliding window of audio from the file */
+    off_t audio_start = 0;	/* Where it starts, in sample frames */
+    bool audio_valid = FALSE;
+    float *max, *sum;		/* The column being pooled */
+    off_t n0 = pyr_columns;
+    off_t col;
+
+    set_thread_role(ROLE_CALC);
+
+    af = dup_audio_file(main_af);
+    if (af == NULL) {
+	fprintf(stderr, "The pyramid thread cannot open %s\n",
+		main_af->filename);
+	return;
+    }
+    spec = create_spectrum(pyr_speclen, 1, pyr_window, 1);
+    if (spec == NULL) {
+	close_audio_file(af);
+	return;
+    }
+    audio = Malloc(fftsize * sizeof(*audio));
+    max = Malloc((pyr_speclen + 1) * sizeof(*max));
+    sum = Malloc((pyr_speclen + 1) * sizeof(*sum));
+
+    for (col = 0; col < level_columns[0] && !quit_pyramid; col++) {
+	off_t b;		/* Level-0 column */
+	int n = 0;	/* How many we have pooled */
+	unsigned char *out = column_address(base_level, col);
+	int k;
+
+	if (!take_batch_slot(&quit_pyramid)) break;
+	for (b = col << base_level;
+	     b < (col + 1) << base_level && b < n0 && !quit_pyramid;
+	     b++) {
+	    off_t start = llrint(b * af->sample_rate / pyr_ppsec) - fftsize/2;
+
+	    /* Keep the part of the audio we already have */
+	    if (audio_valid && start > audio_start &&
+		start < audio_start + fftsize) {
+		int keep = audio_start + fftsize - start;
+		memmove(audio, audio + (start - audio_start),
+			keep * sizeof(*audio));
+		read_audio_file(af, (char *) (audio + keep), af_float, 1,
+				start + keep, fftsize - keep);
+	    } else if (!audio_valid || start != audio_start) {
+		read_audio_file(af, (char *) audio, af_float, 1,
+				start, fftsize);
+	    }
+	    audio_start = start;
+	    audio_valid = TRUE;
+
+	    memcpy(spec->time_domain, audio, fftsize * sizeof(*audio));
+	    calc_magnitude_spectrum(spec);
+
+	    for (k = 0; k <= pyr_speclen; k++) {
+		float mag = spec->mag_spec[k];
+		if (n == 0) {
+		    max[k] = sum[k] = mag;
+		} else {
+		    if (mag > max[k]) max[k] = mag;
+		    sum[k] += mag;
+		}
+	    }
+	    n++;
+	}
+	give_batch_slot();
+	if (n == 0) break;
+
+	for (k = 0; k <= pyr_speclen; k++) {
+	    out[k] = encode(max[k]);
+	    out[pyr_speclen + 1 + k] = encode(sum[k] / n);
+	}
+	level_done[0] = col + 1;
+	pool_upward(base_level, col);
+    }
+
+    free(max);
+    free(sum);
+    free(audio);
+    destroy_spectrum(spec);
+    close_audio_file(af);
+}
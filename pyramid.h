@@ -0,0 +1,38 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * pyramid.h: Declarations for pyramid.c
+ */
+
+#ifndef PYRAMID_H
+
+#include "calc.h"
+
+/* Values for use_pyramid */
+#define PYRAMID_OFF	0
+#define PYRAMID_MAX	1	/* Show the loudest of the pooled columns */
+#define PYRAMID_MEAN	2	/* Show the average of the pooled columns */
+
+extern int use_pyramid;		/* Set by --pyramid and --pyramid-mean */
+
+extern void start_pyramid(audio_file_t *af);
+extern void stop_pyramid(void);
+extern calc_t *pyramid_result(int pos_x);
+
+#define PYRAMID_H
+#endif
@@ -25,9 +25,18 @@
  * event to the main loop, and that calls calc_notify() with the new result
  * and refreshes some column of the display.
  *
- * The list of pending columns to refresh is kept in time order.
+ * Pending work is kept in one list per priority class, each in time order.
+ * get_work() always hands out the most urgent class first, so a column
+ * that is on-screen never waits behind more than the jobs already running.
+ * Display work is classed as visible or lookahead by where its column is
+ * and is moved from one to the other as the display scrolls.
  *
- * The list can contain work that is no longer relevant, either because the
+ * Batch work, like building the pyramid or the fingerprint index, is done
+ * by threads of their own, which take a slot in the batch class for each
+ * piece of it. That class has no queue, only a quota of threads that
+ * leaves one free for the display.
+ *
+ * The lists can contain work that is no longer relevant, either because the
  * columns are no longer on-screen or because the calculation parameters
  * (fft_freq, window_function) have changed since it was scheduled.
  * We remove these while searching for new work in get_work().
@@ -40,11 +49,21 @@
 #include "audio_file.h"
 #include "cache.h"
 #include "calc.h"
+#include "col_features.h"
 #include "convert.h"
+#include "dump.h"
 #include "gui.h"
+#include "hud.h"
 #include "lock.h"
 #include "paint.h"
+#include "pool.h"
+#include "script.h"
+#include "startup.h"
+#include "stream.h"
 #include "ui.h"
+#include "video.h"
+
+#include <sys/time.h>	/* for gettimeofday() */
 
 #if 0
 #define DEBUG(...) fprintf(stderr, __VA_ARGS__)
@@ -60,7 +79,7 @@
 #include <unistd.h>		/* for usleep() */
 #include <Ecore.h>
 #elif SDL_MAIN
-#include <unistd.h>		/* for sysconf() */
+#include <unistd.h>		/* for sysconf() and usleep() */
 #include <errno.h>
 #include <string.h>		/* for strerror() */
 #include <pthread.h>
@@ -73,8 +92,33 @@ bool sdl_quit_threads = FALSE;	/* When true, calc threads should return */
 static void print_list(calc_t *list);
 static void clear_list(void);
 
-/* The list of moments to calculate */
-static calc_t *list = NULL;
+/* How long the calculation threads sleep when there's no work, in usecs.
+ * On live input, each column needs calculating as soon as its audio arrives.
+ */
+#define IDLE_SLEEP (current_audio_file()->live ? 2000 : 100000)
+
+/* The moments to calculate in each priority class, and how that class
+ * is doing. All are guarded by lock_list(). */
+typedef struct {
+    char *	name;
+    calc_t *	list;		/* Work to do, in time order */
+    int		running;	/* How many threads are doing its work */
+    int		max_threads;	/* and how many it may occupy at once */
+    double	latency;	/* Total secs from schedule() to result */
+    int		finished;	/* for this many jobs since the last look */
+} class_t;
+
+static class_t class[NUMBER_OF_PRIORITIES] = {
+    { "visible",     NULL, 0, 0, 0.0, 0 },
+    { "lookahead",   NULL, 0, 0, 0.0, 0 },
+    { "batch",       NULL, 0, 0, 0.0, 0 },
+};
+
+/* The first and last on-screen frames when the display work was last
+ * dealt into the visible and lookahead classes */
+static off_t classified_first = 0, classified_last = 0;
+static bool must_reclassify = TRUE;
+
 /* The list of moments that are currently being calculated */
 static calc_t *jobs = NULL;
 /* How many threads are busy calculating an FFT for us? */
@@ -119,7 +163,7 @@ start_scheduler(int nthreads)
     for (threads=0; threads < nthreads; threads++) {
 	thread[threads] = ecore_thread_feedback_run(
 				ecore_calc_heavy, ecore_calc_notify,
-				NULL, NULL, NULL, EINA_TRUE);
+				NULL, NULL, (void *)(long)threads, EINA_TRUE);
 	if (thread[threads] == NULL) {
 	    fprintf(stderr, "Can't start an FFT-calculating thread.\n");
 	    if (threads == 0) {
@@ -142,11 +186,11 @@ start_scheduler(int nthreads)
 	for (threads=0; threads < nthreads; threads++) {
 	    char name[16];
 	    sprintf(name, "calc%d", threads);
-	    thread[threads] = SDL_CreateThread(sdl_calc_heavy, NULL
+	    thread[threads] = SDL_CreateThread(sdl_calc_heavy,
 #if SDL2
-								   , NULL
+					       name,
 #endif
-									 );
+					       (void *)(long)threads);
 	    if (thread[threads] == NULL) {
 		fprintf(stderr, "Cannot create a calculation thread: %s\n",
 			SDL_GetError());
@@ -154,11 +198,19 @@ start_scheduler(int nthreads)
 		    /* Can't start the first thread: fatal */
 		    exit(1);
 		}
-		return;
+		break;
 	    }
 	}
     }
 #endif
+
+    /* Display work may use every thread, but batch work has to leave
+     * one free for whatever scrolls into view. */
+    class[PRI_VISIBLE].max_threads = threads;
+    class[PRI_LOOKAHEAD].max_threads = threads;
+    class[PRI_BATCH].max_threads = threads > 1 ? threads - 1 : 1;
+
+    hud_set_threads(threads);
 }
 
 /* The function called as the body of the FFT-calculation threads.
@@ -166,19 +218,40 @@ start_scheduler(int nthreads)
  * Get work from the scheduler, do it, call the result callback and repeat.
  * If get_work() returns NULL, there is nothing to do, so sleep a little.
  */
+
+/* With the HUD showing, tell it how long each thread worked or idled */
+static void
+time_calc(int me, bool working, struct timeval *since)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    hud_calc_time(me, (now.tv_sec - since->tv_sec) +
+		      (now.tv_usec - since->tv_usec) / 1000000.0, working);
+    *since = now;
+}
+
 #if ECORE_MAIN
 static void
 ecore_calc_heavy(void *data, Ecore_Thread *thread)
 {
+    int me = (long) data;	/* Which calc thread are we? */
+    struct timeval since;
+
+    set_thread_role(ROLE_CALC);
+    gettimeofday(&since, NULL);
+
     /* Loop until this thread is scheduled to be cancelled */
     while (ecore_thread_check(thread) == FALSE) {
 	calc_t *work = get_work();
 	if (work == NULL) {
-	    usleep((useconds_t)100000); /* Sleep for a tenth of a second */
+	    usleep((useconds_t)IDLE_SLEEP);
 	} else {
+	    if (show_hud) time_calc(me, FALSE, &since);
 	    work->thread = thread;
 	    calc(work);
 	}
+	if (show_hud) time_calc(me, work != NULL, &since);
     }
 }
 #elif SDL_MAIN
@@ -186,8 +259,14 @@ static int
 sdl_calc_heavy(void *data)
 {
     calc_t *work;
-    audio_file_t *af = open_audio_file(current_audio_file()->filename);
+    audio_file_t *af;
+    int me = (long) data;	/* Which calc thread are we? */
+    struct timeval since;
 
+    set_thread_role(ROLE_CALC);
+    gettimeofday(&since, NULL);
+
+    af = dup_audio_file(current_audio_file());
     if (af == NULL) {
 	fprintf(stderr, "thread cannot open %s\n",
 			current_audio_file()->filename);
@@ -197,11 +276,13 @@ sdl_calc_heavy(void *data)
     work = get_work();
     while (!sdl_quit_threads) {
 	if (work == NULL) {
-	    usleep((useconds_t)100000); /* No work: sleep for a tenth of a second */
+	    usleep((useconds_t)IDLE_SLEEP); /* No work: sleep for a while */
 	} else {
+	    if (show_hud) time_calc(me, FALSE, &since);
 	    work->af = af;
 	    calc(work);
 	}
+	if (show_hud) time_calc(me, work != NULL, &since);
         work = get_work();
     }
     close_audio_file(af);
@@ -254,12 +335,27 @@ stop_scheduler(void)
     clear_list();
 }
 
-/* Ask for an FFT to be queued for execution */
+/* Which class does display work for this frame belong in? */
+static priority_t
+display_priority(off_t frame)
+{
+    return (frame < screen_column_to_frame(min_x) ||
+	    frame > screen_column_to_frame(max_x)) ? PRI_LOOKAHEAD
+						   : PRI_VISIBLE;
+}
+
+/* Ask for an FFT for the display to be queued for execution.
+ * It goes in the list for its class in time order. */
 void
 schedule(calc_t *calc)
 {
-    /* Add it to the list in time order */
+    class_t *cl;
     calc_t **cpp;	/* Pointer to the "next" field of the previous cell */
+    priority_t pri;
+
+    calc->af = current_audio_file();
+    calc->priority = display_priority(calc->frame);
+    cl = &class[calc->priority];
 
     /* Is this column's calculation already scheduled or already being performed?
      * This happens a lot, when several scrolls happen before the newly
@@ -268,42 +364,40 @@ schedule(calc_t *calc)
      * so check that first (its list is also shorter).
      */
 
-    calc->af = current_audio_file();
-
     lock_list();
-    if (is_in_list(calc, jobs) || is_in_list(calc, list)) {
-	unlock_list();
-	free(calc);
-	return;
-    }
+    if (is_in_list(calc, jobs)) goto drop;
+    for (pri = 0; pri < PRI_BATCH; pri++)
+	if (is_in_list(calc, class[pri].list)) goto drop;
     unlock_list();
 
     /* Do we already have a result for this calculation in the cache? */
-    if (recall_result(calc->t, fft_freq, calc->window)) {
-	fprintf(stderr, "scheduler drops calculation already in cache for %g/%g/%c\n",
-		calc->t, calc->fft_freq, window_key(calc->window));
-	free(calc);
+    if (recall_result(calc->frame, calc->fft_freq, calc->window)) {
+	fprintf(stderr, "scheduler drops calculation already in cache for %lld/%g/%c\n",
+		(long long) calc->frame, calc->fft_freq, window_key(calc->window));
+	free_calc(calc);
 	return;
     }
 
+    if (show_hud) gettimeofday(&calc->queued, NULL);
+    else calc->queued.tv_sec = 0;
+
     lock_list();
 
-DEBUG("Scheduling %g/%g/%c... ", calc->t, calc->fft_freq,
-      window_key(calc->window));
-    if (list == NULL) {
-DEBUG("Adding to empty list:\n");
-	list = calc;
-	calc->next = NULL;
-	print_list(list);
-	unlock_list();
-	return;
-    }
+    /* If the display has moved since the lists were last sorted out,
+     * this was classed differently from them, so make sure they are
+     * sorted again even if the display moves back. */
+    if (screen_column_to_frame(min_x) != classified_first ||
+	screen_column_to_frame(max_x) != classified_last)
+	must_reclassify = TRUE;
+
+DEBUG("Scheduling %lld/%g/%c as %s... ", (long long) calc->frame,
+      calc->fft_freq, window_key(calc->window), cl->name);
 
     /* To keep the list in time order, skip over all pending calculations
      * that are earlier than the new one.
      */
-    for (cpp = &list;
-	 *cpp != NULL && DELTA_LT((*cpp)->t, calc->t);
+    for (cpp = &cl->list;
+	 *cpp != NULL && (*cpp)->frame < calc->frame;
 	 cpp = &((*cpp)->next))
 	;
 
@@ -317,14 +411,14 @@ DEBUG("Adding at end of list\n");
 	calc->next = NULL;
 	*cpp = calc;
     } else /* If a duplicate in time, replace the existing one */
-    if (DELTA_EQ((*cpp)->t, calc->t)) {
-DEBUG("Replacing existing item %g/%g/%c  with new %g/%g/%c\n",
-      (*cpp)->t, (*cpp)->fft_freq, window_key((*cpp)->window),
-      (*cpp)->t,   calc->fft_freq, window_key(  calc->window));
+    if ((*cpp)->frame == calc->frame) {
+DEBUG("Replacing existing item %lld/%g/%c  with new %lld/%g/%c\n",
+      (long long) (*cpp)->frame, (*cpp)->fft_freq, window_key((*cpp)->window),
+      (long long) (*cpp)->frame,   calc->fft_freq, window_key(  calc->window));
 	    calc_t *cp = *cpp;
 	    calc->next = (*cpp)->next;
 	    *cpp = calc;
-	    free(cp);
+	    free_calc(cp);
     } else {
 DEBUG("Adding before later item\n");
 	/* Add it before the one that is later than it.
@@ -334,8 +428,13 @@ DEBUG("Adding before later item\n");
 	*cpp = calc;
     }
 
-    print_list(list);
+    print_list(cl->list);
+    unlock_list();
+    return;
+
+drop:
     unlock_list();
+    free_calc(calc);
 }
 
 /* Are the results for this calculation already being worked on by
@@ -347,13 +446,28 @@ is_in_list(calc_t *calc, calc_t *l)
     calc_t *cp;
 
     for (cp = l; cp != NULL; cp = cp->next) {
-	if (DELTA_EQ(calc->t, cp->t) &&
+	if (calc->frame == cp->frame &&
 	    calc->fft_freq == cp->fft_freq &&
-	    calc->window   == cp->window) return TRUE;
+	    calc->window   == cp->window &&
+	    calc->channels == cp->channels) return TRUE;
     }
     return FALSE;
 }
 
+/* Free all the work in a list */
+static void
+free_list(calc_t **lp)
+{
+    calc_t *cp = *lp;
+
+    while (cp != NULL) {
+	calc_t *new_cp = cp->next;
+	free_calc(cp);
+	cp = new_cp;
+    }
+    *lp = NULL;
+}
+
 /*
  * When they change the FFT size or the window function, forget all work
  * scheduled for the old ones.
@@ -363,16 +477,21 @@ is_in_list(calc_t *calc, calc_t *l)
 void
 drop_all_work()
 {
-    calc_t *cp;
+    priority_t pri;
 
     lock_list();
-    cp = list;
-    while (cp != NULL) {
-	calc_t *new_cp = cp->next;
-	free(cp);
-	cp = new_cp;
-    }
-    list = NULL;
+    for (pri = 0; pri < PRI_BATCH; pri++)
+	free_list(&class[pri].list);
+    unlock_list();
+}
+
+/* When memory is short, drop the queued work for columns that aren't
+ * on-screen, which was only scheduled in case they scroll there */
+void
+shed_work()
+{
+    lock_list();
+    free_list(&class[PRI_LOOKAHEAD].list);
     unlock_list();
 }
 
@@ -380,114 +499,202 @@ drop_all_work()
 bool
 there_is_work()
 {
-    return list != NULL;
+    priority_t pri;
+
+    for (pri = 0; pri < PRI_BATCH; pri++)
+	if (class[pri].list != NULL) return TRUE;
+    return FALSE;
 }
 
-/* The FFT threads ask here for the next FFT to perform
- *
- * Give them the earliest one that is on-screen, so that the screen
- * repaints from left to right.
- */
-static void put_work_in_flight(calc_t **cpp);
+/* How many calculations are waiting for a thread to do them? */
+int
+queued_jobs()
+{
+    int queued = 0;
+    priority_t pri;
+    calc_t *cp;
 
-calc_t *
-get_work()
+    lock_list();
+    for (pri = 0; pri < PRI_BATCH; pri++)
+	for (cp = class[pri].list; cp != NULL; cp = cp->next)
+	    queued++;
+    unlock_list();
+
+    return queued;
+}
+
+/* How many calculation threads have nothing to do, and won't be given
+ * anything from the queue? */
+int
+idle_threads()
 {
-    /* We will need to remove the most interesting element from the list
-     * so again we keep a pointer to the "next" field of the previous cell.
-     */
-    calc_t **cpp;
+    int idle;
+    priority_t pri;
+    calc_t *cp;
 
     lock_list();
+    /* Threads doing batch work of their own are using CPUs too */
+    idle = threads - jobs_in_flight - class[PRI_BATCH].running;
+    for (pri = 0; pri < PRI_BATCH && idle > 0; pri++)
+	for (cp = class[pri].list; cp != NULL && idle > 0; cp = cp->next)
+	    idle--;
+    unlock_list();
 
-DEBUG("Getting work... ");
+    return idle > 0 ? idle : 0;
+}
 
-    if (list == NULL) {
-DEBUG("List is empty\r");
-	unlock_list();
-	return NULL;
-    }
+/* For the HUD: How many jobs of a class are queued and running,
+ * and their mean time from schedule() to result since the last call,
+ * or -1.0 if none have finished.
+ */
+void
+scheduler_stats(priority_t pri, int *queued, int *running, double *latency)
+{
+    calc_t *cp;
 
-    /* First, drop any list items that are off the left side of the screen,
-     * but keep the same amount of lookahead off the left side of the screen
-     * so that the region exposed by scrolling left with <- is precalculated.
-     */
-    {
-	double earliest = screen_column_to_start_time(min_x - LOOKAHEAD);
+    lock_list();
+    *queued = 0;
+    for (cp = class[pri].list; cp != NULL; cp = cp->next)
+	(*queued)++;
+    *running = class[pri].running;
+    *latency = class[pri].finished > 0
+	       ? class[pri].latency / class[pri].finished : -1.0;
+    class[pri].latency = 0.0;
+    class[pri].finished = 0;
+    unlock_list();
+}
 
-	while (list != NULL && DELTA_LT(list->t, earliest)) {
-	    calc_t *old_cp = list;
-	    old_cp = list;	/* Remember cell to free */
-	    list = list->next;
-	    free(old_cp);
+/*
+ * As the display moves, columns move between visible and lookahead.
+ * Merge the two lists and deal their work out again, dropping whatever
+ * has gone beyond the lookahead.
+ */
+static void
+reclassify()
+{
+    off_t first = screen_column_to_frame(min_x);
+    off_t last = screen_column_to_frame(max_x);
+    off_t earliest = screen_column_to_frame(min_x - LOOKAHEAD);
+    off_t latest = screen_column_to_frame(max_x + LOOKAHEAD);
+    calc_t *v = class[PRI_VISIBLE].list;
+    calc_t *l = class[PRI_LOOKAHEAD].list;
+    calc_t **vpp = &class[PRI_VISIBLE].list;
+    calc_t **lpp = &class[PRI_LOOKAHEAD].list;
+
+    if (!must_reclassify &&
+	first == classified_first && last == classified_last) return;
+    classified_first = first; classified_last = last;
+    must_reclassify = FALSE;
+
+    while (v != NULL || l != NULL) {
+	calc_t *cp;
+
+	if (l == NULL || (v != NULL && v->frame < l->frame)) {
+	    cp = v; v = v->next;
+	} else {
+	    cp = l; l = l->next;
 	}
-    }
 
-    if (list == NULL) {
-DEBUG("List is empty after dropping before-screens\r");
-	unlock_list();
-	return NULL;
+	if (cp->frame < earliest || cp->frame > latest) {
+	    free_calc(cp);
+	} else if (cp->frame < first || cp->frame > last) {
+	    cp->priority = PRI_LOOKAHEAD;
+	    *lpp = cp; lpp = &(cp->next);
+	} else {
+	    cp->priority = PRI_VISIBLE;
+	    *vpp = cp; vpp = &(cp->next);
+	}
     }
+    *vpp = NULL;
+    *lpp = NULL;
+}
+
+/* Take the earliest job from a class that can be done now, optionally
+ * only from those between two frames.
+ * Display work whose parameters have changed since it was scheduled is
+ * dropped on the way. That never happens, I guess because of calls to
+ * drop_all_work() when the params change.
+ */
+static void put_work_in_flight(calc_t **cpp);
+
+static calc_t *
+take_work(priority_t pri, bool bounded, off_t from, off_t to)
+{
+    calc_t **cpp = &class[pri].list;
 
-    /* Refresh the screen left-to-right, then the off-screen lookahead */
-    cpp = &list;
     while (*cpp != NULL) {
 	calc_t *cp = *cpp;	/* Proto return value, the cell we detach */
 
-	/* If the work is not in the area of interest, drop it.
-	 * The first condition happens due to look-behind,
-	 * the second when scrolling left.
-	 */
-	if (DELTA_LT(cp->t, screen_column_to_start_time(min_x - LOOKAHEAD)) ||
-	    DELTA_GT(cp->t, screen_column_to_start_time(max_x + LOOKAHEAD))) {
-	    *cpp = cp->next;
-	    free(cp);
-	    continue;
+	if (bounded) {
+	    if (cp->frame > to) break;
+	    if (cp->frame < from) {
+		cpp = &(cp->next);
+		continue;
+	    }
 	}
 
-	/* If UI settings changed since the work was scheduled,
-	 * drop this calc and continue searching. This never happens,
-	 * I guess because of calls to drop_all_work() when the params change.
-	 */
 	if (DELTA_NE(cp->fft_freq, fft_freq) ||
-	    cp->window != window_function) {
+	    cp->window != window_function ||
+	    cp->channels != calc_channels()) {
 
 	    *cpp = cp->next;
-	    free(cp);
+	    free_calc(cp);
 	    continue;
 	}
 
+	/* On live input, this and all later columns must wait for
+	 * their audio to arrive */
+	if (cp->af->live && !stream_column_ready(cp->frame, cp->fft_freq))
+	    break;
+
 	put_work_in_flight(cpp);
-	unlock_list();
 	return cp;
     }
+    return NULL;
+}
 
-    /* Then the pre-screen look-behind. */
-    cpp = &list;
-    while (*cpp != NULL &&
-    	   DELTA_LT((*cpp)->t, screen_column_to_start_time(min_x))) {
-	calc_t *cp = *cpp;	/* Proto return value, the cell we detach */
+/* The FFT threads ask here for the next FFT to perform
+ *
+ * Give them the earliest one that is on-screen, so that the screen
+ * repaints from left to right, then the lookahead off the right,
+ * which is where we are usually going, then the look-behind off the left
+ * so that the region exposed by scrolling left with <- is precalculated.
+ */
+calc_t *
+get_work()
+{
+    calc_t *cp = NULL;
+    priority_t pri;
 
-	/* If UI settings changed since the work was scheduled,
-	 * drop this calc and continue searching.
-	 */
-	if (DELTA_NE(cp->fft_freq, fft_freq) ||
-	    cp->window != window_function) {
+    lock_list();
 
-	    *cpp = cp->next;
-	    free(cp);
-	    continue;
-	}
+DEBUG("Getting work... ");
 
-	put_work_in_flight(cpp);
-	unlock_list();
-	return cp;
+    reclassify();
+
+    for (pri = 0; pri < PRI_BATCH && cp == NULL; pri++) {
+	if (class[pri].list == NULL ||
+	    class[pri].running >= class[pri].max_threads) continue;
+
+	if (pri == PRI_LOOKAHEAD) {
+	    off_t first = screen_column_to_frame(min_x);
+	    off_t last = screen_column_to_frame(max_x);
+
+	    cp = take_work(pri, TRUE, last + 1,
+			   screen_column_to_frame(max_x + LOOKAHEAD));
+	    if (cp == NULL)
+		cp = take_work(pri, TRUE,
+			       screen_column_to_frame(min_x - LOOKAHEAD),
+			       first - 1);
+	} else {
+	    cp = take_work(pri, FALSE, 0, 0);
+	}
     }
 
-DEBUG("List is empty after all\r");
+if (cp == NULL) DEBUG("Nothing to do\r");
 
     unlock_list();
-    return NULL;
+    return cp;
 }
 
 /* Convenience function to avoid repetition:
@@ -498,8 +705,8 @@ put_work_in_flight(calc_t **cpp)
 {
     calc_t *cp = *cpp;
 
-DEBUG("Picked %g/%g/%c from list\n", cp->t, cp->fft_freq,
-      window_key(cp->window));
+DEBUG("Picked %lld/%g/%c from %s\n", (long long) cp->frame, cp->fft_freq,
+      window_key(cp->window), class[cp->priority].name);
 
     /* Detach the job from the list of jobs-to-do */
     *cpp = cp->next;
@@ -509,11 +716,14 @@ DEBUG("Picked %g/%g/%c from list\n", cp->t, cp->fft_freq,
     cp->next = jobs;
     jobs = cp;
     jobs_in_flight++;
+    class[cp->priority].running++;
 
-    print_list(list);
+    print_list(class[cp->priority].list);
 }
 
-/* Remove a job from the list of jobs in flight */
+/* Remove a job from the list of jobs in flight and free it.
+ * "result" may be the job itself or the result calculated from it.
+ */
 void
 remove_job(calc_t *result)
 {
@@ -522,40 +732,128 @@ remove_job(calc_t *result)
     lock_list();
     DEBUG("Removing from "); print_list(jobs);
     for (cpp = &jobs; *cpp != NULL; cpp = &((*cpp)->next)) {
-	if ((*cpp)->t        == result->t &&
+	if ((*cpp)->frame    == result->frame &&
 	    (*cpp)->fft_freq == result->fft_freq &&
-	    (*cpp)->window   == result->window) {
+	    (*cpp)->window   == result->window &&
+	    (*cpp)->channels == result->channels) {
 	    calc_t *cp;
+	    class_t *cl;
 
 	    cp = *cpp;
 	    *cpp = cp->next;
 	    jobs_in_flight--;
+	    cl = &class[cp->priority];
+	    cl->running--;
+	    if (cp->queued.tv_sec != 0) {
+		struct timeval now;
+
+		gettimeofday(&now, NULL);
+		cl->latency += (now.tv_sec - cp->queued.tv_sec) +
+			       (now.tv_usec - cp->queued.tv_usec) / 1000000.0;
+		cl->finished++;
+	    }
+	    free_calc(cp);
 	    goto got_it;
 	}
     }
-    fprintf(stderr, "Result for %g/%g/%c is not among the jobs in flight\n",
-	    result->t, result->fft_freq, window_key(result->window));
+    fprintf(stderr, "Result for %lld/%g/%c is not among the jobs in flight\n",
+	    (long long) result->frame, result->fft_freq, window_key(result->window));
 got_it:
     unlock_list();
 }
 
+/*
+ * The pyramid builder, the fingerprint indexer and the PNG writers do
+ * batch work in threads of their own. They take a slot in the batch class
+ * for each piece of it so that they keep to its quota and only use CPUs
+ * that the display work leaves idle.
+ * Returns FALSE, without a slot, if *quit became TRUE while it waited.
+ */
+#define BATCH_WAIT 20000	/* usecs */
+
+bool
+take_batch_slot(volatile bool *quit)
+{
+    class_t *cl = &class[PRI_BATCH];
+
+    for (;;) {
+	lock_list();
+	/* With no calc threads yet, there's nobody to share with */
+	if (threads == 0 ||
+	    (cl->running < cl->max_threads &&
+	     jobs_in_flight + cl->running < threads)) {
+	    cl->running++;
+	    unlock_list();
+	    return TRUE;
+	}
+	unlock_list();
+	if (quit != NULL && *quit) return FALSE;
+	usleep(BATCH_WAIT);
+    }
+}
+
+void
+give_batch_slot(void)
+{
+    lock_list();
+    class[PRI_BATCH].running--;
+    unlock_list();
+}
+
+/* Put a job in flight back on the list for its class, for when it couldn't
+ * be done for lack of memory. It goes back in time order like schedule(),
+ * which won't have queued a duplicate while it was in flight.
+ */
+void
+requeue_job(calc_t *calc)
+{
+    calc_t **cpp;
+
+    lock_list();
+    for (cpp = &jobs; *cpp != NULL && *cpp != calc; cpp = &((*cpp)->next))
+	;
+    if (*cpp == NULL) {
+	fprintf(stderr, "Job for %lld/%g/%c is not in flight\n",
+		(long long) calc->frame, calc->fft_freq, window_key(calc->window));
+	unlock_list();
+	return;
+    }
+    *cpp = calc->next;
+    jobs_in_flight--;
+    class[calc->priority].running--;
+
+    /* The thread may have replaced it with its own copy */
+    calc->af = current_audio_file();
+
+    for (cpp = &class[calc->priority].list;
+	 *cpp != NULL && (*cpp)->frame < calc->frame;
+	 cpp = &((*cpp)->next))
+	;
+    calc->next = *cpp;
+    *cpp = calc;
+    unlock_list();
+}
+
 /* When they zoom out on the frequency axis, we need to remove all the
  * scheduled calculations that no longer correspond to a pixel column.
  */
 void
 reschedule_for_bigger_secpp()
 {
+    priority_t pri;
     calc_t **cpp;
 
     lock_list();
 
-    for (cpp = &list; *cpp != NULL; /* see below */) {
-	/* If its time is no longer a multiple of the step, drop it */
-	if (DELTA_GT((*cpp)->t, floor((*cpp)->t / secpp) * secpp)) {
+    for (pri = 0; pri < PRI_BATCH; pri++)
+    for (cpp = &class[pri].list; *cpp != NULL; /* see below */) {
+	/* If its frame no longer falls on a pixel column, drop it */
+	off_t frame = (*cpp)->frame;
+	if (piece_column_to_frame(frame_to_piece_column(frame)) != frame) {
 	    calc_t *cp = *cpp;	/* Old cell to free */
-	    /* Rewrite "next" field of previous cell or the "list" pointer */
+	    /* Rewrite "next" field of previous cell or the list pointer */
 	    *cpp = cp->next;
-	    free(cp);
+	    free_calc(cp);
 	    /* and *cpp is already the next cell to examine */
 	} else {
 	    cpp = &((*cpp)->next);	/* loop reinitialization */
@@ -570,10 +868,10 @@ print_list(calc_t *l)
 {
     calc_t *cp;
 
-DEBUG(l == list ? "List:" : "Jobs:");
+DEBUG(l == jobs ? "Jobs:" : "List:");
 if (l == jobs) DEBUG(" [%d]", jobs_in_flight);
     for (cp = l; cp != NULL; cp=cp->next) {
-	DEBUG(" %g/%g", cp->t, cp->fft_freq);
+	DEBUG(" %lld/%g", (long long) cp->frame, cp->fft_freq);
 	if (cp->window != window_function)
 	    DEBUG("/%c", window_key(cp->window));
     }
@@ -583,11 +881,10 @@ DEBUG("\n");
 static void
 clear_list()
 {
-    calc_t *lp, *next;
+    priority_t pri;
 
-    for (lp = list; lp != NULL; next = lp->next, free(lp), lp = next)
-	;
-    list = NULL;
+    for (pri = 0; pri < PRI_BATCH; pri++)
+	free_list(&class[pri].list);
 }
 /*
  * The main loop has been notified of the arrival of a result. Process it.
@@ -601,6 +898,14 @@ calc_notify(calc_t *result)
     int pos_x;	/* Where would this column appear in the displayed region? */
 
     remove_job(result);
+    hud_column_done();
+
+    /* Results for the mono mix are no use when showing a single channel
+     * and vice versa; the cache is emptied when they switch. */
+    if (result->channels != calc_channels()) {
+	free_calc(result);
+	return;
+    }
 
     result = remember_result(result);
 
@@ -614,21 +919,36 @@ calc_notify(calc_t *result)
 	return;
     }
 
+    store_features(result);
+
     /* What screen coordinate does this result correspond to? */
-    pos_x = time_to_screen_column(result->t);
+    pos_x = frame_to_screen_column(result->frame);
 
     /* Update the display if the column is in the displayed region
-     * and isn't at the green line's position
+     * and the result is still for the frame that column starts at,
+     * which it won't be if they have zoomed in or out since.
      */
-    if (pos_x >= min_x && pos_x <= max_x) {
+    if (pos_x >= min_x && pos_x <= max_x &&
+	screen_column_to_frame(pos_x) == result->frame) {
 	paint_column(pos_x, min_y, max_y, result);
 	gui_update_column(pos_x);
+	startup_column_painted();
+	if (current_audio_file()->live)
+	    stream_painted(result->frame, result->fft_freq);
+    }
+
+    if (jobs_in_flight == 0 && !there_is_work()) {
+	script_work_done();
+	startup_work_done();
+	video_work_done();
     }
 
     /* We can output the PNG file for the -o option when all work is complete */
 
     if (output_file != NULL && jobs_in_flight == 0 && !there_is_work()) {
-	gui_output_png_file(output_file);
+	/* Columns painted before logmax last rose are too bright */
+	repaint_display(TRUE);
+	output_png_file(output_file);
 	gui_quit_main_loop();
 	return;
     }
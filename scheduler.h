@@ -26,12 +26,20 @@ extern void stop_scheduler(void);
 extern void schedule(calc_t *calc);
 extern bool there_is_work(void);
 extern void drop_all_work(void);
+extern void shed_work(void);
 extern calc_t *get_work(void);
 extern void reschedule_for_bigger_secpp(void);
 extern void calc_notify(calc_t *result);
 
 extern void remove_job(calc_t *result);
+extern void requeue_job(calc_t *calc);
+extern bool take_batch_slot(volatile bool *quit);
+extern void give_batch_slot(void);
 extern int jobs_in_flight;
+extern int idle_threads(void);
+extern int queued_jobs(void);
+extern void scheduler_stats(priority_t pri, int *queued, int *running,
+			    double *latency);
 
 #if SDL_MAIN
 extern bool sdl_quit_threads;
@@ -0,0 +1,272 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * script.c: Replay a script of key presses and mouse events, timing each
+ * step, to measure interactive performance reproducibly (--script file).
+ *
+ * Each line of the script is a command, optionally preceded by "@secs" to
+ * say that it mustn't happen until that many seconds after the script
+ * started. Blank lines and lines starting with # are ignored.
+ *
+ *	key [Shift-][Ctrl-]name	Press a key, named as in do_key.c: X, Left...
+ *	down x y [right]	Press the left (or right) mouse button at x,y
+ *	up x y [right]		and release it
+ *	move x y		Move the mouse to x,y
+ *	wait			Wait until all the FFTs have been done
+ *	sleep secs		Wait for a while
+ *	quit			Stop, as does the end of the script
+ *
+ * The script is run from the main loop, once per frame after the display
+ * has scrolled, and a key or mouse command ends the frame's commands.
+ *
+ * Each step is reported on stdout with when it started and how long it
+ * took. For keys and mouse events, that includes applying the pans and
+ * zooms they ask for and repainting the display, which would otherwise
+ * wait for the next frame; for "wait" it is how long until the last FFT
+ * result arrived.
+ * When the script ends, so does spettro.
+ */
+
+#include "spettro.h"
+#include "script.h"
+
+#include "do_key.h"
+#include "gui.h"		/* for gui_quit_main_loop() */
+#include "key.h"		/* for Shift and Ctrl */
+#include "mouse.h"
+#include "paint.h"		/* for update_view() */
+#include "scheduler.h"		/* for jobs_in_flight and there_is_work() */
+
+#include <string.h>
+#include <ctype.h>		/* for isspace() */
+#include <strings.h>		/* for strncasecmp() */
+#include <sys/time.h>		/* for gettimeofday() */
+
+char *script_file = NULL;
+
+static FILE *script = NULL;
+static int line_number = 0;
+static char line[256];		/* The next command, */
+static char *command;		/* the part of it after any @time */
+static double command_at;	/* and when it should happen */
+static bool have_command = FALSE;
+
+static double script_start;	/* When the script started, in Unix time */
+static double step_start;	/* When the current step started, in secs
+				 * since script_start */
+
+static enum {
+    NOT_WAITING, WAIT_FOR_WORK, WAIT_FOR_TIME
+} waiting = NOT_WAITING;
+static double wait_until;	/* For WAIT_FOR_TIME */
+static double work_done_at;	/* For WAIT_FOR_WORK, or -1 if not yet */
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0 - script_start;
+}
+
+/* Open the script and start the clock */
+void
+start_script()
+{
+    if (script_file == NULL) return;
+
+    if ((script = fopen(script_file, "r")) == NULL) {
+	fprintf(stderr, "Cannot open the script ");
+	perror(script_file);
+	exit(1);
+    }
+    script_start = 0.0;
+    script_start = now();
+    printf("#  start     secs  command\n");
+}
+
+static void
+report(double secs)
+{
+    printf("%8.3f %8.3f  %s\n", step_start, secs, command);
+}
+
+static void
+end_script(void)
+{
+    printf("%8.3f total\n", now());
+    fclose(script);
+    script = NULL;
+    gui_quit_main_loop();
+}
+
+/* Read the next command from the script. Returns FALSE at the end. */
+static bool
+read_command(void)
+{
+    while (fgets(line, sizeof(line), script) != NULL) {
+	char *cp = line + strlen(line);
+
+	line_number++;
+	while (cp > line && isspace(cp[-1])) *--cp = '\0';
+	for (cp = line; isspace(*cp); cp++)
+	    ;
+	if (*cp == '\0' || *cp == '#') continue;
+
+	command_at = 0.0;
+	if (*cp == '@') {
+	    command_at = strtod(cp + 1, &cp);
+	    while (isspace(*cp)) cp++;
+	}
+	command = cp;
+	return TRUE;
+    }
+    return FALSE;
+}
+
+/* Parse "[Shift-][Ctrl-]name" and press that key */
+static bool
+script_key(char *name)
+{
+    key_t key;
+
+    Shift = Ctrl = FALSE;
+    for (;;) {
+	if (strncasecmp(name, "Shift-", 6) == 0) {
+	    Shift = TRUE; name += 6;
+	} else if (strncasecmp(name, "Ctrl-", 5) == 0) {
+	    Ctrl = TRUE; name += 5;
+	} else break;
+    }
+    if ((key = key_by_name(name)) == KEY_NONE) return FALSE;
+    do_key(key);
+    return TRUE;
+}
+
+/* Do one command. Returns FALSE if it's not a valid command. */
+static bool
+do_command(double when)
+{
+    char verb[16], arg[64], button[16];
+    int x, y;
+    int n;
+
+    button[0] = '\0';
+    n = sscanf(command, "%15s %63s", verb, arg);
+    if (n < 1) return FALSE;
+
+    if (!strcmp(verb, "key") && n == 2) {
+	double before = now();
+
+	if (!script_key(arg)) return FALSE;
+	update_view();
+	report(now() - before);
+    } else if ((!strcmp(verb, "down") || !strcmp(verb, "up")) &&
+	       sscanf(command, "%*s %d %d %15s", &x, &y, button) >= 2) {
+	double before = now();
+
+	Shift = Ctrl = FALSE;
+	do_mouse_button(x, y,
+			strcmp(button, "right") ? LEFT_BUTTON : RIGHT_BUTTON,
+			verb[0] == 'd' ? MOUSE_DOWN : MOUSE_UP);
+	update_view();
+	report(now() - before);
+    } else if (!strcmp(verb, "move") &&
+	       sscanf(command, "%*s %d %d", &x, &y) == 2) {
+	double before = now();
+
+	do_mouse_move(x, y);
+	update_view();
+	report(now() - before);
+    } else if (!strcmp(verb, "wait") && n == 1) {
+	waiting = WAIT_FOR_WORK;
+	work_done_at = -1.0;
+    } else if (!strcmp(verb, "sleep") && n == 2) {
+	waiting = WAIT_FOR_TIME;
+	wait_until = when + atof(arg);
+    } else if (!strcmp(verb, "quit") && n == 1) {
+	report(0.0);
+	end_script();
+    } else {
+	return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Called by the scheduler when the last outstanding FFT result arrives,
+ * to get an exact time for the end of a "wait".
+ */
+void
+script_work_done()
+{
+    if (waiting == WAIT_FOR_WORK && work_done_at < 0.0)
+	work_done_at = now();
+}
+
+/* Called once per frame to do whatever commands are due */
+void
+run_script()
+{
+    double t;
+
+    if (script == NULL) return;
+    t = now();
+
+    for (;;) {
+	switch (waiting) {
+	case WAIT_FOR_WORK:
+	    if (work_done_at < 0.0) {
+		if (jobs_in_flight > 0 || there_is_work()) return;
+		/* There was nothing to do */
+		work_done_at = step_start;
+	    }
+	    report(work_done_at - step_start);
+	    break;
+	case WAIT_FOR_TIME:
+	    if (t < wait_until) return;
+	    report(t - step_start);
+	    break;
+	case NOT_WAITING:
+	    break;
+	}
+	waiting = NOT_WAITING;
+
+	if (!have_command) {
+	    if (!read_command()) {
+		end_script();
+		return;
+	    }
+	    have_command = TRUE;
+	}
+	if (command_at > t) return;
+	have_command = FALSE;
+
+	step_start = t;
+	if (!do_command(t)) {
+	    fprintf(stderr, "%s:%d: Unknown command \"%s\"\n",
+		    script_file, line_number, command);
+	    continue;
+	}
+	if (script == NULL) return;	/* "quit" */
+
+	/* Let a key or mouse command take effect before the next one */
+	if (waiting == NOT_WAITING) return;
+    }
+}
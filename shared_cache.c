@@ -0,0 +1,457 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * shared_cache.c - FFT results shared between spettros viewing the same file
+ *
+ * With --shared-cache, every spettro that a user runs on the same audio file
+ * maps the same POSIX shared memory segment, named after the user and the
+ * file's device, inode, size and modification time. Only that user may
+ * read or write it, since a spettro believes whatever it finds there. The calc threads look there before
+ * doing an FFT and publish each result they calculate, so a second viewer
+ * of a file gets the columns the first has already done.
+ *
+ * The segment is a header, a hash table of entries keyed like cache.c's
+ * results, and a ring of spectrum data. Nothing in it is locked:
+ *
+ * - Spectrum space is allocated by atomically advancing "head", the number
+ *   of bytes ever allocated, so the ring overwrites the oldest data.
+ *   A reader copies the spectrum out, then checks that head hasn't moved
+ *   so far on meanwhile that its data might have been overwritten.
+ * - Each entry has a reference count: readers increment it while they
+ *   copy the entry, and a publisher can only take an entry over by
+ *   changing its count from 0 to -1, which it sets back to 0 when the
+ *   entry is complete. An entry is only reused when nobody is reading it.
+ *
+ * The sizes of the parts are copied out of the header when we map it and
+ * are never read from the segment again, so a damaged header can't make us
+ * read or write outside the mapping.
+ *
+ * The last spettro to let go of a segment unlinks it, unless the name has
+ * meanwhile been given to a new segment, which it tells by the creation id
+ * in the header. If one crashes, the segment stays in /dev/shm and the next
+ * viewer of that file uses it.
+ */
+
+#include "spettro.h"
+#include "shared_cache.h"
+
+#include "convert.h"
+#include "pool.h"
+
+#include <errno.h>
+#include <fcntl.h>	/* for O_* */
+#include <string.h>	/* for memcpy(), strerror() */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>	/* for gettimeofday() */
+#include <unistd.h>	/* for ftruncate(), getuid(), getpid(), usleep() */
+
+size_t shared_cache_size = 0;	/* --shared-cache, 0 = don't share */
+
+#define SHARED_MAGIC	0x53505431	/* "SPT1" */
+#define SHARED_VERSION	2
+
+/* How many neighbouring entries a result may be stored in */
+#define PROBES 8
+
+/* Roughly how much spectrum data each hash table entry is for */
+#define BYTES_PER_ENTRY 4096
+
+typedef struct {
+    volatile int	refs;	/* Readers copying it, or -1 while being set */
+    volatile int	ready;	/* Does it hold a result? */
+    long long		frame;
+    double		fft_freq;
+    int			window;
+    int			channels;
+    int			speclen;
+    unsigned long long	offset;	/* Where its spectrum is in the ring */
+    features_t		features;
+} shared_entry_t;
+
+typedef struct {
+    volatile unsigned	magic;	/* Set last, when the rest is valid */
+    unsigned		version;
+    unsigned		nentries; /* A power of two */
+    volatile int	users;	/* How many spettros have it mapped */
+    unsigned long long	data_size;
+    volatile unsigned long long head; /* Bytes ever allocated in the ring */
+    unsigned long long	created; /* Tells this segment from a later one */
+} shared_header_t;
+
+static shared_header_t *header = NULL;	/* NULL if we're not sharing */
+static shared_entry_t *entries;
+static char *data;			/* The ring of spectra */
+static size_t mapped_size;
+static char name[64];			/* of the segment, for shm_unlink() */
+
+/* Our copies of the header's fields, checked against the mapping's size */
+static unsigned n_entries;		/* A power of two */
+static size_t ring_size;		/* Bytes of spectrum data */
+static unsigned long long created;
+
+static size_t
+segment_size(unsigned nentries, size_t data_size)
+{
+    return sizeof(shared_header_t) + nentries * sizeof(shared_entry_t)
+	   + data_size;
+}
+
+/* Find the segment's contents in a mapping */
+static void
+find_parts(void)
+{
+    entries = (shared_entry_t *)(header + 1);
+    data = (char *)(entries + n_entries);
+}
+
+/* Map a segment that another spettro created, waiting for it to be ready */
+static bool
+attach(int fd)
+{
+    struct stat st;
+    unsigned long long size;
+    int tries;
+
+    /* Someone else could have made one with our name and let us in */
+    if (fstat(fd, &st) != 0 || st.st_uid != getuid() ||
+	(st.st_mode & 077) != 0) {
+	fprintf(stderr, "Shared cache %s is not private to you\n", name);
+	return FALSE;
+    }
+
+    /* Its creator sizes it and then fills in the header */
+    for (tries = 0; ; tries++) {
+	if (fstat(fd, &st) != 0) return FALSE;
+	if (st.st_size >= sizeof(shared_header_t)) break;
+	if (tries == 100) return FALSE;
+	usleep(10000);
+    }
+    mapped_size = st.st_size;
+    header = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		  fd, 0);
+    if (header == MAP_FAILED) {
+	header = NULL;
+	return FALSE;
+    }
+    for (tries = 0; header->magic != SHARED_MAGIC; tries++) {
+	if (tries == 100) goto fail;
+	usleep(10000);
+    }
+    __sync_synchronize();
+    n_entries = header->nentries;
+    size = header->data_size;
+    ring_size = size;
+    created = header->created;
+    if (header->version != SHARED_VERSION ||
+	n_entries == 0 || (n_entries & (n_entries - 1)) != 0 ||
+	ring_size == 0 || ring_size != size ||
+	segment_size(n_entries, ring_size) != mapped_size)
+	goto fail;
+
+    find_parts();
+    return TRUE;
+
+fail:
+    munmap(header, mapped_size);
+    header = NULL;
+    return FALSE;
+}
+
+/* Make a new segment, of about shared_cache_size bytes */
+static bool
+create(int fd)
+{
+    unsigned nentries = 1024;
+    size_t data_size;
+
+    while (nentries * 2 < shared_cache_size / BYTES_PER_ENTRY)
+	nentries *= 2;
+    data_size = shared_cache_size - nentries * sizeof(shared_entry_t);
+    data_size &= ~(size_t)7;
+    if (shared_cache_size < nentries * sizeof(shared_entry_t) + 65536)
+	return FALSE;
+
+    mapped_size = segment_size(nentries, data_size);
+    if (ftruncate(fd, mapped_size) != 0) return FALSE;
+    header = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		  fd, 0);
+    if (header == MAP_FAILED) {
+	header = NULL;
+	return FALSE;
+    }
+
+    /* ftruncate() has zeroed it, so all entries are empty */
+    n_entries = nentries;
+    ring_size = data_size;
+    /* Different from any earlier segment of the same name */
+    {
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	created = ((unsigned long long) getpid() << 40) ^
+		  ((unsigned long long) now.tv_sec * 1000000 + now.tv_usec);
+    }
+    header->version = SHARED_VERSION;
+    header->nentries = nentries;
+    header->data_size = data_size;
+    header->head = 0;
+    header->users = 0;
+    header->created = created;
+    find_parts();
+    __sync_synchronize();
+    header->magic = SHARED_MAGIC;
+
+    return TRUE;
+}
+
+/* Start sharing results with other spettros viewing this audio file.
+ * Live input has nothing to share.
+ */
+void
+open_shared_cache(audio_file_t *af)
+{
+    struct stat st;
+    unsigned long long id = 14695981039346656037ULL;	/* FNV-1a */
+    unsigned long long fields[4];
+    int fd, i;
+    bool ok;
+
+    if (shared_cache_size == 0 || af->live) return;
+
+    if (stat(af->filename, &st) != 0) return;
+    fields[0] = st.st_dev;
+    fields[1] = st.st_ino;
+    fields[2] = st.st_size;
+    fields[3] = st.st_mtime;
+    for (i = 0; i < sizeof(fields); i++) {
+	id ^= ((unsigned char *)fields)[i];
+	id *= 1099511628211ULL;
+    }
+    sprintf(name, "/spettro-%u-%016llx", (unsigned) getuid(), id);
+
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0) {
+	ok = create(fd);
+	if (!ok) shm_unlink(name);
+    } else if (errno == EEXIST &&
+	       (fd = shm_open(name, O_RDWR, 0)) >= 0) {
+	ok = attach(fd);
+    } else {
+	fprintf(stderr, "Can't open shared cache %s: %s\n",
+		name, strerror(errno));
+	return;
+    }
+    close(fd);	/* The mapping stays */
+
+    if (!ok) {
+	fprintf(stderr, "Can't use shared cache %s; not sharing results\n",
+		name);
+	return;
+    }
+    __sync_fetch_and_add(&header->users, 1);
+}
+
+/* Is the segment that has our name now still the one we mapped? */
+static bool
+still_ours(void)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    shared_header_t *h;
+    struct stat st;
+    bool ours = FALSE;
+
+    if (fd < 0) return FALSE;
+    if (fstat(fd, &st) == 0 && st.st_size >= sizeof(*h) &&
+	(h = mmap(NULL, sizeof(*h), PROT_READ, MAP_SHARED, fd, 0))
+	    != MAP_FAILED) {
+	ours = h->magic == SHARED_MAGIC && h->created == created;
+	munmap(h, sizeof(*h));
+    }
+    close(fd);
+    return ours;
+}
+
+void
+close_shared_cache(void)
+{
+    if (header == NULL) return;
+
+    /* A spettro attaching right now will keep its mapping, but the next
+     * one will start a new segment */
+    if (__sync_sub_and_fetch(&header->users, 1) == 0 && still_ours())
+	shm_unlink(name);
+    munmap(header, mapped_size);
+    header = NULL;
+}
+
+/* Where in the table does a result's search start? */
+static unsigned
+entry_hash(off_t frame, double fftfreq, window_function_t window, int channels)
+{
+    unsigned long long h = (unsigned long long)frame * 0x9E3779B97F4A7C15ULL;
+
+    h ^= (unsigned long long)(fftfreq * 1000.0) * 0xC2B2AE3D27D4EB4FULL;
+    h ^= (window * 16 + channels) * 0x165667B19E3779F9ULL;
+    return (unsigned)(h >> 32) & (n_entries - 1);
+}
+
+static bool
+entry_is(shared_entry_t *e, off_t frame, double fftfreq,
+	 window_function_t window, int channels)
+{
+    return e->frame == frame && e->fft_freq == fftfreq &&
+	   e->window == window && e->channels == channels;
+}
+
+/* Has an entry's spectrum been overwritten by newer ones in the ring? */
+static bool
+overwritten(shared_entry_t *e)
+{
+    return header->head - e->offset > ring_size;
+}
+
+/* Copy between a buffer and the ring, which may wrap round */
+static void
+ring_copy(unsigned long long offset, void *buf, size_t bytes, bool to_ring)
+{
+    size_t pos = offset % ring_size;
+    size_t first = ring_size - pos;	/* Room before it wraps */
+
+    if (first > bytes) first = bytes;
+    if (to_ring) {
+	memcpy(data + pos, buf, first);
+	memcpy(data, (char *)buf + first, bytes - first);
+    } else {
+	memcpy(buf, data + pos, first);
+	memcpy((char *)buf + first, data, bytes - first);
+    }
+}
+
+/* If another spettro has published this calculation, return a copy of
+ * its result, as get_result() would have. Otherwise return NULL.
+ * Called by the calc threads.
+ */
+calc_t *
+shared_recall(calc_t *calc, int speclen)
+{
+    unsigned h;
+    int i;
+
+    /* shared_publish() doesn't store any bigger than this */
+    if (header == NULL ||
+	(speclen + 1) * calc->channels * sizeof(float) > ring_size / 4)
+	return NULL;
+
+    h = entry_hash(calc->frame, calc->fft_freq, calc->window, calc->channels);
+    for (i = 0; i < PROBES; i++) {
+	shared_entry_t *e = &entries[(h + i) & (n_entries - 1)];
+	calc_t *result = NULL;
+	int refs;
+
+	if (!e->ready || !entry_is(e, calc->frame, calc->fft_freq,
+				   calc->window, calc->channels))
+	    continue;
+
+	/* Hold it while we copy it, unless someone is rewriting it */
+	do {
+	    refs = e->refs;
+	} while (refs >= 0 &&
+		 !__sync_bool_compare_and_swap(&e->refs, refs, refs + 1));
+	if (refs < 0) continue;
+
+	/* Now it can't change. Was it rewritten before we got it?
+	 * A different FFT size calibration would give a different speclen. */
+	if (e->ready && e->speclen == speclen &&
+	    entry_is(e, calc->frame, calc->fft_freq, calc->window,
+		     calc->channels) &&
+	    !overwritten(e)) {
+	    result = new_calc();
+	    result->frame = calc->frame;
+	    result->fft_freq = calc->fft_freq;
+	    result->window = calc->window;
+	    result->channels = calc->channels;
+	    result->priority = calc->priority;
+	    result->features = e->features;
+	    result->spec = new_spec(speclen, calc->channels);
+	    if (result->spec == NULL) {
+		/* No room for it; calc() will have a go itself */
+		free_calc(result);
+		__sync_fetch_and_sub(&e->refs, 1);
+		return NULL;
+	    }
+	    ring_copy(e->offset, result->spec,
+		      (speclen + 1) * calc->channels * sizeof(float), FALSE);
+	    __sync_synchronize();
+	    if (overwritten(e)) {
+		free_calc(result);
+		result = NULL;
+	    }
+	}
+	__sync_fetch_and_sub(&e->refs, 1);
+
+	if (result != NULL) return result;
+    }
+    return NULL;
+}
+
+/* Offer a result we have calculated to the other spettros.
+ * If its entries are all busy, we just don't bother.
+ */
+void
+shared_publish(calc_t *result, int speclen)
+{
+    size_t bytes = (speclen + 1) * result->channels * sizeof(float);
+    shared_entry_t *victim = NULL;
+    unsigned h;
+    int i;
+
+    if (header == NULL || bytes > ring_size / 4) return;
+
+    /* Use an empty entry or one whose data is gone, or else the oldest */
+    h = entry_hash(result->frame, result->fft_freq, result->window,
+		   result->channels);
+    for (i = 0; i < PROBES; i++) {
+	shared_entry_t *e = &entries[(h + i) & (n_entries - 1)];
+
+	if (!e->ready || overwritten(e)) {
+	    if (victim == NULL || victim->ready) victim = e;
+	    continue;
+	}
+	if (entry_is(e, result->frame, result->fft_freq, result->window,
+		     result->channels))
+	    return;		/* Someone beat us to it */
+	if (victim == NULL || (victim->ready && e->offset < victim->offset))
+	    victim = e;
+    }
+    if (!__sync_bool_compare_and_swap(&victim->refs, 0, -1)) return;
+
+    victim->ready = FALSE;
+    victim->frame = result->frame;
+    victim->fft_freq = result->fft_freq;
+    victim->window = result->window;
+    victim->channels = result->channels;
+    victim->speclen = speclen;
+    victim->features = result->features;
+    victim->offset = __sync_fetch_and_add(&header->head,
+					  (unsigned long long)bytes);
+    ring_copy(victim->offset, result->spec, bytes, TRUE);
+    __sync_synchronize();
+    victim->ready = TRUE;
+    __sync_synchronize();
+    victim->refs = 0;
+}
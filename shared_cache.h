@@ -0,0 +1,35 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * shared_cache.h: Declarations for shared_cache.c
+ */
+
+#ifndef SHARED_CACHE_H
+
+#include "audio_file.h"
+#include "calc.h"
+
+extern size_t shared_cache_size;	/* --shared-cache, 0 = don't share */
+
+extern void    open_shared_cache(audio_file_t *af);
+extern void    close_shared_cache(void);
+extern calc_t *shared_recall(calc_t *calc, int speclen);
+extern void    shared_publish(calc_t *result, int speclen);
+
+#define SHARED_CACHE_H
+#endif
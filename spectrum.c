@@ -29,10 +29,17 @@
 #include "spettro.h"
 #include "window.h"
 #include "spectrum.h"
+#include "fft.h"
 #include "lock.h"
+#include "pool.h"
 
+/*
+ * nthreads is how many threads FFTW should use to do the transform,
+ * which is only worth it for very large ones.
+ */
 spectrum *
-create_spectrum (int speclen, window_function_t window_function)
+create_spectrum (int speclen, int nchannels, window_function_t window_function,
+		 int nthreads)
 {
     spectrum *spec;
 
@@ -40,17 +47,25 @@ create_spectrum (int speclen, window_function_t window_function)
 
     spec->wfunc = window_function;
     spec->speclen = speclen;
+    spec->nchannels = nchannels;
 
     /*
      * mag_spec has values from [0..speclen] inclusive for 0Hz to Nyquist.
      * time_domain has an extra element to be able to interpolate between
      * samples for better time precision, hoping to eliminate artifacts.
+     *
+     * With more than one channel, each of the three arrays holds
+     * one channel's data after the other, 2*speclen or speclen+1 apart.
      */
     lock_fftw3();
-    spec->time_domain	= fftwf_alloc_real(2 * speclen + 1);
-    spec->freq_domain	= fftwf_alloc_real(2 * speclen);
+    spec->time_domain	= fftwf_alloc_real(2 * speclen * nchannels + 1);
+    spec->freq_domain	= fftwf_alloc_real(2 * speclen * nchannels);
     unlock_fftw3();
-    spec->mag_spec	= Calloc(speclen + 1, sizeof(*spec->mag_spec));
+    if (spec->time_domain != NULL)
+	mem_account(MEM_FFT, (2 * speclen * nchannels + 1) * sizeof(float));
+    if (spec->freq_domain != NULL)
+	mem_account(MEM_FFT, (2 * speclen * nchannels) * sizeof(float));
+    spec->mag_spec	= new_spec(speclen, nchannels);
     spec->plan = NULL;
     if (spec->time_domain == NULL ||
 	spec->freq_domain == NULL ||
@@ -59,11 +74,12 @@ create_spectrum (int speclen, window_function_t window_function)
 	    return(NULL);
     }
 
-    lock_fftw3();
-    spec->plan = fftwf_plan_r2r_1d(2 * speclen,
-			    spec->time_domain, spec->freq_domain,
-			    FFTW_R2HC, FFTW_ESTIMATE /*| FFTW_PRESERVE_INPUT*/);
-    unlock_fftw3();
+    /* Use whichever backend calibration found fastest for this size */
+    spec->plan = fft_plan(fft_backend_for(speclen), 2 * speclen, nchannels,
+			  spec->time_domain, spec->freq_domain, nthreads);
+    if (spec->plan == NULL)
+	spec->plan = fft_plan(FFT_FFTW, 2 * speclen, nchannels,
+			      spec->time_domain, spec->freq_domain, nthreads);
 
     if (spec->plan == NULL) {
 	fprintf(stderr, "create_spectrum(): failed to create plan\n");
@@ -79,15 +95,21 @@ create_spectrum (int speclen, window_function_t window_function)
 void
 destroy_spectrum(spectrum *spec)
 {
+    fft_destroy(spec->plan);
     lock_fftw3();
-    if (spec->plan) {
-	fftwf_destroy_plan(spec->plan);
-    }
     fftwf_free(spec->time_domain);
     fftwf_free(spec->freq_domain);
     unlock_fftw3();
-    /* free(spec->window);	window may be in use by another calc thread */
-    free(spec->mag_spec);
+    if (spec->time_domain != NULL)
+	mem_account(MEM_FFT, -(long) ((2 * spec->speclen * spec->nchannels + 1)
+				      * sizeof(float)));
+    if (spec->freq_domain != NULL)
+	mem_account(MEM_FFT, -(long) ((2 * spec->speclen * spec->nchannels)
+				      * sizeof(float)));
+    /* The window may be in use by another calc thread */
+    if (spec->window)
+	release_window(spec->window, spec->wfunc, 2 * spec->speclen);
+    if (spec->mag_spec) free_spec(spec->mag_spec);
     free(spec);
 }
 
@@ -96,33 +118,42 @@ calc_magnitude_spectrum(spectrum *spec)
 {
     int k, freqlen;
     int speclen = spec->speclen;
+    int c;
 
     freqlen = 2 * speclen;
 
-    for (k = 0; k < 2 * speclen; k++)
-	spec->time_domain[k] *= spec->window[k];
+    for (c = 0; c < spec->nchannels; c++) {
+	float *time_domain = spec->time_domain + c * freqlen;
 
-    fftwf_execute(spec->plan);
+	for (k = 0; k < 2 * speclen; k++)
+	    time_domain[k] *= spec->window[k];
+    }
+
+    fft_execute(spec->plan);
 
     /*
      * Convert from FFTW's "half complex" format to an array of magnitudes.
      * In HC format, the values are stored:
      * r0, r1, r2 ... r(n/2), i(n+1)/2-1 .. i2, i1
      */
-
-    /* Add the DC offset at 0Hz */
-    spec->mag_spec[0] = fabsf(spec->freq_domain[0]);
-
-    for (k = 1; k < speclen; k++) {
-	float re = spec->freq_domain[k];
-	float im = spec->freq_domain[freqlen - k];
-	float mag = sqrtf(re * re + im * im);
-	spec->mag_spec[k] = mag;
-    }
-
-    /* Lastly add the point for the Nyquist frequency */
-    {
-	float mag = fabsf(spec->freq_domain[speclen]);
-	spec->mag_spec[speclen] = mag;
+    for (c = 0; c < spec->nchannels; c++) {
+	float *freq_domain = spec->freq_domain + c * freqlen;
+	float *mag_spec = spec->mag_spec + c * (speclen + 1);
+
+	/* Add the DC offset at 0Hz */
+	mag_spec[0] = fabsf(freq_domain[0]);
+
+	for (k = 1; k < speclen; k++) {
+	    float re = freq_domain[k];
+	    float im = freq_domain[freqlen - k];
+	    float mag = sqrtf(re * re + im * im);
+	    mag_spec[k] = mag;
+	}
+
+	/* Lastly add the point for the Nyquist frequency */
+	{
+	    float mag = fabsf(freq_domain[speclen]);
+	    mag_spec[speclen] = mag;
+	}
     }
 }
@@ -19,12 +19,13 @@
 
 #ifndef SPECTRUM_H
 
-#include <fftw3.h>	/* for fftw_plan */
+#include "fft.h"		/* for fft_plan_t */
 
 typedef struct
 {	int speclen;
+	int nchannels;		/* How many spectra to calculate at once */
 	window_function_t wfunc;
-	fftwf_plan plan;
+	fft_plan_t *plan;
 
 	float *time_domain;
 	float *window;
@@ -32,7 +33,9 @@ typedef struct
 	float *mag_spec;
 } spectrum;
 
-extern spectrum *create_spectrum(int speclen, window_function_t window_function);
+extern spectrum *create_spectrum(int speclen, int nchannels,
+				 window_function_t window_function,
+				 int nthreads);
 extern void destroy_spectrum(spectrum *spec);
 extern void calc_magnitude_spectrum(spectrum *spec);
 
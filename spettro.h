@@ -29,8 +29,6 @@
 #include <math.h>
 #include <assert.h>
 
-#include "alloc.h"
-
 typedef int bool;
 
 #ifndef FALSE
@@ -40,7 +38,10 @@ typedef int bool;
 # define TRUE 1
 #endif
 
+#include "alloc.h"
+
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
 
 /* Slop factor for comparisons involving calculated floating point values. */
 #define DELTA (1.0e-10)
@@ -0,0 +1,218 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * startup.c: Get the window up while the audio file is being opened.
+ *
+ * Opening the audio file can take a while, as mpg123_scan() reads the whole
+ * of some MP3s to find their length, and so can decoding the audio for the
+ * first screenful and making the FFT's window function. The window doesn't
+ * need any of them, so they are done in a thread of their own while main()
+ * opens the window and draws the frequency axes.
+ *
+ * With --startup-times, it reports how long it took to show the window,
+ * to open the file, to paint the first column and to fill the screen,
+ * then quits, to compare the startup time of different kinds of file.
+ */
+
+#include "spettro.h"
+#include "startup.h"
+
+#include "audio_file.h"
+#include "calc.h"		/* for calc_channels() */
+#include "convert.h"		/* for fft_freq_to_speclen() */
+#include "fft.h"		/* for calibrate_fft() */
+#include "gui.h"		/* for gui_quit_main_loop() */
+#include "lock.h"		/* for set_thread_role() */
+#include "spectrum.h"
+#include "stream.h"		/* for stream_capture and stream_format */
+#include "ui.h"
+
+#include <unistd.h>		/* for usleep() */
+#include <sys/time.h>		/* for gettimeofday() */
+
+#if ECORE_MAIN
+#include <Ecore.h>
+#elif SDL_MAIN
+#include <SDL.h>
+#include <SDL_thread.h>
+#endif
+
+bool startup_times = FALSE;	/* --startup-times */
+
+static char *open_filename;
+static audio_file_t *opened_af = NULL;
+static volatile bool opened = FALSE;	/* Has the thread finished? */
+#if ECORE_MAIN
+static Ecore_Thread *open_thread = NULL;
+#elif SDL_MAIN
+static SDL_Thread *open_thread = NULL;
+#endif
+
+static double started;		/* When start_opening() was called */
+static bool column_painted = FALSE;
+static bool screen_full = FALSE;
+
+static void open_file(void);
+#if ECORE_MAIN
+static void ecore_open_file(void *data, Ecore_Thread *thread);
+#elif SDL_MAIN
+static int sdl_open_file(void *data);
+#endif
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+report(const char *what)
+{
+    if (startup_times) printf("%-13s %6.3f secs\n", what, now() - started);
+}
+
+/*
+ * Start opening the audio file in the background. Called from main()
+ * before it initializes the GUI.
+ */
+void
+start_opening(char *filename)
+{
+    started = now();
+    open_filename = filename;
+
+    /* Live input is opened in finish_opening(), as SDL capture needs the
+     * GUI to have started SDL and there's nothing to decode in advance. */
+    if (stream_capture || stream_format != NULL) return;
+
+#if ECORE_MAIN
+    /* The GUI hasn't started Ecore yet */
+    ecore_init();
+    open_thread = ecore_thread_run(ecore_open_file, NULL, NULL, NULL);
+#elif SDL_MAIN
+    open_thread = SDL_CreateThread(sdl_open_file,
+# if SDL2
+				   "open",
+# endif
+				   NULL);
+#endif
+    /* If the thread didn't start, finish_opening() does it all */
+}
+
+#if ECORE_MAIN
+static void
+ecore_open_file(void *data, Ecore_Thread *thread)
+{
+    open_file();
+}
+#elif SDL_MAIN
+static int
+sdl_open_file(void *data)
+{
+    open_file();
+    return 0;
+}
+#endif
+
+/* Open the file, decode the audio for the first screenful, choose the
+ * FFT size and make the window and plan that the calc threads will need. */
+static void
+open_file(void)
+{
+    spectrum *spec;
+
+    set_thread_role(ROLE_CALC);
+
+    if ((opened_af = open_audio_file(open_filename)) == NULL) {
+	opened = TRUE;
+	return;
+    }
+
+    /* If they set disp_time with -t or --start, check that it's
+     * within the audio and make it coincide with the start of a column.
+     * This also fills the audio cache for the first screenful.
+     */
+    if (start_time > audio_file_length()) {
+	fprintf(stderr,
+		"Starting time (%g) is beyond the end of the audio (%g).\n",
+		start_time, audio_file_length());
+	set_disp_time(audio_file_length());
+    } else {
+	set_disp_time(start_time);
+    }
+
+    calibrate_fft(fft_freq, current_sample_rate());
+    spec = create_spectrum(fft_freq_to_speclen(fft_freq,
+					       current_sample_rate()),
+			   calc_channels(), window_function, 1);
+    if (spec != NULL) destroy_spectrum(spec);
+
+    opened = TRUE;
+}
+
+/*
+ * Wait for the audio file to be opened and return its handle,
+ * or NULL if it couldn't be opened.
+ */
+audio_file_t *
+finish_opening()
+{
+    if (open_thread == NULL) {
+	open_file();
+    } else {
+#if ECORE_MAIN
+	while (!opened) usleep(1000);
+	ecore_shutdown();
+#elif SDL_MAIN
+	SDL_WaitThread(open_thread, NULL);
+#endif
+	open_thread = NULL;
+    }
+    if (opened_af != NULL) report("File opened");
+
+    return opened_af;
+}
+
+/* The window is up, with its frequency axes */
+void
+startup_window_shown()
+{
+    report("Window shown");
+}
+
+/* A column of spectrogram has been painted */
+void
+startup_column_painted()
+{
+    if (column_painted) return;
+    column_painted = TRUE;
+    report("First column");
+}
+
+/* All the FFTs that were asked for are done */
+void
+startup_work_done()
+{
+    if (screen_full) return;
+    screen_full = TRUE;
+    report("Full screen");
+    if (startup_times) gui_quit_main_loop();
+}
@@ -0,0 +1,36 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * startup.h: Declarations for startup.c
+ */
+
+#ifndef STARTUP_H
+
+#include "audio_file.h"
+
+extern bool startup_times;	/* --startup-times: Report them and quit */
+
+extern void start_opening(char *filename);
+extern audio_file_t *finish_opening(void);
+
+extern void startup_window_shown(void);
+extern void startup_column_painted(void);
+extern void startup_work_done(void);
+
+#define STARTUP_H
+#endif
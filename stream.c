@@ -0,0 +1,461 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * stream.c - Read live audio from stdin, a FIFO or an SDL capture device.
+ *
+ * Raw PCM samples, in the format given by --raw, are converted to 16-bit
+ * native-endian shorts as they arrive and appended to a ring buffer that
+ * holds the last STREAM_SECONDS of audio. The audio file's length grows as
+ * they arrive, the display follows the newest audio and the scheduler
+ * computes each column as soon as the whole of its FFT window has arrived.
+ *
+ * We also measure the time from the arrival of a column's last sample to
+ * that column being painted, and report it when we quit.
+ */
+
+#include "spettro.h"
+#include "stream.h"
+
+#include "convert.h"	/* for fft_freq_to_speclen() */
+#include "lock.h"
+#include "pcmfile.h"	/* for parse_raw_format() and pcm_to_shorts() */
+#include "ui.h"		/* for fft_freq and fps */
+
+#include <string.h>	/* for memcpy(), memset(), memmove() */
+#include <errno.h>
+#include <fcntl.h>	/* for open() */
+#include <unistd.h>	/* for read() and close() */
+#include <poll.h>
+#include <sys/time.h>	/* for gettimeofday() */
+
+#if ECORE_MAIN
+#include <Ecore.h>
+#elif SDL_MAIN
+#include <SDL.h>
+#include <SDL_thread.h>
+#endif
+
+char *stream_format = NULL;
+bool stream_capture = FALSE;
+
+#define STREAM_SECONDS 60	/* How much of the live audio we keep */
+#define READ_FRAMES 4096	/* The most frames we read from the input at once */
+#define ARRIVALS 1024		/* How many arrival times we remember */
+#define CAPTURE_FORMAT "48000:1:s16"	/* For --capture without --raw */
+
+static struct {
+    audio_file_t *af;	/* The audio file that opened the stream */
+    int fd;		/* Where the raw PCM comes from; -1 when capturing */
+    pcm_format_t fmt;	/* The format of the raw samples */
+
+    short *ring;		/* The last ring_frames frames of audio */
+    off_t ring_frames;
+    off_t head;		/* How many frames have arrived, under lock_stream() */
+    volatile bool ended;	/* Has the input finished? */
+
+    /* When each block of audio arrived, to measure the latency */
+    struct {
+	off_t head;		/* The value of "head" after the block */
+	double when;		/* in seconds from the epoch */
+    } arrival[ARRIVALS];
+    unsigned narrivals;
+
+    /* Latency statistics */
+    off_t newest_painted;	/* The last frame of the newest column painted */
+    unsigned latencies;		/* How many columns we have measured */
+    unsigned late;		/* and how many took longer than two frames */
+    double total_latency, max_latency;
+} stream;
+static bool stream_is_open = FALSE;
+
+static volatile bool quit_stream = FALSE;
+
+#if ECORE_MAIN
+static Ecore_Thread *reader = NULL;
+static void ecore_read_stream(void *data, Ecore_Thread *thread);
+#elif SDL_MAIN
+static SDL_Thread *reader = NULL;
+static int sdl_read_stream(void *data);
+#endif
+
+#if SDL_AUDIO && SDL2
+static SDL_AudioDeviceID capture_device = 0;
+static void sdl_capture(void *userdata, Uint8 *data, int len);
+#endif
+
+static void read_stream(void);
+
+/* How many frames have arrived? An off_t may not be read in one go,
+ * so it needs the lock while the reader thread may be changing it. */
+static off_t
+stream_head(void)
+{
+    off_t head;
+
+    lock_stream();
+    head = stream.head;
+    unlock_stream();
+    return head;
+}
+
+/* Open the live input and start filling the ring buffer from it.
+ * The calculation threads open the audio file again, so later calls
+ * just share the stream that is already open.
+ * Returns FALSE on failure, having said why if errno won't.
+ */
+bool
+stream_open(audio_file_t *af, char *filename)
+{
+    if (stream_is_open) {
+	af->filename = filename;
+	af->sample_rate = stream.fmt.sample_rate;
+	af->channels = stream.fmt.channels;
+	af->frames = stream_head();
+	af->live = TRUE;
+	return TRUE;
+    }
+
+    if (!parse_raw_format(stream_format != NULL ? stream_format
+						: CAPTURE_FORMAT, &stream.fmt))
+	return FALSE;
+
+    if (stream_capture) {
+#if SDL_AUDIO && SDL2
+	SDL_AudioSpec want, have;
+
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+	    fprintf(stderr, "Couldn't initialize SDL audio: %s.\n",
+		    SDL_GetError());
+	    return FALSE;
+	}
+	SDL_zero(want);
+	want.freq = lrint(stream.fmt.sample_rate);
+	want.format = AUDIO_S16SYS;
+	want.channels = stream.fmt.channels;
+	want.samples = 512;	/* Small blocks, to keep the latency down */
+	want.callback = sdl_capture;
+	capture_device = SDL_OpenAudioDevice(NULL, 1, &want, &have,
+					     SDL_AUDIO_ALLOW_FREQUENCY_CHANGE |
+					     SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+	if (capture_device == 0) {
+	    fprintf(stderr, "Couldn't open the audio capture device: %s.\n",
+		    SDL_GetError());
+	    return FALSE;
+	}
+	/* It starts paused, so we can make the ring to suit first */
+	stream.fmt.sample_rate = have.freq;
+	stream.fmt.channels = have.channels;
+	stream.fd = -1;
+#else
+	fprintf(stderr, "Audio capture needs spettro to be built with SDL2.\n");
+	return FALSE;
+#endif
+    } else if (strcmp(filename, "-") == 0) {
+	stream.fd = 0;
+    } else if ((stream.fd = open(filename, O_RDONLY)) < 0) {
+	return FALSE;
+    }
+
+    stream.ring_frames = llrint(STREAM_SECONDS * stream.fmt.sample_rate);
+    stream.ring = Calloc(stream.ring_frames * stream.fmt.channels, sizeof(short));
+    stream.head = 0;
+    stream.ended = FALSE;
+    stream.narrivals = 0;
+    stream.newest_painted = 0;
+    stream.latencies = stream.late = 0;
+    stream.total_latency = stream.max_latency = 0.0;
+    stream.af = af;
+
+    af->filename = filename;
+    af->sample_rate = stream.fmt.sample_rate;
+    af->channels = stream.fmt.channels;
+    af->frames = 0;
+    af->live = TRUE;
+
+    stream_is_open = TRUE;
+    quit_stream = FALSE;
+
+#if SDL_AUDIO && SDL2
+    if (stream_capture) {
+	SDL_PauseAudioDevice(capture_device, 0);
+	return TRUE;
+    }
+#endif
+
+#if ECORE_MAIN
+    reader = ecore_thread_run(ecore_read_stream, NULL, NULL, NULL);
+#elif SDL_MAIN
+    reader = SDL_CreateThread(sdl_read_stream,
+# if SDL2
+			      "stream",
+# endif
+			      NULL);
+#endif
+    if (reader == NULL) {
+	fprintf(stderr, "Cannot start the thread to read the live input.\n");
+	stream_close(af);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+stream_close(audio_file_t *af)
+{
+    /* The calculation threads' copies don't own the stream */
+    if (!stream_is_open || af != stream.af) return;
+
+    quit_stream = TRUE;
+#if SDL_AUDIO && SDL2
+    if (capture_device != 0) SDL_CloseAudioDevice(capture_device);
+    capture_device = 0;
+#endif
+#if ECORE_MAIN
+    if (reader != NULL) {
+	ecore_thread_cancel(reader);
+	while (ecore_thread_active_get() > 0) usleep(100000);
+    }
+#elif SDL_MAIN
+    if (reader != NULL) SDL_WaitThread(reader, NULL);
+#endif
+    reader = NULL;
+
+    if (stream.fd > 0) close(stream.fd);
+    stream.fd = -1;
+    free(stream.ring);
+    stream.ring = NULL;
+    stream.af = NULL;
+    stream_is_open = FALSE;
+
+    if (stream.latencies > 0) {
+	fprintf(stderr, "Live latency: mean %.1fms, worst %.1fms; %u of %u columns took more than two frames.\n",
+		stream.total_latency / stream.latencies * 1000.0,
+		stream.max_latency * 1000.0,
+		stream.late, stream.latencies);
+    }
+}
+
+/* Add some frames of 16-bit audio to the ring buffer */
+static void
+append(short *shorts, off_t frames)
+{
+    struct timeval tv;
+
+    lock_stream();
+
+    while (frames > 0) {
+	off_t pos = stream.head % stream.ring_frames;
+	off_t n = MIN(frames, stream.ring_frames - pos);
+
+	memcpy(stream.ring + pos * stream.fmt.channels, shorts,
+	       n * stream.fmt.channels * sizeof(short));
+	shorts += n * stream.fmt.channels;
+	frames -= n;
+	stream.head += n;
+    }
+    stream.af->frames = stream.head;
+
+    if (gettimeofday(&tv, NULL) == 0) {
+	int i = stream.narrivals++ % ARRIVALS;
+
+	stream.arrival[i].head = stream.head;
+	stream.arrival[i].when = tv.tv_sec + tv.tv_usec * 0.000001;
+    }
+
+    unlock_stream();
+}
+
+#if ECORE_MAIN
+static void
+ecore_read_stream(void *data, Ecore_Thread *thread)
+{
+    read_stream();
+}
+#elif SDL_MAIN
+static int
+sdl_read_stream(void *data)
+{
+    read_stream();
+    return 0;
+}
+#endif
+
+/* The body of the thread that reads raw PCM from the input file */
+static void
+read_stream(void)
+{
+    size_t framesize = stream.fmt.bytes * stream.fmt.channels;
+    size_t bufsize = READ_FRAMES * framesize;
+    unsigned char *buf = Malloc(bufsize);
+    short *shorts = Malloc(READ_FRAMES * stream.fmt.channels * sizeof(short));
+    size_t have = 0;	/* How many bytes are in buf[] */
+
+    set_thread_role(ROLE_AUDIO);
+
+    while (!quit_stream) {
+	struct pollfd pfd;
+	ssize_t n;
+	size_t frames;
+
+	/* Wake up now and then to see whether we should quit */
+	pfd.fd = stream.fd;
+	pfd.events = POLLIN;
+	if ((n = poll(&pfd, 1, 100)) == 0 || (n < 0 && errno == EINTR))
+	    continue;
+
+	n = read(stream.fd, buf + have, bufsize - have);
+	if (n < 0 && errno == EINTR) continue;
+	if (n <= 0) {
+	    if (n < 0) perror("Cannot read the live input");
+	    break;
+	}
+	have += n;
+
+	frames = have / framesize;
+	if (frames == 0) continue;
+	pcm_to_shorts(buf, shorts, frames * stream.fmt.channels, &stream.fmt);
+	append(shorts, frames);
+
+	/* Keep any partial frame for next time */
+	have -= frames * framesize;
+	memmove(buf, buf + frames * framesize, have);
+    }
+    stream.ended = TRUE;
+
+    free(buf);
+    free(shorts);
+}
+
+#if SDL_AUDIO && SDL2
+/* SDL's audio capture callback, which gives us 16-bit native samples */
+static void
+sdl_capture(void *userdata, Uint8 *data, int len)
+{
+    set_thread_role(ROLE_AUDIO);
+    append((short *) data, len / (sizeof(short) * stream.fmt.channels));
+}
+#endif
+
+/*
+ * Fetch audio from the ring buffer as mono floats or as 16-bit samples with
+ * the stream's number of channels.
+ * Audio that has already fallen out of the ring reads as silence.
+ * Returns the number of frames written, which is short if some of them
+ * haven't arrived yet.
+ */
+off_t
+stream_read_frames(audio_file_t *af, void *write_to,
+		   off_t start, off_t frames_to_read, af_format_t format)
+{
+    int channels = stream.fmt.channels;
+    float *fp = (float *) write_to;
+    short *sp = (short *) write_to;
+    off_t tail;		/* The oldest frame still in the ring */
+    off_t written = 0;
+
+    lock_stream();
+
+    tail = stream.head - stream.ring_frames;
+    for (; frames_to_read > 0 && start < tail;
+	 frames_to_read--, start++, written++) {
+	if (format == af_float) {
+	    *fp++ = 0.0;
+	} else {
+	    memset(sp, 0, channels * sizeof(short));
+	    sp += channels;
+	}
+    }
+
+    if (start + frames_to_read > stream.head)
+	frames_to_read = stream.head > start ? stream.head - start : 0;
+
+    for (; frames_to_read > 0; frames_to_read--, start++, written++) {
+	short *in = stream.ring + (start % stream.ring_frames) * channels;
+
+	if (format == af_float) {
+	    int c, total = 0;
+
+	    for (c = 0; c < channels; c++) total += in[c];
+	    *fp++ = (float)total / (32768 * channels);
+	} else {
+	    memcpy(sp, in, channels * sizeof(short));
+	    sp += channels;
+	}
+    }
+
+    unlock_stream();
+
+    return written;
+}
+
+/* Has all the audio for an FFT centred on "frame" arrived? */
+bool
+stream_column_ready(off_t frame, double fft_freq)
+{
+    /* Its window ends speclen frames after the frame it is centred on */
+    return stream.ended ||
+	   frame + fft_freq_to_speclen(fft_freq, stream.fmt.sample_rate)
+	   <= stream_head();
+}
+
+/* Where should the display be to show the newest column we can calculate? */
+double
+stream_live_time(void)
+{
+    off_t frame = stream_head() - fft_freq_to_speclen(fft_freq, stream.fmt.sample_rate);
+
+    return frame < 0 ? 0.0 : frame / stream.fmt.sample_rate;
+}
+
+/*
+ * A column of the live input has been painted: see how long it took since
+ * the last of its audio arrived.
+ * Only the newest columns count, not ones repainted after scrolling back
+ * or changing the parameters.
+ */
+void
+stream_painted(off_t frame, double fft_freq)
+{
+    off_t last = frame + fft_freq_to_speclen(fft_freq, stream.fmt.sample_rate);
+    struct timeval tv;
+    double when = -1.0;	/* When its last frame arrived */
+    double latency;
+    unsigned i;
+
+    if (last <= stream.newest_painted || gettimeofday(&tv, NULL) != 0)
+	return;
+    stream.newest_painted = last;
+
+    /* Find the oldest block we remember whose arrival completed the column */
+    lock_stream();
+    for (i = stream.narrivals; i > 0 && stream.narrivals - i < ARRIVALS; i--) {
+	int k = (i - 1) % ARRIVALS;
+
+	if (stream.arrival[k].head < last) break;
+	when = stream.arrival[k].when;
+    }
+    unlock_stream();
+    if (when < 0.0) return;
+
+    latency = tv.tv_sec + tv.tv_usec * 0.000001 - when;
+    stream.latencies++;
+    stream.total_latency += latency;
+    if (latency > stream.max_latency) stream.max_latency = latency;
+    if (latency > 2.0 / fps) stream.late++;
+}
@@ -0,0 +1,40 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * stream.h: Declarations for stream.c
+ */
+
+#ifndef STREAM_H
+
+#include "audio_file.h"
+
+extern char *stream_format;	/* --raw's "rate:channels:format" or NULL */
+extern bool stream_capture;	/* --capture: Read from an SDL capture device */
+
+extern bool  stream_open(audio_file_t *af, char *filename);
+extern off_t stream_read_frames(audio_file_t *af, void *write_to,
+				off_t start, off_t frames_to_read,
+				af_format_t format);
+extern void  stream_close(audio_file_t *af);
+
+extern bool   stream_column_ready(off_t frame, double fft_freq);
+extern double stream_live_time(void);
+extern void   stream_painted(off_t frame, double fft_freq);
+
+#define STREAM_H
+#endif
@@ -22,6 +22,8 @@
 #include "spettro.h"
 #include "timer.h"
 #include "gui.h"
+#include "hud.h"		/* for hud_frame_missed() */
+#include "lock.h"		/* for set_thread_role() */
 #include "paint.h"		/* for do_scroll() */
 
 /* The timer and its callback function. */
@@ -162,6 +164,11 @@ bool scroll_event_pending = FALSE;
     timer_cb(Uint32 interval, void *data)
 #endif
 {
+#if SDL_TIMER
+    /* SDL calls us from its own timer thread */
+    set_thread_role(ROLE_TIMER);
+#endif
+
     /* To see if the timer is running, #define DEBUG 1 */
 #if DEBUG
     static char spinner[]="|/-\\";
@@ -176,6 +183,8 @@ bool scroll_event_pending = FALSE;
     if (!scroll_event_pending) {
 	ecore_event_add(scroll_event, NULL, NULL, NULL);
 	scroll_event_pending = TRUE;
+    } else {
+	hud_frame_missed();
     }
 
     return ECORE_CALLBACK_RENEW;
@@ -196,6 +205,8 @@ bool scroll_event_pending = FALSE;
 	} else {
 	    scroll_event_pending = TRUE;
 	}
+    } else {
+	hud_frame_missed();
     }
 
     return(interval);
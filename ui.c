@@ -56,6 +56,9 @@ double fft_freq	= DEFAULT_FFT_FREQ;
 /* Which window functions to apply to each audio sample before FFt-ing it */
 window_function_t window_function = DEFAULT_WINDOW_FUNCTION;
 
+/* Which channel of the audio to display, -1 for all mixed to mono */
+int show_channel = -1;
+
 /* The -t/--start time parameter */
 double start_time = 0.0;
 
@@ -57,6 +57,9 @@ extern double fft_freq;
 extern window_function_t window_function;
 #define DEFAULT_WINDOW_FUNCTION KAISER
 
+/* Which channel of the audio to display, -1 for all mixed to mono */
+extern int show_channel;
+
 /* The -t/--start time parameter */
 extern double start_time;
 
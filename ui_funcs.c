@@ -21,6 +21,11 @@
  * It's up to the caller to call repaint_display() to show any changes
  * except for time pans, which are always updated when the timer ticks and
  * frequency pans, which know more about what to redraw than the caller.
+ *
+ * Pans and zooms from the keyboard go through the request_*() functions,
+ * which just accumulate them, and apply_view_changes() applies the net
+ * change once per frame, so that holding a key down with auto-repeat
+ * doesn't scroll, repaint and schedule work for every intermediate view.
  */
 
 #include "spettro.h"
@@ -155,7 +160,8 @@ freq_pan_by(double by)
 
 #define MAX_RANGE DBL_MAX/2
 
-void
+/* Returns FALSE if the zoom was refused because it went too far */
+bool
 freq_zoom_by(double by)
 {
     /* We want to stay centred on the frequency at the middle of the screen
@@ -174,7 +180,7 @@ freq_zoom_by(double by)
      * loop */
     if (range > MAX_RANGE || !isfinite(range)) {
     	/* Silly zoom-out bursts the frequency axis. Refuse */
-	return;
+	return FALSE;
     }
 
     /* Convert center/range back to min/max */
@@ -186,11 +192,93 @@ freq_zoom_by(double by)
 	fprintf(stderr, "Zoom limit reached\n");
 	min_freq = old_min_freq;
 	max_freq = old_max_freq;
-	return;
+	return FALSE;
     }
 
     if (show_freq_axes) draw_freq_axes();
     if (show_time_axes) draw_status_line();
+    return TRUE;
+}
+
+/*
+ * Coalescing of pans and zooms
+ */
+
+static double pending_time_pan = 0.0;	/* Seconds to pan by */
+static double pending_time_zoom = 1.0;	/* Factors to pan and zoom by */
+static double pending_freq_pan = 1.0;
+static double pending_freq_zoom = 1.0;
+
+void
+request_time_pan_by(double by)
+{
+    pending_time_pan += by;
+}
+
+void
+request_time_zoom_by(double by)
+{
+    pending_time_zoom *= by;
+}
+
+void
+request_freq_pan_by(double by)
+{
+    pending_freq_pan *= by;
+}
+
+void
+request_freq_zoom_by(double by)
+{
+    pending_freq_zoom *= by;
+}
+
+/* Called from the timer, via the main loop, before it scrolls the screen */
+void
+apply_view_changes()
+{
+    double time_zoom = pending_time_zoom, time_pan = pending_time_pan;
+    double freq_zoom = pending_freq_zoom, freq_pan = pending_freq_pan;
+
+    pending_time_zoom = pending_freq_pan = pending_freq_zoom = 1.0;
+    pending_time_pan = 0.0;
+
+    /* Time pans are done by scroll() when it sees the new playing time */
+    if (time_pan != 0.0) time_pan_by(time_pan);
+
+    /* If several zooms together would go past a limit, do as many of them
+     * as fit, as they would have done one at a time. Their factors are
+     * powers of two except for Ctrl-Y's one-pixel zooms. */
+    while (time_zoom > 2.0 && ppsec * time_zoom > current_sample_rate())
+	time_zoom /= 2.0;
+
+    if (freq_zoom != 1.0 || (time_zoom != 1.0 && freq_pan != 1.0)) {
+	/* The whole display is to be repainted anyway, so no need to
+	 * scroll for the pan. The zoom is about the center frequency,
+	 * so it doesn't matter which we do first. */
+	min_freq *= freq_pan;
+	max_freq *= freq_pan;
+	if (freq_pan != 1.0) {
+	    if (show_freq_axes) draw_freq_axes();
+	    if (show_time_axes) draw_status_line();
+	}
+	freq_pan = 1.0;
+	while (freq_zoom != 1.0 && !freq_zoom_by(freq_zoom)) {
+	    if (freq_zoom > 2.0) freq_zoom /= 2.0;
+	    else if (freq_zoom < 0.5) freq_zoom *= 2.0;
+	    else break;
+	}
+    }
+    if (time_zoom != 1.0) time_zoom_by(time_zoom);
+
+    if (time_zoom != 1.0) {
+	repaint_display(FALSE);
+    } else if (freq_zoom != 1.0) {
+	repaint_display(TRUE);
+    } else if (freq_pan != 1.0) {
+	freq_pan_by(freq_pan);
+	gui_update_display();
+    }
 }
 
 /* Change the color scale's dynamic range, thereby changing the brightness
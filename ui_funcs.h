@@ -20,6 +20,13 @@
 extern void time_pan_by(double by);
 extern void time_zoom_by(double by);
 extern void freq_pan_by(double by);
-extern void freq_zoom_by(double by);
+extern bool freq_zoom_by(double by);
 extern void change_dyn_range(float by);
 extern void change_logmax(float by);
+
+/* Pans and zooms from key presses, accumulated until the next frame */
+extern void request_time_pan_by(double by);
+extern void request_time_zoom_by(double by);
+extern void request_freq_pan_by(double by);
+extern void request_freq_zoom_by(double by);
+extern void apply_view_changes(void);
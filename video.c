@@ -0,0 +1,188 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * video.c: Write the scrolling display as raw video, one frame every 1/fps
+ * seconds of audio from the starting time to the end of the piece
+ * (--video file).
+ *
+ * Instead of following the audio player, each frame scrolls the display
+ * on by 1/fps seconds with do_scroll() then waits until the FFT threads
+ * have finished all the columns it revealed, so it runs as fast as they
+ * can go. The frames include the green line, axes and overlays and are
+ * written in YUV4MPEG2 (4:4:4) or as raw 24-bit RGB for an encoder, e.g.
+ *	spettro --video - file.wav | ffmpeg -i - file.mp4
+ *	spettro --video - --video-format rgb file.wav |
+ *	    ffmpeg -f rawvideo -pix_fmt rgb24 -s 640x480 -r 25 -i - file.mp4
+ */
+
+#include "spettro.h"
+#include "video.h"
+
+#include "audio.h"		/* for set_playing_time() */
+#include "audio_file.h"
+#include "gui.h"
+#include "paint.h"		/* for do_scroll() */
+#include "scheduler.h"		/* for jobs_in_flight and there_is_work() */
+#include "ui.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>		/* for dup() */
+
+char *video_file = NULL;		/* --video */
+video_format_t video_format = VIDEO_Y4M;	/* --video-format */
+
+static FILE *video = NULL;
+static double first_time;	/* The audio time of the first frame */
+static double last_time;	/* and the last one */
+static double frame_time;	/* and the one on the screen now */
+static long frames;		/* How many we have written */
+static unsigned char *planes = NULL;	/* Frame buffer for Y4M's Y, U and V */
+
+static void stop_video(void);
+
+/*
+ * Open the output and write the stream header.
+ * Called from main() after the initial repaint has been scheduled.
+ */
+void
+start_video()
+{
+    if (video_file == NULL) return;
+
+    if (current_audio_file()->live) {
+	fprintf(stderr, "--video can't be used with live input.\n");
+	exit(1);
+    }
+
+    if (!strcmp(video_file, "-")) {
+	/* Keep stdout for the video and send our messages to stderr */
+	int fd = dup(1);
+
+	if (fd < 0 || dup2(2, 1) < 0 || (video = fdopen(fd, "wb")) == NULL) {
+	    fprintf(stderr, "Can't write video to stdout: %s\n",
+		    strerror(errno));
+	    exit(1);
+	}
+    } else if ((video = fopen(video_file, "wb")) == NULL) {
+	fprintf(stderr, "Can't create \"%s\": %s\n",
+		video_file, strerror(errno));
+	exit(1);
+    }
+
+    if (video_format == VIDEO_Y4M) {
+	fprintf(video, "YUV4MPEG2 W%d H%d F%ld:1000 Ip A1:1 C444\n",
+		disp_width, disp_height, lrint(fps * 1000));
+	planes = Malloc((size_t) disp_width * disp_height * 3);
+    }
+
+    /* We step through the audio ourselves instead of playing it */
+    autoplay = FALSE;
+    first_time = disp_time;
+    last_time = audio_file_length() - 1/current_sample_rate();
+    frame_time = first_time;
+    frames = 0;
+
+    /* In case there is nothing to calculate */
+    video_work_done();
+}
+
+/* Convert the snapshot, whose pixels are blue, green, red, unused,
+ * and write it to the video stream. Returns FALSE on failure. */
+static bool
+write_frame(unsigned char *pixels)
+{
+    size_t npixels = (size_t) disp_width * disp_height;
+    unsigned char *p = pixels;
+    size_t i;
+
+    if (video_format == VIDEO_Y4M) {
+	unsigned char *y = planes, *u = planes + npixels, *v = u + npixels;
+
+	/* ITU-R BT.601 studio range */
+	for (i = 0; i < npixels; i++, p += 4) {
+	    int r = p[2], g = p[1], b = p[0];
+
+	    y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+	    u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+	    v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+	}
+	return fputs("FRAME\n", video) != EOF &&
+	       fwrite(planes, npixels * 3, 1, video) == 1;
+    } else {
+	/* Convert it in place, as we don't need it again */
+	unsigned char *rgb = pixels;
+
+	for (i = 0; i < npixels; i++, p += 4, rgb += 3) {
+	    unsigned char blue = p[0];
+
+	    rgb[0] = p[2];
+	    rgb[1] = p[1];
+	    rgb[2] = blue;
+	}
+	return fwrite(pixels, npixels * 3, 1, video) == 1;
+    }
+}
+
+/*
+ * Called from the main loop when all the FFTs that were asked for are done:
+ * write the current frame and scroll on to the next until one of them
+ * needs some calculating.
+ */
+void
+video_work_done()
+{
+    if (video == NULL) return;
+
+    while (jobs_in_flight == 0 && !there_is_work()) {
+	unsigned char *pixels = gui_snapshot(TRUE);
+	bool ok = write_frame(pixels);
+
+	Tfree(MEM_FRAMEBUFFER, pixels, (size_t) disp_width * disp_height * 4);
+	if (!ok) {
+	    fprintf(stderr, "Can't write the video: %s\n", strerror(errno));
+	    stop_video();
+	    return;
+	}
+	frames++;
+
+	if (frame_time >= last_time) {
+	    stop_video();
+	    return;
+	}
+
+	/* Work from the frame count so that rounding errors don't add up */
+	frame_time = first_time + frames / fps;
+	if (frame_time > last_time) frame_time = last_time;
+	set_playing_time(frame_time);
+	do_scroll();
+    }
+}
+
+static void
+stop_video(void)
+{
+    if (fclose(video) != 0)
+	fprintf(stderr, "Can't write the video: %s\n", strerror(errno));
+    else
+	fprintf(stderr, "Wrote %ld frames of video\n", frames);
+    video = NULL;
+    free(planes);
+    planes = NULL;
+    gui_quit_main_loop();
+}
@@ -0,0 +1,33 @@
+/*	Copyright (C) 2018-2019 Martin Guy <martinwguy@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * video.h: Declarations for video.c
+ */
+
+#ifndef VIDEO_H
+
+typedef enum { VIDEO_Y4M, VIDEO_RGB } video_format_t;
+
+extern char *video_file;		/* --video: Write frames here */
+extern video_format_t video_format;	/* --video-format */
+
+extern void start_video(void);
+extern void video_work_done(void);
+
+#define VIDEO_H
+#endif
@@ -31,14 +31,28 @@ static void hann(float *data, int datalen);
 
 static float besseli0(float x);
 
-typedef struct stored_window {
+/*
+ * The windows we have made, most of which are in use by some spectrum.
+ *
+ * Calc threads look them up without taking the lock: a window's "users"
+ * count is raised before its pointer is used and a slot is only refilled,
+ * with the lock held, once its count can be set from 0 to -1, after which
+ * nobody can start using it until the new window is in place.
+ * When all the slots are in use, the window isn't stored but belongs to
+ * its caller, and release_window() frees it.
+ */
+#define MAX_STORED_WINDOWS 8
+
+typedef struct {
     window_function_t wfunc;
     int datalen;
     float *window;
-    struct stored_window *next;
+    volatile int users;		/* How many are using it, -1 while refilling */
+    unsigned long last_used;	/* For choosing which one to replace */
 } stored_window_t;
 
-stored_window_t *stored_windows = NULL;
+static stored_window_t stored_windows[MAX_STORED_WINDOWS];
+static unsigned long window_clock = 0;	/* Ticks at every use */
 
 const char *
 window_name(window_function_t w)
@@ -59,25 +73,42 @@ window_key(window_function_t w)
     return "KNHBD?"[w];
 }
 
-float *
-get_window(window_function_t wfunc, int datalen)
+/* Find a stored window and register as a user of it, or return NULL */
+static float *
+find_window(window_function_t wfunc, int datalen)
 {
-    float *new_window;	/* data to return */
+    stored_window_t *w;
 
-    lock_window();
+    for (w = stored_windows; w < stored_windows + MAX_STORED_WINDOWS; w++) {
+	int users;
 
-    /* See if it's already in the cache */
-    {	stored_window_t *w;
-	for (w = stored_windows; w != NULL; w=w->next) {
-	    if (w->wfunc == wfunc && w->datalen == datalen) {
-		unlock_window();
-		return(w->window);
-	    }
+	if (w->window == NULL || w->wfunc != wfunc || w->datalen != datalen)
+	    continue;
+
+	/* Become a user unless it's being refilled */
+	users = w->users;
+	while (users >= 0) {
+	    int was = __sync_val_compare_and_swap(&w->users, users, users + 1);
+	    if (was == users) break;
+	    users = was;
 	}
+	if (users < 0) continue;
+
+	/* It may have been refilled before we became a user of it */
+	if (w->window != NULL && w->wfunc == wfunc && w->datalen == datalen) {
+	    w->last_used = ++window_clock;
+	    return w->window;
+	}
+	__sync_fetch_and_sub(&w->users, 1);
     }
+    return NULL;
+}
 
-    /* If not, make a new one and fill it */
-    new_window = Malloc(datalen * sizeof(*new_window));
+/* Make a window of the requested type and size */
+static float *
+make_window(window_function_t wfunc, int datalen)
+{
+    float *new_window = Tmalloc(MEM_WINDOWS, datalen * sizeof(*new_window));
 
     switch (wfunc) {
     case KAISER:	kaiser(new_window, datalen);	break;
@@ -90,41 +121,114 @@ get_window(window_function_t wfunc, int datalen)
 	exit(1);
     };
 
-    if (new_window == NULL) {
-	fprintf(stderr, "Window creation failed.\n");
-	abort();
+    return new_window;
+}
+
+/*
+ * Return a window of the given type and size, making it if necessary.
+ * When the caller has finished with it, they must call release_window().
+ */
+float *
+get_window(window_function_t wfunc, int datalen)
+{
+    float *new_window;
+    stored_window_t *w, *victim;
+
+    /* The usual case: it's already there */
+    if ((new_window = find_window(wfunc, datalen)) != NULL)
+	return new_window;
+
+    lock_window();
+
+    /* Someone else may have made it while we were waiting for the lock */
+    if ((new_window = find_window(wfunc, datalen)) != NULL) {
+	unlock_window();
+	return new_window;
     }
 
-    /* Remember this window for future use */
-    {
-	stored_window_t *new = Malloc(sizeof(*new));
-	if (new == NULL) {
-	    fprintf(stderr, "Out of memory storing new window\n");
-	    exit(1);
+    new_window = make_window(wfunc, datalen);
+
+    /* Store it in an empty slot or in place of the least recently used
+     * one that nobody is using. */
+    for (;;) {
+	victim = NULL;
+	for (w = stored_windows; w < stored_windows + MAX_STORED_WINDOWS; w++) {
+	    if (w->users != 0) continue;
+	    if (w->window == NULL) { victim = w; break; }
+	    if (victim == NULL || w->last_used < victim->last_used) victim = w;
 	}
-	new->wfunc = wfunc;
-	new->datalen = datalen;
-	new->window = new_window;
-	new->next = stored_windows;
-	stored_windows = new;
+	if (victim == NULL) break;	/* All in use: the caller keeps it */
+	if (__sync_bool_compare_and_swap(&victim->users, 0, -1)) break;
+	/* Someone started using it: choose again */
+    }
+
+    if (victim != NULL) {
+	if (victim->window != NULL)
+	    Tfree(MEM_WINDOWS, victim->window,
+		  victim->datalen * sizeof(*victim->window));
+	victim->wfunc = wfunc;
+	victim->datalen = datalen;
+	victim->window = new_window;
+	victim->last_used = ++window_clock;
+	/* Publish it, with us as its first user */
+	__sync_synchronize();
+	victim->users = 1;
     }
 
     unlock_window();
     return new_window;
 }
 
+/* Say that we've finished with a window that get_window() returned */
+void
+release_window(float *window, window_function_t wfunc, int datalen)
+{
+    stored_window_t *w;
+
+    for (w = stored_windows; w < stored_windows + MAX_STORED_WINDOWS; w++) {
+	if (w->window == window) {
+	    __sync_fetch_and_sub(&w->users, 1);
+	    return;
+	}
+    }
+    /* It wasn't stored, so it's ours */
+    Tfree(MEM_WINDOWS, window, datalen * sizeof(*window));
+}
+
+/*
+ * Make a window before it's needed, so that the calc threads don't all
+ * wait for the first one of them to make it. Called from the main thread
+ * when the FFT size or window function changes, before scheduling columns.
+ */
+void
+prepare_window(window_function_t wfunc, int datalen)
+{
+    release_window(get_window(wfunc, datalen), wfunc, datalen);
+}
+
+/* Free the stored windows. Only called at exit, when nobody's using them. */
 void
 free_windows()
 {
-    stored_window_t *w, *next_w;
+    stored_window_t *w;
 
-    for (w = stored_windows; w != NULL; w=next_w) {
-	next_w = w->next;
-	free(w->window);
+    for (w = stored_windows; w < stored_windows + MAX_STORED_WINDOWS; w++) {
+	if (w->window != NULL)
+	    Tfree(MEM_WINDOWS, w->window, w->datalen * sizeof(*w->window));
+	w->window = NULL;
+	w->users = 0;
     }
-    stored_windows = NULL;
 }
 
+/*
+ * The windows are symmetric, so we only calculate the first half of each
+ * and mirror it into the second.
+ */
+#define mirror(data, datalen, k) ((data)[(datalen) - 1 - (k)] = (data)[k])
+
+/* How many samples of the Kaiser window to do at a time */
+#define KAISER_BLOCK 256
+
 static void
 kaiser(float *data, int datalen)
 {
@@ -135,10 +239,15 @@ kaiser(float *data, int datalen)
      *         besseli0(beta * sqrt(1 - (2*x/N).^2))
      * w(x) =  --------------------------------------,  -N/2 <= x <= N/2
      *                 besseli0(beta)
+     *
+     * besseli0(x) is the sum of the series ((x/2)^k / k!)^2, so we sum it
+     * across a block of samples at a time, one term after the other,
+     * which the compiler can vectorize.
      */
 
-    float two_n_on_N, denom;
-    int k;
+    float denom;
+    int half = (datalen + 1) / 2;
+    int start, k, i;
 
     denom = besseli0(beta);
 
@@ -147,12 +256,32 @@ kaiser(float *data, int datalen)
 	exit(1);
     }
 
-    for (k = 0; k < datalen ; k++) {
-	float n = k + 0.5 - 0.5 * datalen;
-	two_n_on_N = (2.0 * n) / datalen;
-	data[k] = besseli0(beta * sqrt(1.0 - two_n_on_N * two_n_on_N)) / denom;
-    }
+    for (start = 0; start < half; start += KAISER_BLOCK) {
+	float x2[KAISER_BLOCK];		/* (x/2)^2 */
+	float term[KAISER_BLOCK];
+	float sum[KAISER_BLOCK];
+	int n = half - start < KAISER_BLOCK ? half - start : KAISER_BLOCK;
+
+	for (i = 0; i < n; i++) {
+	    float two_n_on_N = (2.0 * (start + i + 0.5 - 0.5 * datalen))
+			       / datalen;
+	    x2[i] = 0.25 * beta * beta * (1.0 - two_n_on_N * two_n_on_N);
+	    term[i] = 1.0;
+	    sum[i] = 1.0;
+	}
+	for (k = 1; k < 25; k++) {
+	    float one_on_k2 = 1.0 / ((float) k * k);
 
+	    for (i = 0; i < n; i++) {
+		term[i] *= x2[i] * one_on_k2;
+		sum[i] += term[i];
+	    }
+	}
+	for (i = 0; i < n; i++) {
+	    data[start + i] = sum[i] / denom;
+	    mirror(data, datalen, start + i);
+	}
+    }
 }
 
 static void
@@ -167,7 +296,7 @@ nuttall(float *data, int datalen)
      *	http://en.wikipedia.org/wiki/Window_function
      */
 
-    for (k = 0; k < datalen ; k++) {
+    for (k = 0; k < (datalen + 1) / 2; k++) {
 	float scale;
 
 	scale = M_PI * k / (datalen - 1);
@@ -176,6 +305,7 @@ nuttall(float *data, int datalen)
 		- a[1] * cos(2.0 * scale)
 		+ a[2] * cos(4.0 * scale)
 		- a[3] * cos(6.0 * scale);
+	mirror(data, datalen, k);
     }
 }
 
@@ -190,8 +320,10 @@ hann(float *data, int datalen)
      *	http://en.wikipedia.org/wiki/Window_function
      */
 
-    for (k = 0; k < datalen ; k++)
+    for (k = 0; k < (datalen + 1) / 2; k++) {
 	data[k] = 0.5 * (1.0 - cos(2.0 * M_PI * k / (datalen - 1)));
+	mirror(data, datalen, k);
+    }
 }
 
 static void
@@ -202,9 +334,10 @@ blackman(float *data, int datalen)
     float alpha = .16;
 
     /* From sox spectrogram */
-    for (k = 0; k < datalen ; k++) {
+    for (k = 0; k < (datalen + 1) / 2; k++) {
 	float x = 2 * M_PI * k / m;
 	data[k] = 0.5 * ((1 - alpha) - cos(x) + alpha * cos(2 * x));
+	mirror(data, datalen, k);
     }
 }
 
@@ -30,6 +30,9 @@ typedef enum {
 } window_function_t;
 
 extern float *get_window(window_function_t wfunc, int datalen);
+extern void release_window(float *window, window_function_t wfunc,
+			   int datalen);
+extern void prepare_window(window_function_t wfunc, int datalen);
 extern void free_windows(void);
 extern const char *window_name(window_function_t wfunc);
 extern const char window_key(window_function_t wfunc);